@@ -17,6 +17,15 @@
 #include "model/rategamma.h"
 #include "gsl/mygsl.h"
 #include "utils/gzstream.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#if !defined WIN32 && !defined _WIN32 && !defined __WIN32__
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 
@@ -423,7 +432,8 @@ Alignment::Alignment(char *filename, char *sequence_type, InputType &intype, str
             readNexus(filename);
         } else if (intype == IN_FASTA) {
             cout << "Fasta format detected" << endl;
-            readFasta(filename, sequence_type);
+            if (!Params::getInstance().mmap_alignment || !readFastaMmap(filename, sequence_type))
+                readFasta(filename, sequence_type);
         } else if (intype == IN_PHYLIP) {
             cout << "Phylip format detected" << endl;
             if (Params::getInstance().phylip_sequential_format)
@@ -496,8 +506,8 @@ bool Alignment::isStandardGeneticCode() {
 void Alignment::buildSeqStates(bool add_unobs_const) {
 	string unobs_const;
 	if (add_unobs_const) unobs_const = getUnobservedConstPatterns();
-	seq_states.clear();
-	seq_states.resize(getNSeq());
+	vector<vector<int> > new_seq_states;
+	new_seq_states.resize(getNSeq());
 	for (int seq = 0; seq < getNSeq(); seq++) {
 		vector<bool> has_state;
 		has_state.resize(STATE_UNKNOWN+1, false);
@@ -505,11 +515,13 @@ void Alignment::buildSeqStates(bool add_unobs_const) {
 			has_state[at(site)[seq]] = true;
 		for (string::iterator it = unobs_const.begin(); it != unobs_const.end(); it++)
 			has_state[*it] = true;
-        seq_states[seq].clear();
 		for (int state = 0; state < STATE_UNKNOWN; state++)
 			if (has_state[state])
-				seq_states[seq].push_back(state);
+				new_seq_states[seq].push_back(state);
 	}
+	// only replace if changed: trees evaluated concurrently (ModelFinder) may read seq_states
+	if (new_seq_states != seq_states)
+		seq_states.swap(new_seq_states);
 }
 
 int Alignment::readNexus(char *filename) {
@@ -896,12 +908,14 @@ bool Alignment::addPattern(Pattern &pat, int site, int freq) {
             cout << "Site " << site << " contains only gaps or ambiguous characters" << endl;
         //return true;
     }
-    PatternIntMap::iterator pat_it = pattern_index.find(pat);
+    string packed;
+    pat.pack(packed);
+    PatternIntMap::iterator pat_it = pattern_index.find(packed);
     if (pat_it == pattern_index.end()) { // not found
         pat.frequency = freq;
         computeConst(pat);
         push_back(pat);
-        pattern_index[back()] = size()-1;
+        pattern_index[packed] = size()-1;
         site_pattern[site] = size()-1;
     } else {
         int index = pat_it->second;
@@ -1044,53 +1058,57 @@ void Alignment::regroupSitePattern(int groups, IntVector& site_group)
 }
 
 
+/** counts of the characters that determine the sequence type, see Alignment::detectSequenceType */
+struct SeqTypeCounts {
+    int64_t num_nuc, num_ungap, num_bin, num_alpha, num_digit;
+
+    SeqTypeCounts() : num_nuc(0), num_ungap(0), num_bin(0), num_alpha(0), num_digit(0) {}
+
+    inline void count(char ch) {
+        if (ch != '?' && ch != '-' && ch != '.' && ch != 'N' && ch != 'X' &&  ch != '~') num_ungap++;
+        if (ch == 'A' || ch == 'C' || ch == 'G' || ch == 'T' || ch == 'U')
+            num_nuc++;
+        if (ch == '0' || ch == '1')
+            num_bin++;
+
+        if (isalpha(ch)) num_alpha++;
+        if (isdigit(ch)) num_digit++;
+    }
+
+    void add(const SeqTypeCounts &counts) {
+        num_nuc += counts.num_nuc;
+        num_ungap += counts.num_ungap;
+        num_bin += counts.num_bin;
+        num_alpha += counts.num_alpha;
+        num_digit += counts.num_digit;
+    }
+
+    SeqType getSeqType() const {
+        // the structural alphabets (SEQ_STRUCT50, SEQ_STRUCT100) are never detected automatically
+        if (((double)num_nuc) / num_ungap > 0.9)
+            return SEQ_DNA;
+        if (((double)num_bin) / num_ungap > 0.9)
+            return SEQ_BINARY;
+        if (((double)num_alpha) / num_ungap > 0.9)
+            return SEQ_PROTEIN;
+
+        if (((double)(num_alpha+num_digit)) / num_ungap > 0.9)
+            return SEQ_MORPH;
+        return SEQ_UNKNOWN;
+    }
+};
+
 /**
 	detect the data type of the input sequences
 	@param sequences vector of strings
 	@return the data type of the input sequences
 */
 SeqType Alignment::detectSequenceType(StrVector &sequences) {
-    int num_nuc = 0;
-    int num_ungap = 0;
-    int num_bin = 0;
-    int num_alpha = 0;
-    int num_digit = 0;
-    int num_symbol50 =0;
-    int num_symbol100 =0;
-
-
+    SeqTypeCounts counts;
     for (StrVector::iterator it = sequences.begin(); it != sequences.end(); it++)
-        for (string::iterator i = it->begin(); i != it->end(); i++) {
-            if ((*i) != '?' && (*i) != '-' && (*i) != '.' && *i != 'N' && *i != 'X' &&  (*i) != '~') num_ungap++;
-            if ((*i) == 'A' || (*i) == 'C' || (*i) == 'G' || (*i) == 'T' || (*i) == 'U')
-                num_nuc++;
-            if ((*i) == '0' || (*i) == '1')
-                num_bin++;
-            
-            if (isalpha(*i)) num_alpha++;
-            if (isdigit(*i)) num_digit++;
-            // detect ascii symbols from struct50
-            if ()
-            // detect ascii symbols from struct100
-            if ()
-
-        }
-    if (((double)num_symbol50 + (double)num_symbol100 ) / num_ungap > 0.9)
-        return SEQ_STRUCT100;
-    
-    if (((double)num_symbol50) / num_ungap > 0.9)
-        return SEQ_STRUCT50;
-    
-    if (((double)num_nuc) / num_ungap > 0.9)
-        return SEQ_DNA;
-    if (((double)num_bin) / num_ungap > 0.9)
-        return SEQ_BINARY;
-    if (((double)num_alpha) / num_ungap > 0.9)
-        return SEQ_PROTEIN;
-    
-    if (((double)(num_alpha+num_digit)) / num_ungap > 0.9)
-        return SEQ_MORPH;
-    return SEQ_UNKNOWN;
+        for (string::iterator i = it->begin(); i != it->end(); i++)
+            counts.count(*i);
+    return counts.getSeqType();
 }
 
 void Alignment::buildStateMap(char *map, SeqType seq_type) {
@@ -1244,7 +1262,7 @@ char Alignment::convertState(char state, SeqType seq_type) {
     default:
         return STATE_INVALID;
 
-    case SEQ_STRUCT_50: // Structural alphabet 50
+    case SEQ_STRUCT50: // Structural alphabet 50
 
         loc = strchr(symbols_protein, state);
 
@@ -1255,7 +1273,7 @@ char Alignment::convertState(char state, SeqType seq_type) {
         else
             return STATE_UNKNOWN;
     
-    case SEQ_STRUCT_100: // Structural alphabet 100
+    case SEQ_STRUCT100: // Structural alphabet 100
         loc = strchr(symbols_protein, state);
 
         if (!loc) return STATE_INVALID; // unrecognize character
@@ -1264,15 +1282,6 @@ char Alignment::convertState(char state, SeqType seq_type) {
             return state;
         else
             return STATE_UNKNOWN;
-
-    case SEQ_MORPH: // Standard morphological character
-        loc = strchr(symbols_morph, state);
-
-        if (!loc) return STATE_INVALID; // unrecognize character
-        state = loc - symbols_morph;
-	    return state;
-    default:
-        return STATE_INVALID;
     }
 }
 
@@ -1474,48 +1483,8 @@ SeqType Alignment::getSeqType(const char *sequence_type) {
     return user_seq_type;
 }
 
-int Alignment::buildPattern(StrVector &sequences, char *sequence_type, int nseq, int nsite) {
-    int seq_id;
-    ostringstream err_str;
-    codon_table = NULL;
-    genetic_code = NULL;
-    non_stop_codon = NULL;
-
-
-    if (nseq != seq_names.size()) throw "Different number of sequences than specified";
-
-    /* now check that all sequence names are correct */
-    for (seq_id = 0; seq_id < nseq; seq_id ++) {
-        ostringstream err_str;
-        if (seq_names[seq_id] == "")
-            err_str << "Sequence number " << seq_id+1 << " has no names\n";
-        // check that all the names are different
-        for (int i = 0; i < seq_id; i++)
-            if (seq_names[i] == seq_names[seq_id])
-                err_str << "The sequence name " << seq_names[seq_id] << " is dupplicated\n";
-    }
-    if (err_str.str() != "")
-        throw err_str.str();
-
-
-    /* now check that all sequences have the same length */
-    for (seq_id = 0; seq_id < nseq; seq_id ++) {
-        if (sequences[seq_id].length() != nsite) {
-            err_str << "Sequence " << seq_names[seq_id] << " contains ";
-            if (sequences[seq_id].length() < nsite)
-                err_str << "not enough";
-            else
-                err_str << "too many";
-
-            err_str << " characters (" << sequences[seq_id].length() << ")\n";
-        }
-    }
-
-    if (err_str.str() != "")
-        throw err_str.str();
-
-    /* now check data type */
-    seq_type = detectSequenceType(sequences);
+bool Alignment::setSequenceType(SeqType detected_type, StrVector &sequences, char *sequence_type) {
+    seq_type = detected_type;
     switch (seq_type) {
     case SEQ_BINARY:
         num_states = 2;
@@ -1529,11 +1498,11 @@ int Alignment::buildPattern(StrVector &sequences, char *sequence_type, int nseq,
         num_states = 20;
         cout << "Alignment most likely contains protein sequences" << endl;
         break;
-    case SEQ_STRUCT_50:
+    case SEQ_STRUCT50:
         num_states = 50;
         cout << "Alignment most likely contains protein in struct alphabet 50" << endl;
         break;
-    case SEQ_STRUCT_100:
+    case SEQ_STRUCT100:
         num_states = 100;
         cout << "Alignment most likely contains proteins in struct alphabet 100" << endl;
         break;
@@ -1588,6 +1557,51 @@ int Alignment::buildPattern(StrVector &sequences, char *sequence_type, int nseq,
             outWarning("Your specified sequence type is different from the detected one");
         seq_type = user_seq_type;
     }
+    return nt2aa;
+}
+
+int Alignment::buildPattern(StrVector &sequences, char *sequence_type, int nseq, int nsite) {
+    int seq_id;
+    ostringstream err_str;
+    codon_table = NULL;
+    genetic_code = NULL;
+    non_stop_codon = NULL;
+
+
+    if (nseq != seq_names.size()) throw "Different number of sequences than specified";
+
+    /* now check that all sequence names are correct */
+    for (seq_id = 0; seq_id < nseq; seq_id ++) {
+        ostringstream err_str;
+        if (seq_names[seq_id] == "")
+            err_str << "Sequence number " << seq_id+1 << " has no names\n";
+        // check that all the names are different
+        for (int i = 0; i < seq_id; i++)
+            if (seq_names[i] == seq_names[seq_id])
+                err_str << "The sequence name " << seq_names[seq_id] << " is dupplicated\n";
+    }
+    if (err_str.str() != "")
+        throw err_str.str();
+
+
+    /* now check that all sequences have the same length */
+    for (seq_id = 0; seq_id < nseq; seq_id ++) {
+        if (sequences[seq_id].length() != nsite) {
+            err_str << "Sequence " << seq_names[seq_id] << " contains ";
+            if (sequences[seq_id].length() < nsite)
+                err_str << "not enough";
+            else
+                err_str << "too many";
+
+            err_str << " characters (" << sequences[seq_id].length() << ")\n";
+        }
+    }
+
+    if (err_str.str() != "")
+        throw err_str.str();
+
+    /* now check data type */
+    bool nt2aa = setSequenceType(detectSequenceType(sequences), sequences, sequence_type);
 
     // now convert to patterns
     int site, seq, num_gaps_only = 0;
@@ -1824,6 +1838,49 @@ int Alignment::readPhylipSequential(char *filename, char *sequence_type) {
     return buildPattern(sequences, sequence_type, nseq, nsite);
 }
 
+/**
+    cut down FASTA sequence names at the first white space if this keeps them unique
+    @param[in,out] seq_names sequence names
+*/
+static void shortenSeqNames(StrVector &seq_names) {
+    int i, j, step = 0;
+    StrVector new_seq_names, remain_seq_names;
+    new_seq_names.resize(seq_names.size());
+    remain_seq_names = seq_names;
+
+    for (step = 0; step < 4; step++) {
+        bool duplicated = false;
+        for (i = 0; i < seq_names.size(); i++) {
+            if (remain_seq_names[i].empty()) continue;
+            size_t pos = remain_seq_names[i].find_first_of(" \t");
+            if (pos == string::npos) {
+                new_seq_names[i] += remain_seq_names[i];
+                remain_seq_names[i] = "";
+            } else {
+                new_seq_names[i] += remain_seq_names[i].substr(0, pos);
+                remain_seq_names[i] = "_" + remain_seq_names[i].substr(pos+1);
+            }
+            // now check for duplication
+            if (!duplicated)
+            for (j = 0; j < i-1; j++)
+                if (new_seq_names[j] == new_seq_names[i]) {
+                    duplicated = true;
+                    break;
+                }
+        }
+        if (!duplicated) break;
+    }
+
+    if (step > 0) {
+        for (i = 0; i < seq_names.size(); i++)
+            if (seq_names[i] != new_seq_names[i]) {
+                cout << "NOTE: Change sequence name '" << seq_names[i] << "' -> " << new_seq_names[i] << endl;
+            }
+    }
+
+    seq_names = new_seq_names;
+}
+
 int Alignment::readFasta(char *filename, char *sequence_type) {
 
     StrVector sequences;
@@ -1867,47 +1924,299 @@ int Alignment::readFasta(char *filename, char *sequence_type) {
     in.exceptions(ios::failbit | ios::badbit);
     in.close();
 
-    // now try to cut down sequence name if possible
-    int i, j, step = 0;
-    StrVector new_seq_names, remain_seq_names;
-    new_seq_names.resize(seq_names.size());
-    remain_seq_names = seq_names;
+    shortenSeqNames(seq_names);
 
-    for (step = 0; step < 4; step++) {
-        bool duplicated = false;
-        for (i = 0; i < seq_names.size(); i++) {
-            if (remain_seq_names[i].empty()) continue;
-            size_t pos = remain_seq_names[i].find_first_of(" \t");
-            if (pos == string::npos) {
-                new_seq_names[i] += remain_seq_names[i];
-                remain_seq_names[i] = "";
-            } else {
-                new_seq_names[i] += remain_seq_names[i].substr(0, pos);
-                remain_seq_names[i] = "_" + remain_seq_names[i].substr(pos+1);
+    return buildPattern(sequences, sequence_type, seq_names.size(), sequences.front().length());
+}
+
+#if !defined WIN32 && !defined _WIN32 && !defined __WIN32__
+
+/** FASTA record in a memory-mapped file whose sequence lines have equal width */
+struct MmapFastaRecord {
+    /** sequence name, without '>' */
+    const char *header;
+    size_t header_len;
+    /** first sequence character */
+    const char *seq;
+    /** number of characters per full line */
+    size_t line_width;
+    /** line width plus length of line break */
+    size_t line_stride;
+    /** number of sites */
+    size_t length;
+
+    inline char at(size_t site) const {
+        return seq[(site / line_width) * line_stride + site % line_width];
+    }
+
+    /**
+        parse the layout of a record
+        @param begin position of '>'
+        @param end end of the record
+        @return false if lines have different widths or unsupported characters
+    */
+    bool parse(const char *begin, const char *end) {
+        header = begin+1;
+        const char *eol = (const char*)memchr(header, '\n', end-header);
+        if (!eol) return false;
+        header_len = eol - header;
+        if (header_len > 0 && header[header_len-1] == '\r') header_len--;
+        seq = eol+1;
+        line_width = line_stride = length = 0;
+        bool last_line = false;
+        for (const char *line = seq; line < end; ) {
+            eol = (const char*)memchr(line, '\n', end-line);
+            const char *next = eol ? eol+1 : end;
+            const char *content_end = (eol && eol > line && eol[-1] == '\r') ? eol-1 : (eol ? eol : end);
+            size_t width = content_end - line;
+            if (width == 0) {
+                // only empty lines may follow
+                last_line = true;
+                line = next;
+                continue;
             }
-            // now check for duplication
-            if (!duplicated)
-            for (j = 0; j < i-1; j++)
-                if (new_seq_names[j] == new_seq_names[i]) {
-                    duplicated = true;
-                    break;
-                }
+            if (last_line) return false;
+            if (line_width == 0) {
+                line_width = width;
+                line_stride = next - line;
+            } else if (width > line_width || (width == line_width && (size_t)(next-line) != line_stride && eol))
+                return false;
+            if (width < line_width) last_line = true;
+            for (const char *c = line; c < content_end; c++)
+                if (!isalnum(*c) && *c != '-' && *c != '?' && *c != '.' && *c != '*' && *c != '~')
+                    return false;
+            length += width;
+            line = next;
         }
-        if (!duplicated) break;
+        return line_width > 0;
     }
+};
 
-    if (step > 0) {
-        for (i = 0; i < seq_names.size(); i++)
-            if (seq_names[i] != new_seq_names[i]) {
-                cout << "NOTE: Change sequence name '" << seq_names[i] << "' -> " << new_seq_names[i] << endl;
+int Alignment::readFastaMmap(char *filename, char *sequence_type) {
+    if (sequence_type && strcmp(sequence_type, "") != 0 && strcmp(sequence_type, "DNA") != 0 &&
+        strcmp(sequence_type, "NT") != 0 && strcmp(sequence_type, "AA") != 0 &&
+        strcmp(sequence_type, "PROT") != 0 && strcmp(sequence_type, "BIN") != 0)
+        return 0;
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size < 2) {
+        close(fd);
+        return 0;
+    }
+    size_t file_size = file_stat.st_size;
+    const char *data = (const char*)mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return 0;
+    // sites are compressed column by column, striding over all sequences
+    madvise((void*)data, file_size, MADV_RANDOM);
+    // gzip-compressed file
+    if ((unsigned char)data[0] == 0x1f && (unsigned char)data[1] == 0x8b) {
+        munmap((void*)data, file_size);
+        return 0;
+    }
+
+    int num_threads = 1;
+#ifdef _OPENMP
+    num_threads = omp_get_max_threads();
+#endif
+
+    // locate records in parallel
+    vector<vector<size_t> > thread_starts(num_threads);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static, 1) num_threads(num_threads)
+#endif
+    for (int t = 0; t < num_threads; t++) {
+        size_t begin = file_size * t / num_threads, end = file_size * (t+1) / num_threads;
+        if (begin == 0 && data[0] == '>')
+            thread_starts[t].push_back(0);
+        for (const char *eol = data+begin; eol < data+end; eol++) {
+            eol = (const char*)memchr(eol, '\n', data+end-eol);
+            if (!eol) break;
+            if (eol+1 < data+file_size && eol[1] == '>')
+                thread_starts[t].push_back(eol+1-data);
+        }
+    }
+    vector<size_t> starts;
+    for (int t = 0; t < num_threads; t++)
+        starts.insert(starts.end(), thread_starts[t].begin(), thread_starts[t].end());
+
+    vector<MmapFastaRecord> records(starts.size());
+    bool regular = !starts.empty() && starts[0] == 0;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) num_threads(num_threads) reduction(&&: regular)
+#endif
+    for (int seq = 0; seq < starts.size(); seq++) {
+        size_t end = (seq+1 < starts.size()) ? starts[seq+1] : file_size;
+        regular = records[seq].parse(data + starts[seq], data + end) && regular;
+    }
+    for (int seq = 1; seq < records.size() && regular; seq++)
+        regular = records[seq].length == records[0].length;
+    if (!regular) {
+        cout << "NOTE: Sequence lines differ in width or contain special characters, reading alignment in memory" << endl;
+        munmap((void*)data, file_size);
+        return 0;
+    }
+
+    int nseq = records.size();
+    size_t nsite = records[0].length;
+
+    // detect the sequence type from all characters, as buildPattern
+    SeqTypeCounts type_counts;
+#ifdef _OPENMP
+#pragma omp parallel num_threads(num_threads)
+#endif
+    {
+        SeqTypeCounts thread_counts;
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+        for (int seq = 0; seq < nseq; seq++) {
+            MmapFastaRecord &rec = records[seq];
+            for (size_t site = 0; site < nsite; site += rec.line_width) {
+                const char *line = rec.seq + (site / rec.line_width) * rec.line_stride;
+                size_t width = min(rec.line_width, nsite - site);
+                for (size_t i = 0; i < width; i++)
+                    thread_counts.count(toupper(line[i]));
             }
+        }
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+        type_counts.add(thread_counts);
+    }
+    SeqType detected_type = type_counts.getSeqType();
+    if (detected_type != SEQ_DNA && detected_type != SEQ_PROTEIN && detected_type != SEQ_BINARY) {
+        munmap((void*)data, file_size);
+        return 0;
     }
 
-    seq_names = new_seq_names;
+    cout << "Memory-mapped reading of " << nseq << " sequences with " << num_threads << " threads" << endl;
 
-    return buildPattern(sequences, sequence_type, seq_names.size(), sequences.front().length());
+    seq_names.resize(nseq);
+    for (int seq = 0; seq < nseq; seq++) {
+        seq_names[seq].assign(records[seq].header, records[seq].header_len);
+        trimString(seq_names[seq]);
+    }
+    shortenSeqNames(seq_names);
+
+    ostringstream err_str;
+    map<string, int> name_ids;
+    for (int seq = 0; seq < nseq; seq++) {
+        if (seq_names[seq] == "")
+            err_str << "Sequence number " << seq+1 << " has no names\n";
+        else if (!name_ids.insert(make_pair(seq_names[seq], seq)).second)
+            err_str << "The sequence name " << seq_names[seq] << " is dupplicated\n";
+    }
+    if (err_str.str() != "") {
+        munmap((void*)data, file_size);
+        throw err_str.str();
+    }
+
+    codon_table = NULL;
+    genetic_code = NULL;
+    non_stop_codon = NULL;
+    // no sequences needed: morphological data are read in memory
+    StrVector no_sequences;
+    setSequenceType(detected_type, no_sequences, sequence_type);
+
+    char char_to_state[NUM_CHAR];
+    computeUnknownState();
+    buildStateMap(char_to_state, seq_type);
+    // sequences are not converted to upper case
+    for (int ch = 'a'; ch <= 'z'; ch++)
+        if (char_to_state[ch] == STATE_INVALID)
+            char_to_state[ch] = char_to_state[toupper(ch)];
+
+    // compress consecutive blocks of sites into per-thread pattern shards
+    vector<vector<Pattern> > shard_patterns(num_threads);
+    vector<IntVector> shard_first_site(num_threads), shard_site_ptn(num_threads);
+    vector<string> shard_errors(num_threads);
+    IntVector shard_num_errors(num_threads, 0);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static, 1) num_threads(num_threads)
+#endif
+    for (int t = 0; t < num_threads; t++) {
+        size_t site_start = nsite * t / num_threads, site_end = nsite * (t+1) / num_threads;
+        PatternIntMap shard_index;
+        vector<Pattern> &patterns = shard_patterns[t];
+        ostringstream shard_err;
+        Pattern pat;
+        pat.resize(nseq);
+        string packed;
+        for (size_t site = site_start; site < site_end; site++) {
+            for (int seq = 0; seq < nseq; seq++) {
+                char ch = records[seq].at(site);
+                char state = char_to_state[(unsigned char)ch];
+                if (state == STATE_INVALID) {
+                    if (shard_num_errors[t] < 100)
+                        shard_err << "Sequence " << seq_names[seq] << " has invalid character " << ch
+                                  << " at site " << site+1 << endl;
+                    shard_num_errors[t]++;
+                }
+                pat[seq] = state;
+            }
+            pat.pack(packed);
+            PatternIntMap::iterator pat_it = shard_index.find(packed);
+            if (pat_it == shard_index.end()) {
+                shard_index[packed] = patterns.size();
+                shard_site_ptn[t].push_back(patterns.size());
+                shard_first_site[t].push_back(site);
+                patterns.push_back(pat);
+                patterns.back().frequency = 1;
+            } else {
+                patterns[pat_it->second].frequency++;
+                shard_site_ptn[t].push_back(pat_it->second);
+            }
+        }
+        shard_errors[t] = shard_err.str();
+    }
+    munmap((void*)data, file_size);
+
+    int num_error = 0;
+    for (int t = 0; t < num_threads; t++) {
+        if (num_error < 100)
+            err_str << shard_errors[t];
+        num_error += shard_num_errors[t];
+    }
+    if (num_error > 100)
+        err_str << "...many more..." << endl;
+    if (num_error)
+        throw err_str.str();
+
+    // merge shards in site order, giving the same pattern order as buildPattern
+    clear();
+    pattern_index.clear();
+    site_pattern.resize(nsite, -1);
+    int num_gaps_only = 0;
+    for (int t = 0; t < num_threads; t++) {
+        vector<Pattern> &patterns = shard_patterns[t];
+        for (int ptn = 0; ptn < patterns.size(); ptn++) {
+            int freq = patterns[ptn].frequency;
+            if (addPattern(patterns[ptn], shard_first_site[t][ptn], freq))
+                num_gaps_only += freq;
+        }
+        size_t site = nsite * t / num_threads;
+        for (auto it = shard_site_ptn[t].begin(); it != shard_site_ptn[t].end(); it++, site++)
+            site_pattern[site] = site_pattern[shard_first_site[t][*it]];
+        patterns.clear();
+    }
+    if (num_gaps_only)
+        cout << "WARNING: " << num_gaps_only << " sites contain only gaps or ambiguous characters." << endl;
+    return 1;
+}
+
+#else
+
+int Alignment::readFastaMmap(char *filename, char *sequence_type) {
+    return 0;
 }
 
+#endif
+
 int Alignment::readClustal(char *filename, char *sequence_type) {
 
 
@@ -3532,7 +3841,9 @@ string Alignment::getUnobservedConstPatterns() {
     {
 		Pattern pat;
 		pat.resize(getNSeq(), state);
-		if (pattern_index.find(pat) == pattern_index.end()) {
+		string packed;
+		pat.pack(packed);
+		if (pattern_index.find(packed) == pattern_index.end()) {
 			// constant pattern is unobserved
 			ret.push_back(state);
 		}
@@ -3589,7 +3900,10 @@ double Alignment::computeObsDist(int seq1, int seq2) {
 }
 
 double Alignment::computeJCDist(int seq1, int seq2) {
-    double obs_dist = computeObsDist(seq1, seq2);
+    return correctJCDist(computeObsDist(seq1, seq2));
+}
+
+double Alignment::correctJCDist(double obs_dist) {
     double z = (double)num_states / (num_states-1);
     double x = 1.0 - (z * obs_dist);
 
@@ -3605,6 +3919,127 @@ double Alignment::computeJCDist(int seq1, int seq2) {
     return -log(x) / z;
 }
 
+/** number of sequences per tile in computeObsDistMatrix */
+const int OBS_DIST_TILE = 32;
+
+static inline int popcount64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcountll(x);
+#else
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (int)((x * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+/** square distance matrix for Alignment::computeObsDistTiles() */
+struct SquareDistMatrix {
+    double *dist_mat;
+    int nseqs;
+    inline void set(int seq1, int seq2, double dist) {
+        dist_mat[(size_t)seq1*nseqs + seq2] = dist_mat[(size_t)seq2*nseqs + seq1] = dist;
+    }
+};
+
+bool Alignment::computeObsDistMatrix(double *dist_mat, bool jc_correct) {
+    SquareDistMatrix square = {dist_mat, (int)getNSeq()};
+    if (!computeObsDistTiles(square, jc_correct))
+        return false;
+    for (int seq = 0; seq < square.nseqs; seq++)
+        dist_mat[(size_t)seq*square.nseqs + seq] = 0.0;
+    return true;
+}
+
+bool Alignment::computeObsDistMatrix(CondensedDistMatrix &dist_mat, bool jc_correct) {
+    ASSERT(dist_mat.getNTaxa() == getNSeq());
+    return computeObsDistTiles(dist_mat, jc_correct);
+}
+
+template <class Matrix>
+bool Alignment::computeObsDistTiles(Matrix &dist_mat, bool jc_correct) {
+    if (seq_type == SEQ_POMO || isSuperAlignment() || num_states < 2)
+        return false;
+    int nseqs = getNSeq();
+    int nptn = size();
+    int nplanes = 1;
+    while ((1 << nplanes) < num_states)
+        nplanes++;
+
+    // every pattern is expanded into frequency columns, 64 columns per word
+    vector<size_t> ptn_col(nptn+1, 0);
+    for (int ptn = 0; ptn < nptn; ptn++)
+        ptn_col[ptn+1] = ptn_col[ptn] + at(ptn).frequency;
+    size_t nwords = (ptn_col[nptn] + 63) / 64;
+    size_t block = (nplanes+1) * nwords;
+
+    // per sequence: the valid-state bits followed by nplanes bit planes of the state
+    vector<uint64_t> bits(block * nseqs, 0);
+    int seq;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (seq = 0; seq < nseqs; seq++) {
+        uint64_t *seq_bits = &bits[block * seq];
+        for (int ptn = 0; ptn < nptn; ptn++) {
+            int state = at(ptn)[seq];
+            if (state >= num_states)
+                continue;
+            for (size_t col = ptn_col[ptn]; col < ptn_col[ptn+1]; col++) {
+                uint64_t mask = 1ULL << (col & 63);
+                seq_bits[col/64] |= mask;
+                for (int plane = 0; plane < nplanes; plane++)
+                    if (state & (1 << plane))
+                        seq_bits[(plane+1)*nwords + col/64] |= mask;
+            }
+        }
+    }
+
+    // tiles of sequence pairs, the upper triangle only
+    int ntiles = (nseqs + OBS_DIST_TILE - 1) / OBS_DIST_TILE;
+    vector<pair<int,int> > tiles;
+    for (int t1 = 0; t1 < ntiles; t1++)
+        for (int t2 = t1; t2 < ntiles; t2++)
+            tiles.push_back(make_pair(t1, t2));
+    int tile, num_tiles = tiles.size();
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (tile = 0; tile < num_tiles; tile++) {
+        int begin1 = tiles[tile].first * OBS_DIST_TILE;
+        int end1 = min(begin1 + OBS_DIST_TILE, nseqs);
+        int begin2 = tiles[tile].second * OBS_DIST_TILE;
+        int end2 = min(begin2 + OBS_DIST_TILE, nseqs);
+        for (int seq1 = begin1; seq1 < end1; seq1++) {
+            uint64_t *bits1 = &bits[block * seq1];
+            for (int seq2 = max(begin2, seq1+1); seq2 < end2; seq2++) {
+                uint64_t *bits2 = &bits[block * seq2];
+                int diff_pos = 0, total_pos = 0;
+                for (size_t w = 0; w < nwords; w++) {
+                    uint64_t both = bits1[w] & bits2[w];
+                    uint64_t diff = 0;
+                    for (int plane = 1; plane <= nplanes; plane++)
+                        diff |= bits1[plane*nwords + w] ^ bits2[plane*nwords + w];
+                    total_pos += popcount64(both);
+                    diff_pos += popcount64(diff & both);
+                }
+                double dist;
+                if (!total_pos) {
+                    if (verbose_mode >= VB_MED)
+                        outWarning("No overlapping characters between " + getSeqName(seq1) + " and " + getSeqName(seq2));
+                    dist = MAX_GENETIC_DIST;
+                } else {
+                    dist = ((double)diff_pos) / total_pos;
+                    if (jc_correct)
+                        dist = correctJCDist(dist);
+                }
+                dist_mat.set(seq1, seq2, dist);
+            }
+        }
+    }
+    return true;
+}
+
 void Alignment::printDist(ostream &out, double *dist_mat) {
     int nseqs = getNSeq();
     int max_len = getMaxSeqNameLength();
@@ -3716,6 +4151,9 @@ double Alignment::readDist(istream &in, double *dist_mat) {
 double Alignment::readDist(const char *file_name, double *dist_mat) {
     double longest_dist = 0.0;
 
+    if (CondensedDistMatrix::isBinaryFile(file_name))
+        return readBinaryDist(file_name, dist_mat);
+
     try {
         ifstream in;
         in.exceptions(ios::failbit | ios::badbit);
@@ -3733,6 +4171,34 @@ double Alignment::readDist(const char *file_name, double *dist_mat) {
     return longest_dist;
 }
 
+double Alignment::readBinaryDist(const char *file_name, double *dist_mat) {
+    CondensedDistMatrix file_mat;
+    file_mat.load(file_name);
+    int nseqs = getNSeq();
+    if (file_mat.getNTaxa() != nseqs)
+        outError("Distance file has different number of taxa");
+    // map the taxa of the file to the sequences of the alignment
+    std::map<string, int> map_seqName_ID;
+    for (int id = 0; id < nseqs; id++)
+        map_seqName_ID[file_mat.getNames()[id]] = id;
+    IntVector file_id(nseqs);
+    for (int seq = 0; seq < nseqs; seq++) {
+        if (map_seqName_ID.count(getSeqName(seq)) == 0)
+            outError("Could not find taxa name " + getSeqName(seq));
+        file_id[seq] = map_seqName_ID[getSeqName(seq)];
+    }
+    double longest_dist = 0.0;
+    for (int seq1 = 0; seq1 < nseqs; seq1++)
+        for (int seq2 = 0; seq2 < nseqs; seq2++) {
+            double dist = file_mat.get(file_id[seq1], file_id[seq2]);
+            dist_mat[(size_t)seq1*nseqs + seq2] = dist;
+            if (dist > longest_dist)
+                longest_dist = dist;
+        }
+    cout << "Distance matrix was read from " << file_name << endl;
+    return longest_dist;
+}
+
 // TODO DS: This only works when the sampling method is SAMPLING_SAMPLED or when
 // the virtual population size is also the sample size (for every species and
 // every site).
@@ -4442,7 +4908,9 @@ void Alignment::multinomialProb(Alignment refAlign, double &prob)
     int index;
     for ( iterator it = begin(); it != end() ; it++)
     {
-        PatternIntMap::iterator pat_it = refAlign.pattern_index.find((*it));
+        string packed;
+        it->pack(packed);
+        PatternIntMap::iterator pat_it = refAlign.pattern_index.find(packed);
         if ( pat_it == refAlign.pattern_index.end() ) //not found ==> error
             outError("Pattern in the current alignment is not found in the reference alignment!");
         sumFac += logFac((*it).frequency);
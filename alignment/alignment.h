@@ -17,6 +17,7 @@
 #include "pattern.h"
 #include "ncl/ncl.h"
 #include "utils/tools.h"
+#include "utils/distmatrix.h"
 
 // IMPORTANT: refactor STATE_UNKNOWN
 //const char STATE_UNKNOWN = 126;
@@ -41,22 +42,28 @@ enum SeqType {
 
 
 #ifdef USE_HASH_MAP
-struct hashPattern {
-	size_t operator()(const vector<StateType> &sp) const {
-		size_t sum = 0;
-		for (Pattern::const_iterator it = sp.begin(); it != sp.end(); it++)
-			sum = (*it) + (sum << 6) + (sum << 16) - sum;
+/** hash of a pattern packed by Pattern::pack(), working on 8-byte words */
+struct hashPackedPattern {
+	size_t operator()(const string &packed) const {
+		size_t sum = 0, i;
+		uint64_t word;
+		for (i = 0; i+8 <= packed.size(); i += 8) {
+			memcpy(&word, packed.data()+i, 8);
+			sum = word + (sum << 6) + (sum << 16) - sum;
+		}
+		for (; i < packed.size(); i++)
+			sum = (unsigned char)packed[i] + (sum << 6) + (sum << 16) - sum;
 		return sum;
 	}
 };
 typedef unordered_map<string, int> StringIntMap;
 typedef unordered_map<string, double> StringDoubleHashMap;
-typedef unordered_map<vector<StateType>, int, hashPattern> PatternIntMap;
+typedef unordered_map<string, int, hashPackedPattern> PatternIntMap;
 typedef unordered_map<uint32_t, uint32_t> IntIntMap;
 #else
 typedef map<string, int> StringIntMap;
 typedef map<string, double> StringDoubleHashMap;
-typedef map<vector<StateType>, int> PatternIntMap;
+typedef map<string, int> PatternIntMap;
 typedef map<uint32_t, uint32_t> IntIntMap;
 #endif
 
@@ -166,6 +173,16 @@ public:
      */
     int readFasta(char *filename, char *sequence_type);
 
+    /**
+            read the alignment in FASTA format from a memory-mapped file without keeping
+            the sequences in memory; records are located and sites compressed into patterns
+            in parallel. Only DNA, protein and binary data with equal line widths are supported
+            @param filename file name
+            @param sequence_type type of the sequence, either "BIN", "DNA", "AA", or NULL
+            @return 1 on success, 0 if the file must be read by readFasta instead
+     */
+    int readFastaMmap(char *filename, char *sequence_type);
+
     /** 
      * Read the alignment in counts format (PoMo).
      *
@@ -229,6 +246,15 @@ public:
      ****************************************************************************/
     SeqType detectSequenceType(StrVector &sequences);
 
+    /**
+            set the detected or user-specified sequence type and build the codon tables if needed
+            @param detected_type sequence type detected by detectSequenceType
+            @param sequences sequences, to count the states of morphological data
+            @param sequence_type user-specified sequence type, or NULL
+            @return true if DNA sequences must be translated into amino acids
+     */
+    bool setSequenceType(SeqType detected_type, StrVector &sequences, char *sequence_type);
+
     void computeUnknownState();
 
     void buildStateMap(char *map, SeqType seq_type);
@@ -535,6 +561,30 @@ public:
      */
     double computeJCDist(int seq1, int seq2);
 
+    /**
+            @param obs_dist observed distance between two sequences
+            @return Juke-Cantor correction of obs_dist
+     */
+    double correctJCDist(double obs_dist);
+
+    /**
+            compute the observed or Juke-Cantor distances between all pairs of sequences at once.
+            Sequences are bit-sliced (one bit per site for validity and for each bit of the state)
+            and mismatches are counted by popcount, with the pairs processed in tiles of sequences
+            that fit into cache. Same results as computeObsDist() and computeJCDist().
+            @param dist_mat (OUT) nseq*nseq distance matrix
+            @param jc_correct true to return Juke-Cantor distances, false for observed distances
+            @return false if not supported for this alignment (PoMo or partitioned alignment),
+                    in which case dist_mat is not touched
+     */
+    bool computeObsDistMatrix(double *dist_mat, bool jc_correct = false);
+
+    /**
+            like computeObsDistMatrix(double*, bool) but for a condensed distance matrix
+            @param dist_mat (OUT) condensed matrix, already created for nseq taxa
+     */
+    bool computeObsDistMatrix(CondensedDistMatrix &dist_mat, bool jc_correct = false);
+
     /**
             abstract function to compute the distance between 2 sequences. The default return
             Juke-Cantor corrected distance.
@@ -576,6 +626,14 @@ public:
      */
     double readDist(istream &in, double *dist_mat);
 
+    /**
+            read a binary distance file (see CondensedDistMatrix) into a square matrix
+            @param file_name distance file name
+            @param dist_mat (OUT) distance matrix, in the order of sequences in the alignment
+            @return the longest distance
+     */
+    double readBinaryDist(const char *file_name, double *dist_mat);
+
 
     /****************************************************************************
             some statistics
@@ -830,6 +888,13 @@ protected:
 	 */
 	void initCodon(char *gene_code_id);
 
+    /**
+            implementation of computeObsDistMatrix()
+            @param dist_mat (OUT) matrix with a set(seq1, seq2, dist) function
+     */
+    template <class Matrix>
+    bool computeObsDistTiles(Matrix &dist_mat, bool jc_correct);
+
 };
 
 
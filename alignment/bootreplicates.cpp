@@ -0,0 +1,200 @@
+/***************************************************************************
+ *   Copyright (C) 2009-2019 by                                            *
+ *   BUI Quang Minh <minh.bui@univie.ac.at>                                *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "bootreplicates.h"
+#include "tree/phylotree.h"
+#include "superalignment.h"
+#include "gsl/mygsl.h"
+#include <string.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/** maximal number of patterns in a block */
+const int BOOT_BLOCK_SIZE = 1024;
+
+/** SplitMix64 finalizer */
+static inline uint64_t mix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/** counter-based generator: the i-th number of a key is a hash of the key and i */
+struct CounterRng {
+    uint64_t key;
+    uint64_t counter;
+};
+
+static double uniformCounterRng(void *state) {
+    CounterRng *rng = (CounterRng*)state;
+    rng->counter++;
+    uint64_t z = mix64(rng->key + rng->counter*0x9e3779b97f4a7c15ULL);
+    // 53 random bits in [0,1)
+    return (z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+BootstrapReplicates::BootstrapReplicates() {
+    num_reps = 0;
+    key = 0;
+    orig_first = false;
+}
+
+void BootstrapReplicates::init(Alignment *aln, size_t num_reps, int seed, double scale, const char *spec) {
+    this->num_reps = num_reps;
+    key = mix64(mix64((uint64_t)seed) + (uint64_t)round(scale*1000));
+    orig_first = (scale == 1.0);
+    block_begin.clear();
+    ptn_freq.clear();
+    block_sites.clear();
+    stored.clear();
+    block_site_begin.clear();
+    site_ptn.clear();
+
+    // the partitions, whose sites are resampled separately
+    vector<Alignment*> parts;
+    if (aln->isSuperAlignment())
+        parts = ((SuperAlignment*)aln)->partitions;
+    else
+        parts.push_back(aln);
+
+    IntVector part_sites, part_first_block;
+    int nptn = 0;
+    for (vector<Alignment*>::iterator it = parts.begin(); it != parts.end(); it++) {
+        part_first_block.push_back(block_begin.size());
+        part_sites.push_back((int)round(scale * (*it)->getNSite()));
+        for (int ptn = 0; ptn < (*it)->getNPattern(); ptn++) {
+            if (ptn % BOOT_BLOCK_SIZE == 0)
+                block_begin.push_back(nptn + ptn);
+            ptn_freq.push_back((*it)->at(ptn).frequency);
+        }
+        nptn += (*it)->getNPattern();
+    }
+    part_first_block.push_back(block_begin.size());
+    block_begin.push_back(nptn);
+
+    if (spec || Params::getInstance().jackknife_prop > 0.0) {
+        // not a plain resampling of sites: store the replicates
+        string scale_spec;
+        if (scale != 1.0) {
+            ASSERT(!spec);
+            scale_spec = "SCALE=" + convertDoubleToString(scale);
+            spec = scale_spec.c_str();
+        }
+        stored.resize(num_reps*nptn);
+        size_t rep;
+#ifdef _OPENMP
+        #pragma omp parallel private(rep) if(nptn > 10000)
+        {
+        int *rstream;
+        init_random(seed + omp_get_thread_num(), false, &rstream);
+        #pragma omp for schedule(static)
+#else
+        int *rstream = randstream;
+#endif
+        for (rep = 0; rep < num_reps; rep++)
+            if (rep == 0 && orig_first)
+                aln->getPatternFreq(&stored[rep*nptn]);
+            else
+                aln->createBootstrapAlignment(&stored[rep*nptn], spec, rstream);
+#ifdef _OPENMP
+        finish_random(rstream);
+        }
+#endif
+        return;
+    }
+
+    int nblocks = getNBlocks();
+    DoubleVector block_freq(nblocks, 0.0);
+    block_site_begin.clear();
+    site_ptn.clear();
+    for (int block = 0; block < nblocks; block++) {
+        block_site_begin.push_back(site_ptn.size());
+        int nsite = 0;
+        for (int ptn = block_begin[block]; ptn < block_begin[block+1]; ptn++)
+            nsite += round(ptn_freq[ptn]);
+        block_freq[block] = nsite;
+        // as Alignment::createBootstrapAlignment: resample the sites unless they are much more than the patterns
+        if (nsite/8 < block_begin[block+1] - block_begin[block])
+            for (int ptn = block_begin[block]; ptn < block_begin[block+1]; ptn++)
+                site_ptn.insert(site_ptn.end(), (int)round(ptn_freq[ptn]), ptn - block_begin[block]);
+    }
+    block_site_begin.push_back(site_ptn.size());
+
+    block_sites.resize(num_reps*nblocks);
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static)
+#endif
+    for (size_t rep = 0; rep < num_reps; rep++) {
+        uint32_t *sites = &block_sites[rep*nblocks];
+        if (rep == 0 && orig_first) {
+            for (int block = 0; block < nblocks; block++)
+                sites[block] = round(block_freq[block]);
+            continue;
+        }
+        for (int part = 0; part < parts.size(); part++) {
+            int first = part_first_block[part], last = part_first_block[part+1];
+            if (last - first == 1) {
+                sites[first] = part_sites[part];
+                continue;
+            }
+            // the block keys are 0..nblocks-1, the partitions use the following ones
+            CounterRng rng;
+            rng.key = mix64(mix64(key + rep) + nblocks + part);
+            rng.counter = 0;
+            gsl_ran_multinomial_gen(last - first, part_sites[part], &block_freq[first], &sites[first],
+                uniformCounterRng, &rng);
+        }
+    }
+}
+
+size_t BootstrapReplicates::getMemory() {
+    return block_sites.size()*sizeof(uint32_t) + stored.size()*sizeof(int) + ptn_freq.size()*sizeof(double) +
+        site_ptn.size()*sizeof(int);
+}
+
+void BootstrapReplicates::getCounts(size_t rep, int block, int *counts) {
+    ASSERT(rep < num_reps);
+    int begin = block_begin[block], end = block_begin[block+1];
+    if (!stored.empty()) {
+        size_t nptn = block_begin.back();
+        memcpy(counts, &stored[rep*nptn + begin], (end - begin)*sizeof(int));
+        return;
+    }
+    if (rep == 0 && orig_first) {
+        for (int ptn = begin; ptn < end; ptn++)
+            counts[ptn - begin] = round(ptn_freq[ptn]);
+        return;
+    }
+    CounterRng rng;
+    rng.key = mix64(mix64(key + rep) + block);
+    rng.counter = 0;
+    uint32_t nsite = block_sites[rep*getNBlocks() + block];
+    int site_begin = block_site_begin[block];
+    int block_nsite = block_site_begin[block+1] - site_begin;
+    if (block_nsite > 0) {
+        memset(counts, 0, (end - begin)*sizeof(int));
+        for (uint32_t site = 0; site < nsite; site++)
+            counts[site_ptn[site_begin + (int)(uniformCounterRng(&rng) * block_nsite)]]++;
+    } else {
+        gsl_ran_multinomial_gen(end - begin, nsite, &ptn_freq[begin],
+            (unsigned int*)counts, uniformCounterRng, &rng);
+    }
+}
@@ -0,0 +1,118 @@
+/***************************************************************************
+ *   Copyright (C) 2009-2019 by                                            *
+ *   BUI Quang Minh <minh.bui@univie.ac.at>                                *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef BOOTREPLICATES_H
+#define BOOTREPLICATES_H
+
+#include "alignment.h"
+
+/**
+    Bootstrap replicates of the pattern counts of an alignment for the tree topology
+    tests, regenerated on demand instead of stored.
+    The patterns are split into blocks, which do not cross partitions of a super alignment.
+    A replicate resamples the sites of each partition: the number of sites falling into
+    each block is drawn first (multinomial) and kept (#replicates x #blocks), then the
+    counts of the patterns of a block are drawn when needed, by multinomial sampling or by
+    resampling its sites. The draws use a counter-based generator keyed by
+    (seed, replicate, block), so a block of a replicate is the same whenever and by
+    whichever thread it is drawn.
+    With a bootstrap specification (-bsam) or jackknife, the replicates are drawn by
+    Alignment::createBootstrapAlignment and stored instead.
+*/
+class BootstrapReplicates {
+public:
+
+    BootstrapReplicates();
+
+    /**
+        draw the number of sites of each block in each replicate
+        @param aln the alignment
+        @param num_reps number of replicates
+        @param seed random seed
+        @param scale each partition has round(scale*#sites) sites, for multiscale bootstrap
+        @param spec bootstrap specification, if not NULL the replicates are stored
+        @note with scale 1.0, replicate 0 is the original alignment
+    */
+    void init(Alignment *aln, size_t num_reps, int seed, double scale = 1.0, const char *spec = NULL);
+
+    /** @return number of replicates */
+    inline size_t getNReps() {
+        return num_reps;
+    }
+
+    /** @return number of pattern blocks */
+    inline int getNBlocks() {
+        return block_begin.size() - 1;
+    }
+
+    /** @return first pattern of a block */
+    inline int getBlockBegin(int block) {
+        return block_begin[block];
+    }
+
+    /** @return pattern after the last pattern of a block */
+    inline int getBlockEnd(int block) {
+        return block_begin[block+1];
+    }
+
+    /** @return memory held by the replicates in bytes */
+    size_t getMemory();
+
+    /**
+        get the pattern counts of a replicate in a block
+        @param rep the replicate
+        @param block the block
+        @param[out] counts counts of the patterns getBlockBegin(block) to getBlockEnd(block)-1
+    */
+    void getCounts(size_t rep, int block, int *counts);
+
+private:
+
+    /** number of replicates */
+    size_t num_reps;
+
+    /** key of the counter-based generator for this seed and scale */
+    uint64_t key;
+
+    /** true if replicate 0 is the original alignment */
+    bool orig_first;
+
+    /** first pattern of each block, followed by the number of patterns */
+    IntVector block_begin;
+
+    /** frequencies of the patterns */
+    DoubleVector ptn_freq;
+
+    /** number of sites of each block in each replicate, #replicates x #blocks */
+    vector<uint32_t> block_sites;
+
+    /** first site of each block in site_ptn, followed by the number of sites */
+    IntVector block_site_begin;
+
+    /**
+        pattern (relative to the block) of each site, for blocks with few sites per pattern,
+        whose counts are drawn by resampling the sites instead of multinomial sampling
+    */
+    IntVector site_ptn;
+
+    /** stored replicates for a bootstrap specification, #replicates x #patterns */
+    IntVector stored;
+};
+
+#endif
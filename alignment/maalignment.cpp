@@ -228,7 +228,9 @@ void MaAlignment::generateExpectedAlignment(MaAlignment *aln, double &prob)
 	int index;
 	for ( Alignment::iterator objectIt = objectAlign.begin(); objectIt != objectAlign.end() ; objectIt++)
 	{
-		PatternIntMap::iterator pat_it = pattern_index.find((*objectIt));
+		string packed;
+		objectIt->pack(packed);
+		PatternIntMap::iterator pat_it = pattern_index.find(packed);
 		if ( pat_it == pattern_index.end() ) //not found ==> error
 			outError("Pattern in the object alignment is not found in the reference alignment!");
 		sumFac += logFac((*objectIt).frequency);
@@ -52,6 +52,33 @@ int Pattern::computeGapChar(int num_states, int STATE_UNKNOWN) {
     return num;
 }
 
+int Pattern::getPackBits() const {
+    StateType max_state = 0;
+    for (const_iterator i = begin(); i != end(); i++)
+        if (*i > max_state) max_state = *i;
+    if (max_state < 16) return 4;
+    if (max_state < 32) return 5;
+    if (max_state < 256) return 8;
+    if (max_state < 65536) return 16;
+    return 32;
+}
+
+void Pattern::pack(string &packed) const {
+    int bits = getPackBits();
+    packed.assign(1 + (size()*bits + 7)/8, 0);
+    packed[0] = bits;
+    size_t pos = 8;
+    for (const_iterator i = begin(); i != end(); i++, pos += bits) {
+        uint64_t state = *i;
+        for (int b = 0; b < bits; ) {
+            int offset = (pos+b) & 7;
+            int n = min(8-offset, bits-b);
+            packed[(pos+b) >> 3] |= (char)(((state >> b) & ((1 << n)-1)) << offset);
+            b += n;
+        }
+    }
+}
+
 //Pattern &Pattern::operator= (Pattern pat) {
 //    assign(pat);
 //    frequency = pat.frequency;
@@ -52,6 +52,21 @@ public:
 	*/
 	int computeGapChar(int num_states, int STATE_UNKNOWN);
 
+	/**
+		@return number of bits per state to pack this pattern: 4 or 5 for DNA and protein,
+		8, 16 or 32 for larger state spaces
+	*/
+	int getPackBits() const;
+
+	/**
+		pack the states into a compact byte string, used as key of Alignment::pattern_index.
+		The pattern itself keeps one StateType per sequence; only the key is packed.
+		The first byte stores the number of bits per state, so that equal patterns
+		always have equal packed strings
+		@param[out] packed packed pattern
+	*/
+	void pack(string &packed) const;
+
 //    Pattern &operator= (Pattern pat);
 
 	/** 
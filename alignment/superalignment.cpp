@@ -1249,7 +1249,7 @@ Alignment *SuperAlignment::concatenateAlignments(set<int> &ids) {
     		//ASSERT(part_seq == partitions[id]->getNSeq());
     		aln->addPattern(pat, site, (*it).frequency);
     		// IMPORTANT BUG FIX FOLLOW
-    		int ptnindex = aln->pattern_index[pat];
+    		int ptnindex = aln->site_pattern[site];
             for (int j = 0; j < (*it).frequency; j++)
                 aln->site_pattern[site++] = ptnindex;
 
@@ -93,8 +93,20 @@ Stirling (double y1)
   return s;
 }
 
+static double
+uniform_rstream (void *state)
+{
+  return random_double((int*)state);
+}
+
 unsigned int
 gsl_ran_binomial (double p, unsigned int n, int *rstream)
+{
+  return gsl_ran_binomial_gen (p, n, uniform_rstream, rstream);
+}
+
+unsigned int
+gsl_ran_binomial_gen (double p, unsigned int n, gsl_uniform_fn uniform, void *state)
 {
   int ix;                       /* return value */
   int flipped = 0;
@@ -130,7 +142,7 @@ gsl_ran_binomial (double p, unsigned int n, int *rstream)
            */
 
           double f = f0;
-          double u = random_double(rstream);
+          double u = uniform(state);
 
           for (ix = 0; ix <= BINV_CUTOFF; ++ix)
             {
@@ -211,8 +223,8 @@ gsl_ran_binomial (double p, unsigned int n, int *rstream)
     TryAgain:
 
       /* generate random variates, u specifies which region: Tri, Par, Tail */
-      u = random_double(rstream) * p4;
-      v = random_double(rstream);
+      u = uniform(state) * p4;
+      v = uniform(state);
 
       if (u <= p1)
         {
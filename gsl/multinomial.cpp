@@ -26,6 +26,8 @@
 //#include <gsl/gsl_sf_gamma.h>
 #include "mygsl.h"
 
+extern double random_double(int *rstream);
+
 /* The multinomial distribution has the form
 
                                       N!           n_1  n_2      n_K
@@ -44,8 +46,8 @@
 */
 
 void
-gsl_ran_multinomial (const size_t K,
-                     const unsigned int N, const double p[], unsigned int n[], int *rstream)
+gsl_ran_multinomial_gen (const size_t K,
+                     const unsigned int N, const double p[], unsigned int n[], gsl_uniform_fn uniform, void *state)
 {
   size_t k;
   double norm = 0.0;
@@ -67,7 +69,7 @@ gsl_ran_multinomial (const size_t K,
     {
       if (p[k] > 0.0)
         {
-          n[k] = gsl_ran_binomial (p[k] / (norm - sum_p), N - sum_n, rstream);
+          n[k] = gsl_ran_binomial_gen (p[k] / (norm - sum_p), N - sum_n, uniform, state);
         }
       else
         {
@@ -80,3 +82,15 @@ gsl_ran_multinomial (const size_t K,
 
 }
 
+static double
+uniform_rstream (void *state)
+{
+  return random_double((int*)state);
+}
+
+void
+gsl_ran_multinomial (const size_t K,
+                     const unsigned int N, const double p[], unsigned int n[], int *rstream)
+{
+  gsl_ran_multinomial_gen (K, N, p, n, uniform_rstream, rstream);
+}
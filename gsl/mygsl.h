@@ -22,6 +22,21 @@ double gsl_pow_uint(double x, unsigned int n);
 */
 unsigned int gsl_ran_binomial (double p, unsigned int n, int *rstream);
 
+/*
+    uniform random number generator in [0,1), called with its state
+*/
+typedef double (*gsl_uniform_fn)(void *state);
+
+/*
+    binomial sampling with a user-supplied uniform random number generator
+    @param p probability
+    @param n sample size
+    @param uniform the generator
+    @param state state passed to the generator
+    @return random value drawn from binominal distribution
+*/
+unsigned int gsl_ran_binomial_gen (double p, unsigned int n, gsl_uniform_fn uniform, void *state);
+
 /*
     multinomial sampling
     @param K number of categories
@@ -31,6 +46,18 @@ unsigned int gsl_ran_binomial (double p, unsigned int n, int *rstream);
 */
 void gsl_ran_multinomial (const size_t K, const unsigned int N, const double p[], unsigned int n[], int *rstream);
 
+/*
+    multinomial sampling with a user-supplied uniform random number generator
+    @param K number of categories
+    @param N sample size
+    @param p probability vector of length K, will be normalized to 1 if not summing up to 1
+    @param[out] n output vector of length K as drawn from multinomial distribution, sum to N
+    @param uniform the generator
+    @param state state passed to the generator
+*/
+void gsl_ran_multinomial_gen (const size_t K, const unsigned int N, const double p[], unsigned int n[],
+    gsl_uniform_fn uniform, void *state);
+
 
 /*
     probability density function for standard normal distribution
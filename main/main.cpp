@@ -1766,6 +1766,12 @@ outstreambuf* outstreambuf::close() {
 }
 
 int outstreambuf::overflow( int c) { // used for output buffer only
+    if (thread_cout_buffer) {
+        // printed later by the caller
+        if (c != EOF)
+            thread_cout_buffer->push_back(c);
+        return c;
+    }
 	if ((verbose_mode >= VB_MIN && MPIHelper::getInstance().isMaster()) || verbose_mode >= VB_MED)
 		if (cout_buf->sputc(c) == EOF) return EOF;
     if (Params::getInstance().suppress_output_flags & OUT_LOG)
@@ -1779,6 +1785,8 @@ int outstreambuf::overflow( int c) { // used for output buffer only
 
 
 int outstreambuf::sync() { // used for output buffer only
+    if (thread_cout_buffer)
+        return 0;
 	if ((verbose_mode >= VB_MIN && MPIHelper::getInstance().isMaster()) || verbose_mode >= VB_MED)
 		cout_buf->pubsync();
     if ((Params::getInstance().suppress_output_flags & OUT_LOG) || !MPIHelper::getInstance().isMaster())
@@ -2271,8 +2279,12 @@ int main(int argc, char *argv[]) {
 
     // 2015-12-05
     Checkpoint *checkpoint = new Checkpoint;
-    string filename = (string)Params::getInstance().out_prefix +".ckp.gz";
-    checkpoint->setFileName(filename);
+    // binary and text checkpoints have their own extension, either one is resumed
+    bool ckp_text = Params::getInstance().checkpoint_text;
+    string ckp_prefix = (string)Params::getInstance().out_prefix + ".ckp";
+    checkpoint->setFileName(ckp_prefix + (ckp_text ? ".gz" : ".bin"), ckp_prefix + (ckp_text ? ".bin" : ".gz"));
+    checkpoint->setBinary(!ckp_text);
+    string filename = checkpoint->getLoadFileName();
     
     bool append_log = false;
     
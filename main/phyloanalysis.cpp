@@ -1335,7 +1335,8 @@ void reportPhyloAnalysis(Params &params, IQTree &tree, ModelCheckpoint &model_in
     printOutfilesInfo(params, tree);
 }
 
-void checkZeroDist(Alignment *aln, double *dist) {
+void checkZeroDist(PhyloTree &tree) {
+	Alignment *aln = tree.aln;
 	int ntaxa = aln->getNSeq();
 	IntVector checked;
 	checked.resize(ntaxa, 0);
@@ -1346,7 +1347,7 @@ void checkZeroDist(Alignment *aln, double *dist) {
 		string str = "";
 		bool first = true;
 		for (j = i + 1; j < ntaxa; j++)
-			if (dist[i * ntaxa + j] <= Params::getInstance().min_branch_length) {
+			if (tree.getDist(i, j) <= Params::getInstance().min_branch_length) {
 				if (first)
 					str = "ZERO distance between sequences "
 							+ aln->getSeqName(i);
@@ -1492,7 +1493,10 @@ void computeMLDist(Params& params, IQTree& iqtree, double begin_time) {
 	cout << "Computing ML distances based on estimated model parameters...";
 	double *ml_dist = NULL;
     double *ml_var = NULL;
-    longest_dist = iqtree.computeDist(params, iqtree.aln, ml_dist, ml_var, iqtree.dist_file);
+    if (params.dist_binary)
+        longest_dist = iqtree.computeCondensedDist(params, iqtree.aln, iqtree.dist_file);
+    else
+        longest_dist = iqtree.computeDist(params, iqtree.aln, ml_dist, ml_var, iqtree.dist_file);
 	cout << " " << (getCPUTime() - begin_time) << " sec" << endl;
 
     double max_genetic_dist = MAX_GENETIC_DIST;
@@ -1504,7 +1508,7 @@ void computeMLDist(Params& params, IQTree& iqtree, double begin_time) {
 		outWarning("Some pairwise ML distances are too long (saturated)");
 		//cout << "Some ML distances are too long, using old distances..." << endl;
 	} //else
-	{
+	if (ml_dist) {
 		if ( !iqtree.dist_matrix ) {
 	        iqtree.dist_matrix = new double[iqtree.aln->getNSeq() * iqtree.aln->getNSeq()];
 		}
@@ -1531,8 +1535,11 @@ void computeInitialDist(Params &params, IQTree &iqtree) {
 	}
 
 	if (params.compute_jc_dist || params.compute_obs_dist || params.partition_file) {
-		longest_dist = iqtree.computeDist(params, iqtree.aln, iqtree.dist_matrix, iqtree.var_matrix, iqtree.dist_file);
-		checkZeroDist(iqtree.aln, iqtree.dist_matrix);
+		if (params.dist_binary)
+			longest_dist = iqtree.computeCondensedDist(params, iqtree.aln, iqtree.dist_file);
+		else
+			longest_dist = iqtree.computeDist(params, iqtree.aln, iqtree.dist_matrix, iqtree.var_matrix, iqtree.dist_file);
+		checkZeroDist(iqtree);
 
         double max_genetic_dist = MAX_GENETIC_DIST;
         if (iqtree.aln->seq_type == SEQ_POMO) {
@@ -1579,6 +1586,9 @@ void pruneTaxa(Params &params, IQTree &iqtree, double *pattern_lh, NodeVector &p
 	double mytime;
 
 	if (params.aLRT_threshold <= 100 && (params.aLRT_replicates > 0 || params.localbp_replicates > 0)) {
+		// collapseStableClade reads and prunes the square distance matrix
+		if (!iqtree.dist_matrix)
+			outError("Pruning stable clades needs the distance matrix in memory and does not work with -dbin");
 		mytime = getCPUTime();
 		cout << "Testing tree branches by SH-like aLRT with " << params.aLRT_replicates << " replicates..." << endl;
 		iqtree.setRootNode(params.root);
@@ -2302,6 +2312,8 @@ void runTreeReconstruction(Params &params, IQTree* &iqtree) {
         cout << "TREE SEARCH COMPLETED AFTER " << iqtree->stop_rule.getCurIt() << " ITERATIONS"
             << " / Time: " << convert_time(getRealTime() - params.start_real_time) << endl << endl;
 	} else {
+        // no tree search to finalize below: report the tree in double precision
+        iqtree->restorePartialLhDouble();
         iqtree->candidateTrees.saveCheckpoint();
 		/* do SPR with likelihood function */
 		if (params.tree_spr) {
@@ -2342,6 +2354,8 @@ void runTreeReconstruction(Params &params, IQTree* &iqtree) {
 		iqtree->readTreeString(iqtree->getBestTrees()[0]);
         iqtree->initializeAllPartialLh();
         iqtree->clearAllPartialLH();
+        // final optimization always in double precision
+        iqtree->restorePartialLhDouble();
         cout << "--------------------------------------------------------------------" << endl;
         cout << "|                    FINALIZING TREE SEARCH                        |" << endl;
         cout << "--------------------------------------------------------------------" << endl;
@@ -2368,6 +2382,7 @@ void runTreeReconstruction(Params &params, IQTree* &iqtree) {
 		((PhyloSuperTree*) iqtree)->computeBranchLengths();
 
 	cout << "BEST SCORE FOUND : " << iqtree->getCurScore() << endl;
+	iqtree->printPartialLhCacheStats(cout);
 
 	if (params.write_candidate_trees) {
 		printTrees(iqtree->getBestTrees(), params, ".imd_trees");
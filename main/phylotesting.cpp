@@ -40,6 +40,7 @@
 
 #include "phyloanalysis.h"
 #include "gsl/mygsl.h"
+#include "alignment/bootreplicates.h"
 #include "utils/MPIHelper.h"
 //#include "vectorclass/vectorclass.h"
 
@@ -885,8 +886,11 @@ void runModelFinder(Params &params, IQTree &iqtree, ModelCheckpoint &model_info)
     //            ((PhyloSuperTree*) &iqtree)->mapTrees();
     double cpu_time = getCPUTime();
     double real_time = getRealTime();
-    model_info.setFileName((string)params.out_prefix + ".model.gz");
+    string model_prefix = (string)params.out_prefix + ".model";
+    model_info.setFileName(model_prefix + (params.checkpoint_text ? ".gz" : ".bin"),
+                           model_prefix + (params.checkpoint_text ? ".bin" : ".gz"));
     model_info.setDumpInterval(params.checkpoint_dump_interval);
+    model_info.setBinary(!params.checkpoint_text);
     
     bool ok_model_file = false;
     if (!params.print_site_lh && !params.model_test_again) {
@@ -897,7 +901,7 @@ void runModelFinder(Params &params, IQTree &iqtree, ModelCheckpoint &model_info)
     
     ok_model_file &= model_info.size() > 0;
     if (ok_model_file)
-        cout << "NOTE: Restoring information from model checkpoint file " << model_info.getFileName() << endl;
+        cout << "NOTE: Restoring information from model checkpoint file " << model_info.getLoadFileName() << endl;
     
     
     Checkpoint *orig_checkpoint = iqtree.getCheckpoint();
@@ -1544,6 +1548,12 @@ string testOneModel(string &model_name, Params &params, Alignment *in_aln,
             }
         }
 
+        // compare models by log-likelihoods in double precision (-lhfloat)
+        if (params.partial_lh_float) {
+            iqtree->disablePartialLhFloat();
+            iqtree->initializeAllPartialLh();
+            info.logl = iqtree->computeLikelihood();
+        }
     }
 
     info.df = iqtree->getModelFactory()->getNParameters(brlen_type);
@@ -2134,6 +2144,180 @@ ModelMarkov* getPrototypeModel(SeqType seq_type, PhyloTree* tree, char *model_se
 */
 
 
+/**
+    check the stop rule for +R/+H models
+    @param info information of a +R<k> model, with IC scores computed
+    @param checkpoint model checkpoint containing the +R<k-1> model
+    @param ssize sample size
+    @return TRUE if info is worse than +R<k-1>, so that models with more categories can be skipped
+*/
+bool checkRminus1Stop(Params &params, ModelCheckpoint *checkpoint, ModelInfo &info, int ssize) {
+    ModelInfo prev_info;
+    if (!prev_info.restoreCheckpointRminus1(checkpoint, info.name))
+        return false;
+    prev_info.computeICScores(ssize);
+    switch (params.model_test_criterion) {
+    case MTC_ALL:
+        return info.AIC_score > prev_info.AIC_score &&
+            info.AICc_score > prev_info.AICc_score &&
+            info.BIC_score > prev_info.BIC_score;
+    case MTC_AIC:
+        return info.AIC_score > prev_info.AIC_score;
+    case MTC_AICC:
+        return info.AICc_score > prev_info.AICc_score;
+    case MTC_BIC:
+        return info.BIC_score > prev_info.BIC_score;
+    }
+    return false;
+}
+
+/** #patterns * #states that keeps one thread of a model group busy */
+const size_t MODEL_THREAD_GRAIN = 20000;
+
+/** model evaluated ahead of time by testModelsParallel */
+struct ModelResult {
+    /** true if the model was evaluated */
+    bool done;
+    /** model name as returned by testOneModel */
+    string model_name;
+    /** output model information */
+    ModelInfo info;
+    /** tree string returned by testOneModel */
+    string tree_string;
+    /** output of testOneModel, printed when the result is reported */
+    string output;
+};
+
+/**
+    evaluate independent models, concurrently if threads are available, each model group on its
+    own team of threads. Models of the same rate family (e.g. +R2, +R3,...) form one group and are
+    evaluated in order, so that testOneModel and the +R stop rule see the model with one category less.
+    Every group starts from the tree and parameters in model_info, not from those of the previous
+    group; this holds for any number of threads, also when the groups run one after another.
+    Each model draws random numbers from its own stream seeded by its ID, its output is collected
+    and printed with its result, and checkpoint entries are merged back into model_info in the order
+    of the models, so results do not depend on the number of threads or the scheduling.
+    @param num_threads number of threads, 0 to let the first model determine it (-nt AUTO)
+    @param model_names model names
+    @param first ID of the first model to evaluate
+    @param last ID of the model after the last one
+    @param[out] results results indexed by model ID
+*/
+void testModelsParallel(Params &params, PhyloTree *in_tree, ModelCheckpoint &model_info,
+    ModelsBlock *models_block, int &num_threads, int brlen_type, string &set_name, int ssize,
+    StrVector &model_names, int first, int last, vector<ModelResult> &results)
+{
+    // group consecutive models of the same rate family
+    vector<pair<int,int> > groups;
+    BoolVector group_asc;
+    const char *rates[] = {"+R", "*R", "+H", "*H"};
+    for (int model = first; model < last; ) {
+        size_t posR = string::npos;
+        for (int i = 0; i < sizeof(rates)/sizeof(char*) && posR == string::npos; i++)
+            posR = model_names[model].find(rates[i]);
+        bool asc = model_names[model].find("+ASC") != string::npos;
+        int next = model+1;
+        if (posR != string::npos) {
+            string first_part = model_names[model].substr(0, posR+2);
+            while (next < last && model_names[next].substr(0, posR+2) == first_part &&
+                   (model_names[next].find("+ASC") != string::npos) == asc)
+                next++;
+        }
+        groups.push_back(make_pair(model, next));
+        group_asc.push_back(asc);
+        model = next;
+    }
+
+    // computation cost is proportional to #patterns and #states
+    size_t cost = in_tree->aln->getNPattern() * in_tree->aln->num_states;
+    int group_threads = num_threads, num_groups = 1;
+    bool concurrent = num_threads > 1;
+#ifdef _OPENMP
+    // the threads are already used, e.g. by partitions tested in parallel
+    concurrent = concurrent && !omp_in_parallel();
+#endif
+    if (concurrent) {
+        group_threads = max(1, min(num_threads, (int)(cost / MODEL_THREAD_GRAIN)));
+        num_groups = max(1, min((int)groups.size(), num_threads / group_threads));
+        group_threads = num_threads / num_groups;
+    }
+
+    if (verbose_mode >= VB_MED)
+        cout << "Testing " << last-first << " models in " << groups.size() << " groups using "
+             << num_groups << " x " << group_threads << " threads" << endl;
+
+    vector<ModelCheckpoint> group_infos(groups.size());
+
+#ifdef _OPENMP
+    int saved_nested = omp_get_nested();
+    if (concurrent)
+        omp_set_nested(group_threads > 1);
+#endif
+
+    // aln->seq_states, shared by all trees on the alignment, holds the states of unobserved
+    // constant patterns only for +ASC: models without and with +ASC are run in separate rounds,
+    // with seq_states built beforehand, so that initializing a model does not change it
+    for (int asc = 0; asc < 2; asc++) {
+        IntVector round_groups;
+        for (int group = 0; group < groups.size(); group++)
+            if (group_asc[group] == (bool)asc)
+                round_groups.push_back(group);
+        if (round_groups.empty())
+            continue;
+        in_tree->aln->buildSeqStates(asc);
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) num_threads(num_groups) if(num_groups > 1)
+#endif
+        for (int i = 0; i < round_groups.size(); i++) {
+            int group = round_groups[i];
+            // private copy: testOneModel writes into the checkpoint
+            ModelCheckpoint &group_info = group_infos[group];
+            group_info.insert(model_info.begin(), model_info.end());
+            int threads = group_threads;
+            for (int model = groups[group].first; model < groups[group].second; model++) {
+                ModelResult &res = results[model];
+                res.model_name = model_names[model];
+                res.info.set_name = set_name;
+                // random numbers (e.g. restarts of the parameter optimization) from a stream
+                // of this model, so that the result does not depend on the scheduling
+                int *rstream;
+                init_random(params.ran_seed + model, false, &rstream);
+                thread_randstream = rstream;
+                thread_cout_buffer = &res.output;
+                res.tree_string = testOneModel(res.model_name, params, in_tree->aln,
+                    group_info, res.info, models_block, threads, brlen_type);
+                thread_cout_buffer = NULL;
+                thread_randstream = NULL;
+                finish_random(rstream);
+                if (num_threads <= 0)
+                    // the first model determined the number of threads, groups run one after another
+                    num_threads = group_threads = threads;
+                res.info.computeICScores(ssize);
+                res.info.saveCheckpoint(&group_info);
+                res.done = true;
+                if (checkRminus1Stop(params, &group_info, res.info, ssize))
+                    break;
+            }
+            // only keep new or changed entries
+            for (auto it = model_info.begin(); it != model_info.end(); it++) {
+                auto found = group_info.find(it->first);
+                if (found != group_info.end() && found->second == it->second)
+                    group_info.erase(found);
+            }
+        }
+    }
+
+#ifdef _OPENMP
+    if (concurrent)
+        omp_set_nested(saved_nested);
+#endif
+
+    for (auto git = group_infos.begin(); git != group_infos.end(); git++)
+        for (auto it = git->begin(); it != git->end(); it++)
+            model_info[it->first] = it->second;
+}
+
 string testModel(Params &params, PhyloTree* in_tree, ModelCheckpoint &model_info, ModelsBlock *models_block,
     int num_threads, int brlen_type, string set_name, bool print_mem_usage, string in_model_name)
 {
@@ -2223,6 +2407,16 @@ string testModel(Params &params, PhyloTree* in_tree, ModelCheckpoint &model_info
 //    int prev_model_id = -1;
 //    int skip_model = 0;
 
+    // independent models are evaluated by testModelsParallel, concurrently if threads are available,
+    // and start from the same checkpoint for any number of threads
+    bool parallel_models = !params.model_test_and_tree;
+    vector<ModelResult> model_results;
+    if (parallel_models) {
+        model_results.resize(model_names.size());
+        for (auto it = model_results.begin(); it != model_results.end(); it++)
+            it->done = false;
+    }
+
     //------------- MAIN FOR LOOP GOING THROUGH ALL MODELS TO BE TESTED ---------//
 
 	for (model = 0; model < model_names.size(); model++) {
@@ -2245,55 +2439,40 @@ string testModel(Params &params, PhyloTree* in_tree, ModelCheckpoint &model_info
             model_names[model] = best_model + model_names[model];
         }
 
+        if (parallel_models && !model_results[model].done) {
+            // models up to the next rate heterogeneity test do not depend on each other
+            int last = model+1;
+            while (last < model_names.size() && (model_names[last][0] != '+' || !best_model.empty())) {
+                if (model_names[last][0] == '+')
+                    model_names[last] = best_model + model_names[last];
+                last++;
+            }
+            testModelsParallel(params, in_tree, model_info, models_block, num_threads, brlen_type,
+                set_name, ssize, model_names, model, last, model_results);
+        }
+
 		// optimize model parameters
         string orig_model_name = model_names[model];
 		ModelInfo info;
 		info.set_name = set_name;
         string tree_string;
 
-        /***** main call to estimate model parameters ******/
-        tree_string = testOneModel(model_names[model], params, in_tree->aln,
-            model_info, info, models_block, num_threads, brlen_type);
+        if (parallel_models && model_results[model].done) {
+            cout << model_results[model].output;
+            model_names[model] = model_results[model].model_name;
+            info = model_results[model].info;
+            tree_string = model_results[model].tree_string;
+        } else {
+            /***** main call to estimate model parameters ******/
+            tree_string = testOneModel(model_names[model], params, in_tree->aln,
+                model_info, info, models_block, num_threads, brlen_type);
+        }
 
         info.computeICScores(ssize);
         info.saveCheckpoint(checkpoint);
 
-        ModelInfo prev_info;
-
-        bool skip_model = false;
-
-        if (prev_info.restoreCheckpointRminus1(checkpoint, info.name)) {
-            // check stop criterion for +R
-            prev_info.computeICScores(ssize);
-            switch (params.model_test_criterion) {
-            case MTC_ALL:
-                if (info.AIC_score > prev_info.AIC_score &&
-                    info.AICc_score > prev_info.AICc_score &&
-                    info.BIC_score > prev_info.BIC_score) {
-                    // skip remaining model
-                    skip_model = true;
-                }
-                break;
-            case MTC_AIC:
-                if (info.AIC_score > prev_info.AIC_score) {
-                    // skip remaining model
-                    skip_model = true;
-                }
-                break;
-            case MTC_AICC:
-                if (info.AICc_score > prev_info.AICc_score) {
-                    // skip remaining model
-                    skip_model = true;
-                }
-                break;
-            case MTC_BIC:
-                if (info.BIC_score > prev_info.BIC_score) {
-                    // skip remaining model
-                    skip_model = true;
-                }
-                break;
-            }
-        }
+        // check stop criterion for +R
+        bool skip_model = checkRminus1Stop(params, checkpoint, info, ssize);
 
 		if (info.AIC_score < best_score_AIC) {
             best_model_AIC = info.name;
@@ -2749,87 +2928,137 @@ int mlecoef(double *cnts, double *rr, double bb, int kk,
 
 /* END CODE WAS TAKEN FROM CONSEL PROGRAM */
 
+/** replicates in a tile of the RELL kernel, summed by one thread */
+const size_t RELL_REP_TILE = 16;
+
+/** memory for the pattern log-likelihoods of trees scored together, if not kept for other tests */
+const size_t RELL_TREE_BATCH_MEM = ((size_t)1) << 30;
+
+/**
+    compute the RELL scores of trees: the log-likelihoods of the trees in all bootstrap replicates.
+    Each thread owns a tile of replicates; the counts of a pattern block are drawn once for
+    the tile and streamed through the pattern log-likelihoods of all trees.
+    Every score sums the patterns in order, whatever the number of threads
+    @param reps bootstrap replicates
+    @param pattern_lhs pattern log-likelihoods of the trees, #trees x maxnptn
+    @param[out] tree_lhs tree_lhs[tree*lhs_stride + rep] is the score of tree in replicate rep
+*/
+void computeRELLScores(BootstrapReplicates &reps, double *pattern_lhs, size_t ntrees, size_t maxnptn,
+    double *tree_lhs, size_t lhs_stride)
+{
+    size_t nreps = reps.getNReps();
+    size_t ntiles = (nreps + RELL_REP_TILE - 1) / RELL_REP_TILE;
+    int nblocks = reps.getNBlocks();
+    size_t max_block_size = 0;
+    for (int block = 0; block < nblocks; block++)
+        max_block_size = max(max_block_size, (size_t)(reps.getBlockEnd(block) - reps.getBlockBegin(block)));
+
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+    {
+    // counts of the tile in a block, pattern-major
+    double *tile_counts = aligned_alloc<double>(max_block_size*RELL_REP_TILE);
+    int *counts = new int[max_block_size];
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+    for (size_t tile = 0; tile < ntiles; tile++) {
+        size_t tile_begin = tile*RELL_REP_TILE;
+        size_t tile_size = min(RELL_REP_TILE, nreps - tile_begin);
+        size_t tid, j;
+        for (tid = 0; tid < ntrees; tid++)
+            for (j = 0; j < tile_size; j++)
+                tree_lhs[tid*lhs_stride + tile_begin + j] = 0.0;
+        for (int block = 0; block < nblocks; block++) {
+            int begin = reps.getBlockBegin(block);
+            int block_size = reps.getBlockEnd(block) - begin;
+            for (j = 0; j < tile_size; j++) {
+                reps.getCounts(tile_begin + j, block, counts);
+                for (int ptn = 0; ptn < block_size; ptn++)
+                    tile_counts[ptn*RELL_REP_TILE + j] = counts[ptn];
+            }
+            for (tid = 0; tid < ntrees; tid++) {
+                double *pattern_lh = pattern_lhs + tid*maxnptn + begin;
+                double *tree_lh = tree_lhs + tid*lhs_stride + tile_begin;
+                double sum[RELL_REP_TILE];
+                for (j = 0; j < tile_size; j++)
+                    sum[j] = tree_lh[j];
+                for (int ptn = 0; ptn < block_size; ptn++) {
+                    double lh = pattern_lh[ptn];
+                    double *ptn_counts = tile_counts + ptn*RELL_REP_TILE;
+                    for (j = 0; j < tile_size; j++)
+                        sum[j] += ptn_counts[j] * lh;
+                }
+                for (j = 0; j < tile_size; j++)
+                    tree_lh[j] = sum[j];
+            }
+        }
+    }
+    delete [] counts;
+    aligned_free(tile_counts);
+    }
+}
+
+/** scale factors of the multiscale bootstrap replicates of the AU test */
+const double AU_SCALES[] = {0.5, 0.6, 0.7, 0.8, 0.9, 1.0, 1.1, 1.2, 1.3, 1.4};
+const size_t AU_NSCALES = sizeof(AU_SCALES)/sizeof(AU_SCALES[0]);
+
 /**
-    @param tree_lhs RELL score matrix of size #trees x #replicates
+    compute the RELL scores of a batch of trees in the multiscale bootstrap replicates of the AU test.
+    The scores are linear in the pattern log-likelihoods, so the trees can be scored batch by batch
+    @param au_reps bootstrap replicates of each scale factor
+    @param pattern_lhs pattern log-likelihoods of the trees of the batch, #trees x maxnptn
+    @param[out] au_tree_lhs scores of the batch, au_tree_lhs[(tree*#scales + scale)*#replicates + rep]
 */
-void performAUTest(Params &params, PhyloTree *tree, double *pattern_lhs, vector<TreeInfo> &info) {
+void computeAURELLScores(vector<BootstrapReplicates> &au_reps, double *pattern_lhs, size_t ntrees, size_t maxnptn,
+    double *au_tree_lhs)
+{
+    size_t nscales = au_reps.size();
+    size_t nboot = au_reps[0].getNReps();
+    for (size_t k = 0; k < nscales; k++)
+        computeRELLScores(au_reps[k], pattern_lhs, ntrees, maxnptn, au_tree_lhs + k*nboot, nscales*nboot);
+}
+
+/**
+    @param treelhs RELL scores of all trees from computeAURELLScores, #trees x #scales x #replicates,
+           overwritten by the sorted statistics
+*/
+void performAUTest(Params &params, PhyloTree *tree, double *treelhs, vector<TreeInfo> &info) {
     
     if (params.topotest_replicates < 10000)
         outWarning("Too few replicates for AU test. At least -zb 10000 for reliable results!");
     
     /* STEP 1: specify scale factors */
-    size_t nscales = 10;
-    double r[] = {0.5, 0.6, 0.7, 0.8, 0.9, 1.0, 1.1, 1.2, 1.3, 1.4};
-    double rr[] = {sqrt(0.5), sqrt(0.6), sqrt(0.7), sqrt(0.8), sqrt(0.9), 1.0, 
-        sqrt(1.1), sqrt(1.2), sqrt(1.3), sqrt(1.4)};
-    double rr_inv[] = {sqrt(1/0.5), sqrt(1/0.6), sqrt(1/0.7), sqrt(1/0.8), sqrt(1/0.9), 1.0, 
-        sqrt(1/1.1), sqrt(1/1.2), sqrt(1/1.3), sqrt(1/1.4)};
+    size_t nscales = AU_NSCALES;
+    double r[AU_NSCALES], rr[AU_NSCALES], rr_inv[AU_NSCALES];
+    size_t k, tid;
+    for (k = 0; k < nscales; k++) {
+        r[k] = AU_SCALES[k];
+        rr[k] = sqrt(r[k]);
+        rr_inv[k] = sqrt(1/r[k]);
+    }
         
     /* STEP 2: compute bootstrap proportion */
     size_t ntrees = info.size();
     size_t nboot = params.topotest_replicates;
 //    double nboot_inv = 1.0 / nboot;
     
-    size_t nptn = tree->getAlnNPattern();
-    size_t maxnptn = get_safe_upper_limit(nptn);
-    
 //    double *bp = new double[ntrees*nscales];
 //    memset(bp, 0, sizeof(double)*ntrees*nscales);
     
-    double *treelhs;
-    cout << (ntrees*nscales*nboot*sizeof(double) >> 20) << " MB required for AU test" << endl;
-    treelhs = new double[ntrees*nscales*nboot];
-    if (!treelhs)
-        outError("Not enough memory to perform AU test!");
-    
-    size_t k, tid, ptn;
-
-    double start_time = getRealTime();
-
-    cout << "Generating " << nscales << " x " << nboot << " multiscale bootstrap replicates... ";
-
-#ifdef _OPENMP
-    #pragma omp parallel private(k, tid, ptn)
-    {
-    int *rstream;
-    init_random(params.ran_seed + omp_get_thread_num(), false, &rstream);
-#else
-    int *rstream = randstream;
-#endif
-    size_t boot;
-    int *boot_sample = aligned_alloc<int>(maxnptn);
-    memset(boot_sample, 0, maxnptn*sizeof(int));
-    
-    double *boot_sample_dbl = aligned_alloc<double>(maxnptn);
-    
+    for (k = 0; k < nscales; k++) {
+        size_t boot;
 #ifdef _OPENMP
-    #pragma omp for schedule(dynamic)
+        #pragma omp parallel for private(tid)
 #endif
-    for (k = 0; k < nscales; k++) {
-        string str = "SCALE=" + convertDoubleToString(r[k]);    
-		for (boot = 0; boot < nboot; boot++) {
-            if (r[k] == 1.0 && boot == 0)
-                // 2018-10-23: get one of the bootstrap sample as the original alignment
-                tree->aln->getPatternFreq(boot_sample);
-            else
-                tree->aln->createBootstrapAlignment(boot_sample, str.c_str(), rstream);
-            for (ptn = 0; ptn < maxnptn; ptn++)
-                boot_sample_dbl[ptn] = boot_sample[ptn];
+        for (boot = 0; boot < nboot; boot++) {
             double max_lh = -DBL_MAX, second_max_lh = -DBL_MAX;
             int max_tid = -1;
             for (tid = 0; tid < ntrees; tid++) {
-                double *pattern_lh = pattern_lhs + (tid*maxnptn);
-                double tree_lh;
-                if (params.SSE == LK_386) {
-                    tree_lh = 0.0;
-                    for (ptn = 0; ptn < nptn; ptn++)
-                        tree_lh += pattern_lh[ptn] * boot_sample_dbl[ptn];
-                } else {
-                    tree_lh = tree->dotProductDoubleCall(pattern_lh, boot_sample_dbl, nptn);
-                }
                 // rescale lh
-                tree_lh /= r[k];
-                
+                double tree_lh = treelhs[(tid*nscales+k)*nboot + boot] / r[k];
+
                 // find the max and second max
                 if (tree_lh > max_lh) {
                     second_max_lh = max_lh;
@@ -2837,33 +3066,27 @@ void performAUTest(Params &params, PhyloTree *tree, double *pattern_lhs, vector<
                     max_tid = tid;
                 } else if (tree_lh > second_max_lh)
                     second_max_lh = tree_lh;
-                    
-                treelhs[(tid*nscales+k)*nboot + boot] = tree_lh; 
+
+                treelhs[(tid*nscales+k)*nboot + boot] = tree_lh;
             }
-            
+
             // compute difference from max_lh
-            for (tid = 0; tid < ntrees; tid++) 
+            for (tid = 0; tid < ntrees; tid++)
                 if (tid != max_tid)
                     treelhs[(tid*nscales+k)*nboot + boot] = max_lh - treelhs[(tid*nscales+k)*nboot + boot];
                 else
                     treelhs[(tid*nscales+k)*nboot + boot] = second_max_lh - max_lh;
-//            bp[k*ntrees+max_tid] += nboot_inv;
         } // for boot
-        
+
         // sort the replicates
+#ifdef _OPENMP
+        #pragma omp parallel for
+#endif
         for (tid = 0; tid < ntrees; tid++) {
             quicksort<double,int>(treelhs + (tid*nscales+k)*nboot, 0, nboot-1);
         }
-        
-    } // for scale
 
-    aligned_free(boot_sample_dbl);
-    aligned_free(boot_sample);
-
-#ifdef _OPENMP
-    finish_random(rstream);
-    }
-#endif
+    } // for scale
 
 //    if (verbose_mode >= VB_MED) {
 //        cout << "scale";
@@ -2879,8 +3102,6 @@ void performAUTest(Params &params, PhyloTree *tree, double *pattern_lhs, vector<
 //        }
 //    }
     
-    cout << getRealTime() - start_time << " seconds" << endl;
-    
     /* STEP 3: weighted least square fit */
     
     double *cc = new double[nscales];
@@ -3019,6 +3240,107 @@ void performAUTest(Params &params, PhyloTree *tree, double *pattern_lhs, vector<
 }
 
 
+/** number of trees read ahead per worker when the user trees are evaluated concurrently */
+const int TOPOTEST_TREES_PER_WORKER = 8;
+
+/** a user tree evaluated by a worker, printed later in input order */
+struct UserTreeResult {
+    /** the tree read, then the tree with optimized branch lengths in NEWICK format */
+    string tree_str;
+
+    /** tree log-likelihood */
+    double logl;
+
+    /** number format of the stream after printing the tree */
+    ios_base::fmtflags flags;
+    streamsize precision;
+};
+
+/**
+    read a user tree, optimize its branch lengths (unless fixed) and compute its log-likelihood
+    @param tree the tree to load the user tree into, with its model
+    @param in input stream positioned at the user tree
+    @param[out] pattern_lh pattern log-likelihoods of size maxnptn, if not NULL
+    @return tree log-likelihood
+*/
+double evaluateUserTree(Params &params, PhyloTree *tree, istream &in, double *pattern_lh, size_t maxnptn) {
+    tree->freeNode();
+    tree->readTree(in, tree->rooted);
+    if (!tree->findNodeName(tree->aln->getSeqName(0))) {
+        outError("Taxon " + tree->aln->getSeqName(0) + " not found in tree");
+    }
+
+    if (tree->rooted && tree->getModel()->isReversible()) {
+        if (tree->leafNum != tree->aln->getNSeq()+1)
+            outError("Tree does not have same number of taxa as alignment");
+        tree->convertToUnrooted();
+    } else if (!tree->rooted && !tree->getModel()->isReversible()) {
+        if (tree->leafNum != tree->aln->getNSeq())
+            outError("Tree does not have same number of taxa as alignment");
+        tree->convertToRooted();
+    }
+    tree->setAlignment(tree->aln);
+    tree->setRootNode(params.root);
+    if (tree->isSuperTree())
+        ((PhyloSuperTree*) tree)->mapTrees();
+
+    tree->initializeAllPartialLh();
+    tree->fixNegativeBranch(false);
+    if (!params.fixed_branch_length) {
+        tree->setCurScore(tree->optimizeAllBranches(100, 0.001));
+    } else {
+        tree->setCurScore(tree->computeLikelihood());
+    }
+    if (pattern_lh) {
+        double curScore = tree->getCurScore();
+        memset(pattern_lh, 0, maxnptn*sizeof(double));
+        tree->computePatternLikelihood(pattern_lh, &curScore);
+    }
+    return tree->getCurScore();
+}
+
+/**
+    create trees to evaluate the user trees concurrently, one per thread.
+    They share the alignment and the model of tree instead of cloning it. This is safe as long as
+    the model is only read: evaluateUserTree() optimizes branch lengths but no model parameters,
+    and -tm models, which cache transition matrices while computing likelihoods, are excluded.
+    evaluateTrees() asserts that the model parameters are unchanged after the evaluation
+    @param tree the tree with the model
+    @param max_num maximal number of worker trees
+    @param[out] workers the worker trees, empty if the trees are evaluated one after another
+*/
+void createUserTreeWorkers(Params &params, IQTree *tree, size_t max_num, vector<PhyloTree*> &workers) {
+    workers.clear();
+    if (!params.topotest_parallel_trees)
+        return;
+    if (tree->isSuperTree() || tree->isMixlen() || tree->getModelFactory()->store_trans_matrix) {
+        outWarning("-zpar does not work with partition, heterotachy or -tm models, trees are evaluated one after another");
+        return;
+    }
+    size_t num = min(max_num, (size_t)tree->num_threads);
+    // every worker needs its own partial likelihoods
+    uint64_t mem_required = tree->getMemoryRequired();
+    uint64_t mem_avail = getMemorySize()/2;
+    if (mem_required*(num+1) > mem_avail)
+        num = (mem_avail > mem_required) ? mem_avail/mem_required - 1 : 0;
+    if (num < 2)
+        return;
+    for (size_t i = 0; i < num; i++) {
+        PhyloTree *worker = new PhyloTree;
+        worker->copyPhyloTree(tree);
+        worker->setParams(&params);
+        worker->optimize_by_newton = tree->optimize_by_newton;
+        worker->setNumThreads(1);
+        worker->setModelFactory(tree->getModelFactory());
+        worker->setModel(tree->getModel());
+        worker->setRate(tree->getRate());
+        // after the model and the taxa are known, as the kernel depends on them
+        worker->setLikelihoodKernel(tree->sse);
+        workers.push_back(worker);
+    }
+    cout << "Evaluating trees concurrently with " << num << " threads" << endl;
+}
+
 void evaluateTrees(Params &params, IQTree *tree, vector<TreeInfo> &info, IntVector &distinct_ids)
 {
 	if (!params.treeset_file)
@@ -3070,7 +3392,7 @@ void evaluateTrees(Params &params, IQTree *tree, vector<TreeInfo> &info, IntVect
 
 	double time_start = getRealTime();
 
-	int *boot_samples = NULL;
+	BootstrapReplicates boot_samples;
 	size_t boot;
 	//double *saved_tree_lhs = NULL;
 	double *tree_lhs = NULL; // RELL score matrix of size #trees x #replicates
@@ -3079,51 +3401,55 @@ void evaluateTrees(Params &params, IQTree *tree, vector<TreeInfo> &info, IntVect
 	double *orig_tree_lh = NULL; // Original tree log-likelihoods
 	double *max_lh = NULL;
 	double *lhdiff_weights = NULL;
+	vector<BootstrapReplicates> au_reps; // multiscale bootstrap replicates of the AU test
+	double *au_tree_lhs = NULL; // multiscale RELL scores of size #trees x #scales x #replicates
 	size_t nptn = tree->getAlnNPattern();
     size_t maxnptn = get_safe_upper_limit(nptn);
-    
+    // trees whose pattern log-likelihoods are kept to compute their RELL scores together
+    size_t batch_trees = ntrees;
+
 	if (params.topotest_replicates && ntrees > 1) {
-		size_t mem_size = (size_t)params.topotest_replicates*nptn*sizeof(int) +
+		cout << "Creating " << params.topotest_replicates << " bootstrap replicates..." << endl;
+		boot_samples.init(tree->aln, params.topotest_replicates, params.ran_seed, 1.0, params.bootstrap_spec);
+        cout << "done" << endl;
+		if (params.do_au_test) {
+			cout << "Generating " << AU_NSCALES << " x " << params.topotest_replicates << " multiscale bootstrap replicates..." << endl;
+			au_reps.resize(AU_NSCALES);
+			// 2018-10-23: with scale 1.0, one of the bootstrap samples is the original alignment
+			for (size_t k = 0; k < AU_NSCALES; k++)
+				au_reps[k].init(tree->aln, params.topotest_replicates, params.ran_seed, AU_SCALES[k]);
+			cout << "done" << endl;
+		}
+		// the weighted test needs the pattern log-likelihoods of all trees
+		if (!params.do_weighted_test)
+			batch_trees = max((size_t)1, min(ntrees, RELL_TREE_BATCH_MEM / (maxnptn*sizeof(double))));
+		size_t au_mem_size = 0;
+		for (size_t k = 0; k < au_reps.size(); k++)
+			au_mem_size += au_reps[k].getMemory();
+		if (params.do_au_test)
+			au_mem_size += ntrees*AU_NSCALES*params.topotest_replicates*sizeof(double);
+		size_t mem_size = boot_samples.getMemory() + au_mem_size +
 				ntrees*params.topotest_replicates*sizeof(double) +
 				(nptn + ntrees*3 + params.topotest_replicates*2)*sizeof(double) +
-				ntrees*sizeof(TreeInfo) +
-				params.do_weighted_test*(ntrees * nptn * sizeof(double) + ntrees*ntrees*sizeof(double));
+				ntrees*sizeof(TreeInfo) + batch_trees*maxnptn*sizeof(double) +
+				params.do_weighted_test*(ntrees*ntrees*sizeof(double));
 		cout << "Note: " << ((double)mem_size/1024)/1024 << " MB of RAM required!" << endl;
 		if (mem_size > getMemorySize()-100000)
 			outWarning("The required memory does not fit in RAM!");
-		cout << "Creating " << params.topotest_replicates << " bootstrap replicates..." << endl;
-		if (!(boot_samples = new int [params.topotest_replicates*nptn]))
-			outError(ERR_NO_MEMORY);
-#ifdef _OPENMP
-        #pragma omp parallel private(boot) if(nptn > 10000)
-        {
-        int *rstream;
-        init_random(params.ran_seed + omp_get_thread_num(), false, &rstream);
-        #pragma omp for schedule(static)
-#else
-        int *rstream = randstream;
-#endif
-		for (boot = 0; boot < params.topotest_replicates; boot++)
-            if (boot == 0)
-                tree->aln->getPatternFreq(boot_samples + (boot*nptn));
-            else
-                tree->aln->createBootstrapAlignment(boot_samples + (boot*nptn), params.bootstrap_spec, rstream);
-#ifdef _OPENMP
-        finish_random(rstream);
-        }
-#endif
-        cout << "done" << endl;
 		//if (!(saved_tree_lhs = new double [ntrees * params.topotest_replicates]))
 		//	outError(ERR_NO_MEMORY);
 		if (!(tree_lhs = new double [ntrees * params.topotest_replicates]))
 			outError(ERR_NO_MEMORY);
+		if (params.do_au_test) {
+			cout << (ntrees*AU_NSCALES*params.topotest_replicates*sizeof(double) >> 20) << " MB required for AU test" << endl;
+			if (!(au_tree_lhs = new double [ntrees * AU_NSCALES * params.topotest_replicates]))
+				outError("Not enough memory to perform AU test!");
+		}
 		if (params.do_weighted_test || params.do_au_test) {
 			if (!(lhdiff_weights = new double [ntrees * ntrees]))
 				outError(ERR_NO_MEMORY);
-            pattern_lhs = aligned_alloc<double>(ntrees*maxnptn);
-//			if (!(pattern_lhs = new double[ntrees* nptn]))
-//				outError(ERR_NO_MEMORY);
 		}
+        pattern_lhs = aligned_alloc<double>(batch_trees*maxnptn);
         pattern_lh = aligned_alloc<double>(maxnptn);
 //		if (!(pattern_lh = new double[nptn]))
 //			outError(ERR_NO_MEMORY);
@@ -3134,88 +3460,138 @@ void evaluateTrees(Params &params, IQTree *tree, vector<TreeInfo> &info, IntVect
 	}
 	int tree_index, tid, tid2;
 	info.resize(ntrees);
-	//for (MTreeSet::iterator it = trees.begin(); it != trees.end(); it++, tree_index++) {
-	for (tree_index = 0, tid = 0; tree_index < distinct_ids.size(); tree_index++) {
 
-		cout << "Tree " << tree_index + 1;
-		if (distinct_ids[tree_index] >= 0) {
-			cout << " / identical to tree " << distinct_ids[tree_index]+1 << endl;
-			// ignore tree
-			char ch;
-			do {
-				in >> ch;
-			} while (!in.eof() && ch != ';');
-			continue;
-		}
-		tree->freeNode();
-		tree->readTree(in, tree->rooted);
-        if (!tree->findNodeName(tree->aln->getSeqName(0))) {
-            outError("Taxon " + tree->aln->getSeqName(0) + " not found in tree");
-        }
+	// the distinct trees of a chunk are evaluated concurrently by the workers, if any,
+	// and their results are printed in input order
+	vector<PhyloTree*> workers;
+	createUserTreeWorkers(params, tree, ntrees, workers);
+	// the workers must only read the shared model
+	string model_params;
+	if (!workers.empty())
+		model_params = tree->getModel()->getNameParams() + tree->getRate()->getNameParams();
+	size_t chunk_size = 1;
+	vector<UserTreeResult> chunk;
+	double *chunk_pattern_lh = NULL;
+	if (!workers.empty()) {
+		chunk_size = min(ntrees, workers.size()*TOPOTEST_TREES_PER_WORKER);
+		chunk_size = max((size_t)1, min(chunk_size, RELL_TREE_BATCH_MEM / (maxnptn*sizeof(double))));
+		chunk.resize(chunk_size);
+		if (pattern_lh || params.print_site_lh)
+			chunk_pattern_lh = aligned_alloc<double>(chunk_size*maxnptn);
+	}
 
-        if (tree->rooted && tree->getModel()->isReversible()) {
-            if (tree->leafNum != tree->aln->getNSeq()+1)
-                outError("Tree does not have same number of taxa as alignment");
-            tree->convertToUnrooted();
-        } else if (!tree->rooted && !tree->getModel()->isReversible()) {
-            if (tree->leafNum != tree->aln->getNSeq())
-                outError("Tree does not have same number of taxa as alignment");
-            tree->convertToRooted();
-        }
-		tree->setAlignment(tree->aln);
-        tree->setRootNode(params.root);
-		if (tree->isSuperTree())
-			((PhyloSuperTree*) tree)->mapTrees();
-
-		tree->initializeAllPartialLh();
-		tree->fixNegativeBranch(false);
-		if (!params.fixed_branch_length) {
-			tree->setCurScore(tree->optimizeAllBranches(100, 0.001));
-		} else {
-			tree->setCurScore(tree->computeLikelihood());
-		}
-		treeout << "[ tree " << tree_index+1 << " lh=" << tree->getCurScore() << " ]";
-		tree->printTree(treeout);
-		treeout << endl;
-		if (params.print_tree_lh)
-			scoreout << tree->getCurScore() << endl;
-
-		cout << " / LogL: " << tree->getCurScore() << endl;
-
-		if (pattern_lh) {
-			double curScore = tree->getCurScore();
-            memset(pattern_lh, 0, maxnptn*sizeof(double));
-			tree->computePatternLikelihood(pattern_lh, &curScore);
-			if (params.do_weighted_test || params.do_au_test)
-				memcpy(pattern_lhs + tid*maxnptn, pattern_lh, maxnptn*sizeof(double));
-		}
-		if (params.print_site_lh) {
-			string tree_name = "Tree" + convertIntToString(tree_index+1);
-			printSiteLh(site_lh_file.c_str(), tree, pattern_lh, true, tree_name.c_str());
-		}
-		if (params.print_partition_lh) {
-			string tree_name = "Tree" + convertIntToString(tree_index+1);
-			printPartitionLh(part_lh_file.c_str(), tree, pattern_lh, true, tree_name.c_str());
+	//for (MTreeSet::iterator it = trees.begin(); it != trees.end(); it++, tree_index++) {
+	for (tree_index = 0, tid = 0; tree_index < distinct_ids.size(); ) {
+		int chunk_end, num_distinct, i;
+		for (chunk_end = tree_index, num_distinct = 0; chunk_end < distinct_ids.size() && num_distinct < chunk_size; chunk_end++)
+			if (distinct_ids[chunk_end] < 0)
+				num_distinct++;
+
+		if (!workers.empty()) {
+			for (i = tree_index, num_distinct = 0; i < chunk_end; i++) {
+				string tree_str;
+				getline(in, tree_str, ';');
+				if (distinct_ids[i] < 0)
+					chunk[num_distinct++].tree_str = tree_str + ";";
+			}
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) num_threads(workers.size())
+#endif
+			for (i = 0; i < num_distinct; i++) {
+				int thread_id = 0;
+#ifdef _OPENMP
+				thread_id = omp_get_thread_num();
+#endif
+				PhyloTree *worker = workers[thread_id];
+				istringstream tree_in(chunk[i].tree_str);
+				chunk[i].logl = evaluateUserTree(params, worker, tree_in,
+					chunk_pattern_lh ? chunk_pattern_lh + i*maxnptn : NULL, maxnptn);
+				ostringstream tree_out;
+				worker->printTree(tree_out);
+				chunk[i].tree_str = tree_out.str();
+				chunk[i].flags = tree_out.flags();
+				chunk[i].precision = tree_out.precision();
+			}
 		}
-		info[tid].logl = tree->getCurScore();
 
-		if (!params.topotest_replicates || ntrees <= 1) {
+		for (i = 0; tree_index < chunk_end; tree_index++) {
+			cout << "Tree " << tree_index + 1;
+			if (distinct_ids[tree_index] >= 0) {
+				cout << " / identical to tree " << distinct_ids[tree_index]+1 << endl;
+				if (!workers.empty())
+					continue;
+				// ignore tree
+				char ch;
+				do {
+					in >> ch;
+				} while (!in.eof() && ch != ';');
+				continue;
+			}
+			double logl;
+			double *tree_pattern_lh;
+			treeout << "[ tree " << tree_index+1 << " lh=";
+			if (workers.empty()) {
+				logl = evaluateUserTree(params, tree, in, pattern_lh, maxnptn);
+				tree_pattern_lh = pattern_lh;
+				treeout << logl << " ]";
+				tree->printTree(treeout);
+			} else {
+				logl = chunk[i].logl;
+				tree_pattern_lh = chunk_pattern_lh ? chunk_pattern_lh + i*maxnptn : NULL;
+				treeout << logl << " ]" << chunk[i].tree_str;
+				// printTree leaves its number format in the stream, as when printing to treeout
+				treeout.flags(chunk[i].flags);
+				treeout.precision(chunk[i].precision);
+				i++;
+			}
+			treeout << endl;
+			if (params.print_tree_lh)
+				scoreout << logl << endl;
+
+			cout << " / LogL: " << logl << endl;
+
+			if (pattern_lhs)
+				memcpy(pattern_lhs + (tid % batch_trees)*maxnptn, tree_pattern_lh, maxnptn*sizeof(double));
+			if (params.print_site_lh) {
+				string tree_name = "Tree" + convertIntToString(tree_index+1);
+				printSiteLh(site_lh_file.c_str(), tree, tree_pattern_lh, true, tree_name.c_str());
+			}
+			if (params.print_partition_lh) {
+				string tree_name = "Tree" + convertIntToString(tree_index+1);
+				printPartitionLh(part_lh_file.c_str(), tree, tree_pattern_lh, true, tree_name.c_str());
+			}
+			info[tid].logl = logl;
+
+			if (!params.topotest_replicates || ntrees <= 1) {
+				tid++;
+				continue;
+			}
+			// now compute RELL scores, once a batch of trees is complete
+			orig_tree_lh[tid] = logl;
 			tid++;
-			continue;
-		}
-		// now compute RELL scores
-		orig_tree_lh[tid] = tree->getCurScore();
-		double *tree_lhs_offset = tree_lhs + (tid*params.topotest_replicates);
-		for (boot = 0; boot < params.topotest_replicates; boot++) {
-			double lh = 0.0;
-			int *this_boot_sample = boot_samples + (boot*nptn);
-			for (size_t ptn = 0; ptn < nptn; ptn++)
-				lh += pattern_lh[ptn] * this_boot_sample[ptn];
-			tree_lhs_offset[boot] = lh;
+			if (tid % batch_trees == 0 || tid == ntrees) {
+				size_t batch_begin = (tid-1) / batch_trees * batch_trees;
+				computeRELLScores(boot_samples, pattern_lhs, tid - batch_begin, maxnptn,
+					tree_lhs + batch_begin*params.topotest_replicates, params.topotest_replicates);
+				if (au_tree_lhs)
+					computeAURELLScores(au_reps, pattern_lhs, tid - batch_begin, maxnptn,
+						au_tree_lhs + batch_begin*AU_NSCALES*params.topotest_replicates);
+			}
 		}
-		tid++;
 	}
 
+	if (!workers.empty())
+		ASSERT(model_params == tree->getModel()->getNameParams() + tree->getRate()->getNameParams());
+	for (vector<PhyloTree*>::iterator it = workers.begin(); it != workers.end(); it++) {
+		// the model is owned by tree
+		(*it)->setModelFactory(NULL);
+		(*it)->setModel(NULL);
+		(*it)->setRate(NULL);
+		delete *it;
+	}
+	if (chunk_pattern_lh)
+		aligned_free(chunk_pattern_lh);
+
 	ASSERT(tid == ntrees);
 
 	if (params.topotest_replicates && ntrees > 1) {
@@ -3427,7 +3803,7 @@ void evaluateTrees(Params &params, IQTree *tree, vector<TreeInfo> &info, IntVect
 
         if (params.do_au_test) {
             cout << "Performing approximately unbiased (AU) test..." << endl;
-            performAUTest(params, tree, pattern_lhs, info);
+            performAUTest(params, tree, au_tree_lhs, info);
         }
 
 		delete [] tree_ranks;
@@ -3446,10 +3822,10 @@ void evaluateTrees(Params &params, IQTree *tree, vector<TreeInfo> &info, IntVect
 		delete [] lhdiff_weights;
 	if (tree_lhs)
 		delete [] tree_lhs;
+	if (au_tree_lhs)
+		delete [] au_tree_lhs;
 	//if (saved_tree_lhs)
 	//	delete [] saved_tree_lhs;
-	if (boot_samples)
-		delete [] boot_samples;
 
 	if (params.print_tree_lh) {
 		scoreout.close();
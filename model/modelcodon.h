@@ -209,6 +209,11 @@ protected:
 	*/
 	virtual bool getVariables(double *variables);
 
+	/**
+		rates[] are computed from the model parameters: no analytic gradient
+	*/
+	virtual bool getRateVariables(int *rate_var) { return false; }
+
 };
 
 #endif /* MODELCODON_H_ */
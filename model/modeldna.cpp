@@ -470,6 +470,15 @@ bool ModelDNA::getVariables(double *variables) {
 //              state_freq[highest_freq_state] = 1.0/sum;
 }
 
+bool ModelDNA::getRateVariables(int *rate_var) {
+    if (num_params <= 0)
+        return false;
+    int num_all = param_spec.length();
+    for (int i = 0; i < num_all; i++)
+        rate_var[i] = param_fixed[param_spec[i]] ? 0 : (int)param_spec[i];
+    return true;
+}
+
 /*
  * setVariables *reads* the state of the model and writes into "variables"
  * Model does not change state. *variables should have length getNDim()+1
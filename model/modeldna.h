@@ -125,6 +125,13 @@ protected:
 	*/
 	virtual bool getVariables(double *variables);
 
+	/**
+		map the entries of the rate matrix to the optimization variables via param_spec
+		@param rate_var (OUT) rate_var[k] is the index of the variable of rates[k], 0 if fixed
+		@return TRUE if there are free rate parameters
+	*/
+	virtual bool getRateVariables(int *rate_var);
+
 	/**
 		rate parameter specification, a string of 6 characters
 	*/
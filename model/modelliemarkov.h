@@ -119,6 +119,11 @@ protected:
 	*/
 	virtual bool getVariables(double *variables);
 
+	/**
+		rates[] are computed from the model parameters: no analytic gradient
+	*/
+	virtual bool getRateVariables(int *rate_var) { return false; }
+
 	static void parseModelName(string model_name, int* model_num, int* symmetry);
 	/*
          * Overrides ModelMarkov::getName().
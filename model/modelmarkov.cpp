@@ -750,6 +750,101 @@ double ModelMarkov::targetFunk(double x[]) {
 
 }
 
+bool ModelMarkov::getRateVariables(int *rate_var) {
+	if (!is_reversible || !half_matrix || num_params <= 0)
+		return false;
+	int nrates = getNumRateEntries();
+	// see getVariables(): the first num_params rates are variables[1..num_params]
+	for (int i = 0; i < nrates; i++)
+		rate_var[i] = (i < num_params) ? i+1 : 0;
+	return true;
+}
+
+double ModelMarkov::derivativeFunk(double x[], double dfx[]) {
+	int ndim = getNDim();
+	int nrates = getNumRateEntries();
+	int *rate_var = new int[nrates];
+	if (phylo_tree->getModel() != this || !normalize_matrix || ignore_state_freq ||
+		!phylo_tree->isRateMatrixGradientSupported() || !getRateVariables(rate_var)) {
+		delete [] rate_var;
+		return Optimization::derivativeFunk(x, dfx);
+	}
+
+	int i, j, k, dim;
+	bool *analytic = new bool[ndim+1];
+	for (dim = 1; dim <= ndim; dim++) {
+		analytic[dim] = false;
+		dfx[dim] = 0.0;
+	}
+
+	double fx = targetFunk(x);
+
+	// normalized frequencies as used in decomposeRateMatrix()
+	double *freq = new double[num_states];
+	double sum = 0.0;
+	for (i = 0; i < num_states; i++)
+		sum += state_freq[i];
+	bool valid = true;
+	for (i = 0; i < num_states; i++) {
+		freq[i] = state_freq[i] / sum;
+		valid &= (freq[i] > ZERO_FREQ);
+	}
+
+	double *df_dQ = new double[num_states*num_states];
+	if (valid && phylo_tree->computeRateMatrixGradient(df_dQ)) {
+		// Q = total_num_subst * R / mu with R[x][y] = rates[xy]*freq[y] and mu = sum_{x!=y} freq[x]*R[x][y]
+		double mu = 0.0;
+		for (i = 0, k = 0; i < num_states; i++)
+			for (j = i+1; j < num_states; j++, k++)
+				mu += 2.0 * freq[i] * freq[j] * rates[k];
+		double scale = total_num_subst / mu;
+		// d(logL)/d(mu) * mu = -sum_xy Q[x][y] * df_dQ[x][y]
+		double q_df_dQ = 0.0;
+		for (i = 0, k = 0; i < num_states; i++)
+			for (j = i+1; j < num_states; j++, k++) {
+				double q_ij = scale * rates[k] * freq[j];
+				double q_ji = scale * rates[k] * freq[i];
+				q_df_dQ += q_ij * (df_dQ[i*num_states+j] - df_dQ[i*num_states+i]) +
+					q_ji * (df_dQ[j*num_states+i] - df_dQ[j*num_states+j]);
+			}
+		for (i = 0, k = 0; i < num_states; i++)
+			for (j = i+1; j < num_states; j++, k++) {
+				if (rate_var[k] <= 0)
+					continue;
+				double df = scale * (freq[j] * (df_dQ[i*num_states+j] - df_dQ[i*num_states+i]) +
+					freq[i] * (df_dQ[j*num_states+i] - df_dQ[j*num_states+j])) -
+					2.0 * freq[i] * freq[j] / mu * q_df_dQ;
+				// targetFunk is the negative log-likelihood
+				dfx[rate_var[k]] -= df;
+				analytic[rate_var[k]] = true;
+			}
+	}
+
+	// finite differences for the remaining variables, e.g. state frequencies
+	computeFiniteDifferences(x, fx, dfx, analytic);
+
+	delete [] df_dQ;
+	delete [] freq;
+	delete [] analytic;
+	delete [] rate_var;
+	return fx;
+}
+
+void ModelMarkov::getFunkWorkers(int max_num, vector<Optimization*> &workers) {
+	// mixture models switch between optimizing weights and submodels
+	if (phylo_tree->getModel() != this || isMixture())
+		return;
+	// the copies evaluate other parameters, thus have other tip partial likelihoods
+	int num = phylo_tree->prepareWorkerTrees(max_num, false);
+	for (int i = 0; i < num; i++)
+		workers.push_back(phylo_tree->worker_trees[i]->getModel());
+}
+
+void ModelMarkov::releaseFunkWorkers() {
+	if (phylo_tree && phylo_tree->getModel() == this)
+		phylo_tree->deleteWorkerTrees();
+}
+
 bool ModelMarkov::isUnstableParameters() {
 	int nrates = getNumRateEntries();
 	int i;
@@ -276,6 +276,28 @@ public:
 	*/
 	virtual double targetFunk(double x[]);
 
+	/**
+		the gradient of targetFunk. Derivatives w.r.t. rate parameters are computed analytically
+		from the eigen-decomposition (see PhyloTree::computeRateMatrixGradient), the remaining
+		ones by finite differences as in Optimization::derivativeFunk
+		@param x the input vector x
+		@param dfx the derivative at x
+		@return the function value at x
+	*/
+	virtual double derivativeFunk(double x[], double dfx[]);
+
+	/**
+		the models of the worker copies of phylo_tree (see PhyloTree::prepareWorkerTrees)
+		@param max_num maximal number of copies needed
+		@param workers (OUT) the copies
+	*/
+	virtual void getFunkWorkers(int max_num, vector<Optimization*> &workers);
+
+	/**
+		free the worker copies of phylo_tree
+	*/
+	virtual void releaseFunkWorkers();
+
 	/**
 	 * setup the bounds for joint optimization with BFGS
 	 */
@@ -395,6 +417,14 @@ protected:
 	*/
 	virtual bool getVariables(double *variables);
 
+	/**
+		map the entries of the rate matrix to the optimization variables, for the analytic gradient
+		@param rate_var (OUT) rate_var[k] is the index of the variable that rates[k] is read from
+			in getVariables(), or 0 if rates[k] is not optimized
+		@return TRUE if rates[] are directly the exchangeabilities of a reversible model, FALSE otherwise
+	*/
+	virtual bool getRateVariables(int *rate_var);
+
 
 	/**
 	 * Called from getVariables to update the rate matrix for the new
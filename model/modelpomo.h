@@ -335,6 +335,11 @@ class ModelPoMo : virtual public ModelMarkov
      */
     virtual bool getVariables(double *variables);
 
+    /**
+     * rates[] are computed from the mutation rates: no analytic gradient
+     */
+    virtual bool getRateVariables(int *rate_var) { return false; }
+
     /**
 	 * Called from getVariables() to update the rate matrix for the
 	 * new model parameters.  For ModelPoMo this is only a dummy
@@ -224,6 +224,23 @@ double RateFree::targetFunk(double x[]) {
 	return -phylo_tree->computeLikelihood();
 }
 
+void RateFree::getFunkWorkers(int max_num, vector<Optimization*> &workers) {
+	if (phylo_tree->getRate() != this)
+		return;
+	int num = phylo_tree->prepareWorkerTrees(max_num, true);
+	for (int i = 0; i < num; i++) {
+		RateFree *rate = dynamic_cast<RateFree*>(phylo_tree->worker_trees[i]->getRate());
+		ASSERT(rate);
+		rate->optimizing_params = optimizing_params;
+		workers.push_back(rate);
+	}
+}
+
+void RateFree::releaseFunkWorkers() {
+	if (phylo_tree && phylo_tree->getRate() == this)
+		phylo_tree->deleteWorkerTrees();
+}
+
 
 
 /**
@@ -61,6 +61,19 @@ public:
 	*/
 	virtual double targetFunk(double x[]);
 
+	/**
+		the rate models of the worker copies of phylo_tree (see PhyloTree::prepareWorkerTrees),
+		set to optimize the same parameters as this
+		@param max_num maximal number of copies needed
+		@param workers (OUT) the copies
+	*/
+	virtual void getFunkWorkers(int max_num, vector<Optimization*> &workers);
+
+	/**
+		free the worker copies of phylo_tree
+	*/
+	virtual void releaseFunkWorkers();
+
 	/**
 	 * setup the bounds for joint optimization with BFGS
 	 */
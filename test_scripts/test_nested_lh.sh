@@ -0,0 +1,65 @@
+#!/bin/bash -
+#===============================================================================
+#
+#          FILE: test_nested_lh.sh
+#
+#         USAGE: ./test_nested_lh.sh <iqtree_binary> [<num_threads>]
+#
+#   DESCRIPTION: Check that the likelihood of partitions computed in nested
+#                parallel regions (partition groups of PhyloSuperTree) is the
+#                same as the serial one. Each partition model is run with one
+#                thread and with <num_threads> threads (default: 2) on the same
+#                starting tree; the log-likelihoods must agree.
+#
+#       OPTIONS: ---
+#  REQUIREMENTS: an OpenMP build of IQ-TREE
+#          BUGS: ---
+#         NOTES: ---
+#       CREATED: 2026-10-18
+#      REVISION:  ---
+#===============================================================================
+
+set -o nounset                              # Treat unset variables as an error
+
+if [ "$#" -lt 1 ]
+then
+    echo "USAGE: $0 <iqtree_binary> [<num_threads>]" >&2
+    exit 1
+fi
+
+iqtree=$1
+numThreads=${2:-2}
+dataDir=$(cd $(dirname $0)/test_data && pwd)
+outDir=$(mktemp -d)
+status=0
+
+# log-likelihood of the final tree of a run
+getLogl() {
+    grep "BEST SCORE FOUND" $1.log | awk '{print $NF}'
+}
+
+for partOpt in "-q" "-spp" "-sp"
+do
+    for aln in example d59_8
+    do
+        prefix=${outDir}/${aln}${partOpt}
+        for nt in 1 ${numThreads}
+        do
+            ${iqtree} -s ${dataDir}/${aln}.phy ${partOpt} ${dataDir}/${aln}.nex -m GTR+G -n 0 \
+                -seed 1 -nt ${nt} -pre ${prefix}.nt${nt} -quiet -redo > /dev/null 2>&1
+        done
+        serialLogl=$(getLogl ${prefix}.nt1)
+        nestedLogl=$(getLogl ${prefix}.nt${numThreads})
+        if [ "${serialLogl}" == "" ] || [ "${nestedLogl}" == "" ] ||
+            ! awk -v a=${serialLogl} -v b=${nestedLogl} 'BEGIN {d = a-b; exit !(d < 0.01 && d > -0.01)}'
+        then
+            echo "ERROR: ${aln} ${partOpt}: log-likelihood ${serialLogl} with 1 thread, ${nestedLogl} with ${numThreads} threads"
+            status=1
+        else
+            echo "OK: ${aln} ${partOpt}: ${serialLogl}"
+        fi
+    done
+done
+
+rm -rf ${outDir}
+exit ${status}
@@ -237,7 +237,7 @@ int CandidateSet::update(string newTree, double newScore) {
     }
     CandidateTree candidate;
     candidate.score = newScore;
-    candidate.topology = convertTreeString(newTree);
+    candidate.topology = computeTopologyHash(newTree);
     candidate.tree = newTree;
 
     int treePos;
@@ -323,7 +323,69 @@ string CandidateSet::getTopology(string tree) {
     return ostr.str();
 }
 
-double CandidateSet::getTopologyScore(string topology) {
+/**
+ * 64-bit finalizer of splitmix64, used to derive taxon keys and to mix split sums
+ */
+static inline uint64_t mixTopologyBits(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+/**
+ * add the hashes of all splits below \a node to \a topo
+ * @param sub1, sub2 (OUT) sums of the two taxon keys over the taxa below \a node
+ */
+static void hashTopologySplits(Node *node, Node *dad, uint64_t &sub1, uint64_t &sub2, TopologyHash &topo) {
+    if (node->isLeaf()) {
+        uint64_t id = node->id;
+        sub1 = mixTopologyBits(2*id + 1);
+        sub2 = mixTopologyBits(2*id + 2);
+        return;
+    }
+    sub1 = sub2 = 0;
+    FOR_NEIGHBOR_IT(node, dad, it) {
+        uint64_t child1, child2;
+        hashTopologySplits((*it)->node, node, child1, child2, topo);
+        sub1 += child1;
+        sub2 += child2;
+        // ignore nodes with degree of 2, as in MTree::convertSplits()
+        if (node->degree() != 2) {
+            topo.h1 += mixTopologyBits(child1);
+            topo.h2 += mixTopologyBits(child2 ^ 0x9e3779b97f4a7c15ULL);
+        }
+    }
+}
+
+TopologyHash CandidateSet::computeTopologyHash(string tree) {
+    MTree mtree;
+    stringstream str;
+    str << tree;
+    str.seekg(0, ios::beg);
+    mtree.readTree(str, Params::getInstance().is_rooted);
+    NodeVector taxa;
+    mtree.getTaxa(taxa);
+    for (NodeVector::iterator it = taxa.begin(); it != taxa.end(); it++)
+        if ((*it)->name != ROOT_NAME)
+            (*it)->id = atoi((*it)->name.c_str());
+    // unrooted trees: every split is taken on the side without taxon 0
+    if (!mtree.rooted) {
+        string rootName = "0";
+        Node *root = mtree.findLeafName(rootName);
+        if (root)
+            mtree.root = root;
+    }
+    TopologyHash topo;
+    uint64_t sub1, sub2;
+    Node *root = mtree.root;
+    hashTopologySplits(root->neighbors[0]->node, root, sub1, sub2, topo);
+    return topo;
+}
+
+double CandidateSet::getTopologyScore(TopologyHash topology) {
     ASSERT(topologies.find(topology) != topologies.end());
     return topologies[topology];
 }
@@ -363,15 +425,15 @@ void CandidateSet::getAllTrees(vector<string> &trees, vector<double> &scores, in
     }
 }
 
-bool CandidateSet::treeTopologyExist(string topo) {
+bool CandidateSet::treeTopologyExist(TopologyHash topo) {
     return (topologies.find(topo) != topologies.end());
 }
 
 bool CandidateSet::treeExist(string tree) {
-    return treeTopologyExist(convertTreeString(tree));
+    return treeTopologyExist(computeTopologyHash(tree));
 }
 
-CandidateSet::iterator CandidateSet::getCandidateTree(string topology) {
+CandidateSet::iterator CandidateSet::getCandidateTree(TopologyHash topology) {
     for (CandidateSet::reverse_iterator rit = rbegin(); rit != rend(); rit++) {
         if (rit->second.topology == topology)
             return --(rit.base());
@@ -379,7 +441,7 @@ CandidateSet::iterator CandidateSet::getCandidateTree(string topology) {
     return end();
 }
 
-void CandidateSet::removeCandidateTree(string topology) {
+void CandidateSet::removeCandidateTree(TopologyHash topology) {
     bool removed = false;
     double treeScore;
     // Find the score of the topology
@@ -500,7 +562,7 @@ void CandidateSet::printTrees(string suffix) {
     outLHs.precision(15);
     for (reverse_iterator rit = rbegin(); rit != rend(); rit++) {
         outLHs << rit->first << endl;
-        outTrees << rit->second.topology << endl;
+        outTrees << convertTreeString(rit->second.tree) << endl;
     }
     outTrees.close();
     outLHs.close();
@@ -32,6 +32,40 @@
 
 class IQTree;
 
+/**
+ * 128-bit topology identity: sum over all bipartitions of a mixed hash of the
+ * taxa on the side not containing the root taxon. Independent of the order in
+ * which subtrees are printed.
+ */
+struct TopologyHash {
+    uint64_t h1, h2;
+
+    TopologyHash() : h1(0), h2(0) {}
+
+    bool operator==(const TopologyHash &other) const {
+        return h1 == other.h1 && h2 == other.h2;
+    }
+
+    bool operator!=(const TopologyHash &other) const {
+        return !(*this == other);
+    }
+
+    bool operator<(const TopologyHash &other) const {
+        return h1 < other.h1 || (h1 == other.h1 && h2 < other.h2);
+    }
+};
+
+#ifdef USE_HASH_MAP
+struct hashfunc_TopologyHash {
+    size_t operator()(const TopologyHash &topo) const {
+        return (size_t)topo.h1;
+    }
+};
+typedef unordered_map<TopologyHash, double, hashfunc_TopologyHash> TopologyDoubleHashMap;
+#else
+typedef map<TopologyHash, double> TopologyDoubleHashMap;
+#endif
+
 struct CandidateTree {
 
 	/**
@@ -41,11 +75,9 @@ struct CandidateTree {
 	string tree;
 
 	/**
-	 * tree topology WITHOUT branch lengths
-	 * and WITH TAXON ID (instead of taxon names)
-	 * for sorting purpose
+	 * split hash of the tree topology, used to detect duplicate topologies
 	 */
-	string topology;
+	TopologyHash topology;
 
 	/**
 	 * log-likelihood or parsimony score
@@ -182,9 +214,9 @@ public:
      * 	Check if tree topology \a topo already exists
      *
      * 	@param topo
-     * 		Newick string of the tree topology
+     * 		split hash of the tree topology
      */
-    bool treeTopologyExist(string topo);
+    bool treeTopologyExist(TopologyHash topo);
 
     /**
      * 	Check if tree \a tree already exists
@@ -217,16 +249,27 @@ public:
      * 		Newick string of the tree topology
      */
     string getTopology(string tree);
-    
+
+    /**
+     * 	Return the split hash of a tree topology, which does not depend on branch lengths
+     * 	or on the order of subtrees
+     *
+     * 	@param tree
+     * 		The newick tree string with taxon IDs as leaf names
+     * 	@return
+     * 		128-bit hash over all bipartitions of the tree
+     */
+    TopologyHash computeTopologyHash(string tree);
+
     /**
      * return the score of \a topology
      *
      * @param topology
-     * 		Newick topology
+     * 		split hash of the topology
      * @return
      * 		Score of the topology
      */
-    double getTopologyScore(string topology);
+    double getTopologyScore(TopologyHash topology);
 
     /**
      *  Empty the candidate set
@@ -275,13 +318,13 @@ public:
      * @param topology
      * @return
      */
-    iterator getCandidateTree(string topology);
+    iterator getCandidateTree(TopologyHash topology);
 
     /**
      * Remove candidate trees with topology equal to the specified topology
      * @param topology
      */
-    void removeCandidateTree(string topology);
+    void removeCandidateTree(TopologyHash topology);
 
     /**
      *  Remove the worst tree in the candidate set
@@ -291,7 +334,7 @@ public:
     /* Getter and Setter function */
 	void setAln(Alignment* aln);
 
-	const StringDoubleHashMap& getTopologies() const {
+	const TopologyDoubleHashMap& getTopologies() const {
 		return topologies;
 	}
 
@@ -378,9 +421,9 @@ private:
 	SplitIntMap candSplits;
 
     /**
-     *  Map data structure storing <topology_string, score>
+     *  Map data structure storing <topology_hash, score>
      */
-    StringDoubleHashMap topologies;
+    TopologyDoubleHashMap topologies;
 
     /**
      *  Trees used for reproduction
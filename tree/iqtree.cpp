@@ -31,6 +31,7 @@
 //#include "phylotreemixlen.h"
 //#include "model/modelfactorymixlen.h"
 #include <numeric>
+#include <limits>
 #include "utils/tools.h"
 #include "utils/MPIHelper.h"
 #include "utils/pllnni.h"
@@ -49,6 +50,8 @@ void IQTree::init() {
     k_delete = k_delete_min = k_delete_max = k_delete_stay = 0;
     dist_matrix = NULL;
     var_matrix = NULL;
+    condensed_dist = NULL;
+    condensed_var = NULL;
 //    curScore = 0.0; // Current score of the tree
     cur_pars_score = -1;
 //    enable_parsimony = false;
@@ -65,6 +68,9 @@ void IQTree::init() {
     duplication_counter = 0;
     //boot_splits = new SplitGraph;
     pll2iqtree_pattern_index = NULL;
+    boot_samples_ptn = NULL;
+    boot_samples_stride = 0;
+    ufboot_batch_lh = NULL;
 
     treels_name = Params::getInstance().out_prefix;
     treels_name += ".treels";
@@ -97,6 +103,7 @@ void IQTree::setCheckpoint(Checkpoint *checkpoint) {
 }
 
 void IQTree::saveUFBoot(Checkpoint *checkpoint) {
+    flushUFBootBatch();
     checkpoint->startStruct("UFBoot");
     if (MPIHelper::getInstance().isWorker()) {
         CKP_SAVE(sample_start);
@@ -129,6 +136,7 @@ void IQTree::saveUFBoot(Checkpoint *checkpoint) {
 }
 
 void IQTree::saveCheckpoint() {
+    flushUFBootBatch();
     stop_rule.saveCheckpoint();
     candidateTrees.saveCheckpoint();
     
@@ -360,10 +368,30 @@ void IQTree::initSettings(Params &params) {
 #else
         size_t nptn = get_safe_upper_limit(orig_nptn);
 #endif
-        BootValType *mem = aligned_alloc<BootValType>(nptn * (size_t)(params.gbo_replicates));
-        memset(mem, 0, nptn * (size_t)(params.gbo_replicates) * sizeof(BootValType));
-        for (i = 0; i < params.gbo_replicates; i++)
-        	boot_samples[i] = mem + i*nptn;
+        if (params.ufboot_batch > 0) {
+            // one pattern-major matrix for the blocked RELL kernel, columns padded to 16
+            boot_samples_stride = ((sample_end - sample_start + 15)/16)*16;
+            boot_samples_ptn = aligned_alloc<BootValType>(orig_nptn * boot_samples_stride);
+            memset(boot_samples_ptn, 0, orig_nptn * boot_samples_stride * sizeof(BootValType));
+            for (i = 0; i < params.gbo_replicates; i++)
+                boot_samples[i] = NULL;
+            ufboot_batch_lh = aligned_alloc<BootValType>(nptn * params.ufboot_batch);
+            cout << "Batching RELL computation of " << params.ufboot_batch << " trees" << endl;
+        } else if (params.ufboot_compact) {
+            BootCountType *mem = aligned_alloc<BootCountType>(nptn * (size_t)(params.gbo_replicates));
+            memset(mem, 0, nptn * (size_t)(params.gbo_replicates) * sizeof(BootCountType));
+            boot_samples_compact.resize(params.gbo_replicates);
+            boot_samples_overflow.resize(params.gbo_replicates);
+            for (i = 0; i < params.gbo_replicates; i++) {
+                boot_samples[i] = NULL;
+                boot_samples_compact[i] = mem + i*nptn;
+            }
+        } else {
+            BootValType *mem = aligned_alloc<BootValType>(nptn * (size_t)(params.gbo_replicates));
+            memset(mem, 0, nptn * (size_t)(params.gbo_replicates) * sizeof(BootValType));
+            for (i = 0; i < params.gbo_replicates; i++)
+                boot_samples[i] = mem + i*nptn;
+        }
 
         if (boot_trees.empty()) {
             boot_logl.resize(params.gbo_replicates, -DBL_MAX);
@@ -373,30 +401,51 @@ void IQTree::initSettings(Params &params) {
         } else {
             cout << "CHECKPOINT: " << boot_trees.size() << " UFBoot trees and " << boot_splits.size() << " UFBootSplits restored" << endl;
         }
+		// Diep: initialize data members to be used in the Refinement Step
+		if (params.ufboot2corr)
+			boot_samples_int.resize(params.gbo_replicates);
+
         VerboseMode saved_mode = verbose_mode;
         verbose_mode = VB_QUIET;
         for (i = 0; i < params.gbo_replicates; i++) {
+			IntVector this_sample;
         	if (params.print_bootaln) {
     			Alignment* bootstrap_alignment;
     			if (aln->isSuperAlignment())
     				bootstrap_alignment = new SuperAlignment;
     			else
     				bootstrap_alignment = new Alignment;
-    			IntVector this_sample;
     			bootstrap_alignment->createBootstrapAlignment(aln, &this_sample, params.bootstrap_spec);
-    			for (size_t j = 0; j < orig_nptn; j++)
-    				boot_samples[i][j] = this_sample[j];
     			if(!isSuperTree())
     				bootstrap_alignment->printPhylip(bootaln_name.c_str(), true);
     			else
     				((SuperAlignment *) bootstrap_alignment)->printCombinedAlignment(bootaln_name.c_str(), true);
 				delete bootstrap_alignment;
         	} else {
-    			IntVector this_sample;
         		aln->createBootstrapAlignment(this_sample, params.bootstrap_spec);
-    			for (size_t j = 0; j < orig_nptn; j++)
-    				boot_samples[i][j] = this_sample[j];
         	}
+            if (boot_samples_ptn) {
+                if (i >= sample_start && i < sample_end)
+                    for (size_t j = 0; j < orig_nptn; j++)
+                        boot_samples_ptn[j*boot_samples_stride + i - sample_start] = this_sample[j];
+            } else if (!boot_samples_compact.empty()) {
+                const int max_count = numeric_limits<BootCountType>::max();
+                for (size_t j = 0; j < orig_nptn; j++)
+                    if (this_sample[j] < max_count)
+                        boot_samples_compact[i][j] = this_sample[j];
+                    else {
+                        boot_samples_compact[i][j] = max_count;
+                        boot_samples_overflow[i].push_back(make_pair((int)j, this_sample[j] - max_count));
+                    }
+            } else {
+                for (size_t j = 0; j < orig_nptn; j++)
+                    boot_samples[i][j] = this_sample[j];
+            }
+            if (params.ufboot2corr) {
+                boot_samples_int[i].resize(nptn, 0);
+                for (size_t j = 0; j < orig_nptn; j++)
+                    boot_samples_int[i][j] = this_sample[j];
+            }
         }
         verbose_mode = saved_mode;
         if (params.print_bootaln) {
@@ -409,17 +458,8 @@ void IQTree::initSettings(Params &params) {
         finish_random();
         randstream = saved_randstream;
 
-		// Diep: initialize data members to be used in the Refinement Step
 		on_refine_btree = false;
 		saved_aln_on_refine_btree = NULL;
-		if(params.ufboot2corr){
-			boot_samples_int.resize(params.gbo_replicates);
-			for (size_t i = 0; i < params.gbo_replicates; i++) {
-				boot_samples_int[i].resize(nptn, 0);
-    			for (size_t j = 0; j < orig_nptn; j++)
-    				boot_samples_int[i][j] = boot_samples[i][j];
-	       	}
-		}
 
     }
 
@@ -443,9 +483,18 @@ IQTree::~IQTree() {
     //if (boot_splits) delete boot_splits;
 
     if (!boot_samples.empty()) {
-    	aligned_free(boot_samples[0]); // free memory
+        if (boot_samples[0])
+            aligned_free(boot_samples[0]); // free memory
         boot_samples.clear();
     }
+    if (!boot_samples_compact.empty()) {
+        aligned_free(boot_samples_compact[0]);
+        boot_samples_compact.clear();
+    }
+    if (boot_samples_ptn)
+        aligned_free(boot_samples_ptn);
+    if (ufboot_batch_lh)
+        aligned_free(ufboot_batch_lh);
 }
 
 extern const char *aa_model_names_rax[];
@@ -693,12 +742,17 @@ void IQTree::initCandidateTreeSet(int nParTrees, int nNNITrees) {
     bool orig_rooted = rooted;
     rooted = false;
 
-/* TODO: this does not work properly with partition model
-#ifdef _OPENMP
+    int processID = MPIHelper::getInstance().getProcessID();
+
+    // stepwise addition works on the (super) alignment only, thus parsimony trees are built
+    // concurrently on plain PhyloTree copies. Each tree has its own random stream seeded by
+    // its index, so that the trees do not depend on the number of threads
     StrVector pars_trees;
     if (params->start_tree == STT_PARSIMONY && nParTrees >= 1) {
         pars_trees.resize(nParTrees);
+#ifdef _OPENMP
         #pragma omp parallel
+#endif
         {
             PhyloTree tree;
             if (!constraintTree.empty()) {
@@ -706,21 +760,21 @@ void IQTree::initCandidateTreeSet(int nParTrees, int nNNITrees) {
             }
             tree.setParams(params);
             tree.setParsimonyKernel(params->SSE);
+#ifdef _OPENMP
             #pragma omp for schedule(dynamic)
+#endif
             for (int i = 0; i < nParTrees; i++) {
-                tree.computeParsimonyTree(NULL, aln);
-                if (orig_rooted)
-                    convertToRooted();
+                int *rstream;
+                init_random(params->ran_seed + processID * nParTrees + i + 1, false, &rstream);
+                tree.computeParsimonyTree(NULL, aln, rstream);
+                finish_random(rstream);
                 pars_trees[i] = tree.getTreeString();
             }
         }
     }
-#endif
-*/
 
     int init_size = candidateTrees.size();
 
-    int processID = MPIHelper::getInstance().getProcessID();
 //    unsigned long curNumTrees = candidateTrees.size();
     for (int treeNr = 1; treeNr <= nParTrees; treeNr++) {
         int parRandSeed = Params::getInstance().ran_seed + processID * nParTrees + treeNr;
@@ -750,24 +804,17 @@ void IQTree::initCandidateTreeSet(int nParTrees, int nNNITrees) {
 			curParsTree = getTreeString();
         } else if (params->start_tree == STT_PARSIMONY) {
             /********* Create parsimony tree using IQ-TREE *********/
-            rooted = false;
-            computeParsimonyTree(NULL, aln);
-            if (orig_rooted)
-                convertToRooted();
-            curParsTree = getTreeString();
-
-/* TODO: this does not work properly with partition model
-#ifdef _OPENMP
             curParsTree = pars_trees[treeNr-1];
-#else
-            rooted = false;
-            curParsTree = generateParsimonyTree(parRandSeed);
-            if (orig_rooted) {
-                convertToRooted();
+            if (isSuperTree() || orig_rooted) {
+                // partition trees take only the topology, their branch lengths are recomputed
+                rooted = false;
+                PhyloTree::readTreeString(curParsTree);
+                if (isSuperTree())
+                    fixNegativeBranch(true);
+                if (orig_rooted)
+                    convertToRooted();
                 curParsTree = getTreeString();
             }
-#endif
-*/
         }
         
         int pos = addTreeToCandidateSet(curParsTree, -DBL_MAX, false, MPIHelper::getInstance().getProcessID());
@@ -1194,12 +1241,10 @@ void IQTree::deleteLeaves(PhyloNodeVector &del_leaves) {
 }
 
 int IQTree::assessQuartet(Node *leaf0, Node *leaf1, Node *leaf2, Node *del_leaf) {
-    ASSERT(dist_matrix);
-    int nseq = aln->getNSeq();
     //int id0 = leaf0->id, id1 = leaf1->id, id2 = leaf2->id;
-    double dist0 = dist_matrix[leaf0->id * nseq + del_leaf->id] + dist_matrix[leaf1->id * nseq + leaf2->id];
-    double dist1 = dist_matrix[leaf1->id * nseq + del_leaf->id] + dist_matrix[leaf0->id * nseq + leaf2->id];
-    double dist2 = dist_matrix[leaf2->id * nseq + del_leaf->id] + dist_matrix[leaf0->id * nseq + leaf1->id];
+    double dist0 = getDist(leaf0->id, del_leaf->id) + getDist(leaf1->id, leaf2->id);
+    double dist1 = getDist(leaf1->id, del_leaf->id) + getDist(leaf0->id, leaf2->id);
+    double dist2 = getDist(leaf2->id, del_leaf->id) + getDist(leaf0->id, leaf1->id);
     if (dist0 < dist1 && dist0 < dist2)
         return 0;
     if (dist1 < dist2)
@@ -2369,6 +2414,8 @@ double IQTree::doTreeSearch() {
 
     }
 
+    flushUFBootBatch();
+
     // 2019-06-03: check convergence here to avoid effect of refineBootTrees
     if (boot_splits.size() >= 2 && MPIHelper::getInstance().isMaster()) {
         // check the stopping criterion for ultra-fast bootstrap
@@ -2612,6 +2659,8 @@ void IQTree::refineBootTrees(){
  ***********************************************************/
 void IQTree::refineBootTrees() {
 
+    flushUFBootBatch();
+
 	int *saved_randstream = randstream;
 	init_random(params->ran_seed);
 
@@ -3495,7 +3544,7 @@ void IQTree::estimateNNICutoff(Params* params) {
     delete[] delta;
 }
 
-void IQTree::saveCurrentTree(double cur_logl) {
+void IQTree::saveCurrentTree(double cur_logl, double *ptn_lh) {
 
     if (logl_cutoff != 0.0 && cur_logl < logl_cutoff - 1.0)
         return;
@@ -3511,15 +3560,21 @@ void IQTree::saveCurrentTree(double cur_logl) {
     int maxnptn = get_safe_upper_limit_float(nptn);
     BootValType *pattern_lh = aligned_alloc<BootValType>(maxnptn);
     memset(pattern_lh, 0, maxnptn*sizeof(BootValType));
-    double *pattern_lh_orig = aligned_alloc<double>(nptn);
-    computePatternLikelihood(pattern_lh_orig, &cur_logl);
+    double *pattern_lh_orig = ptn_lh;
+    if (!ptn_lh) {
+        pattern_lh_orig = aligned_alloc<double>(nptn);
+        computePatternLikelihood(pattern_lh_orig, &cur_logl);
+    }
     for (int i = 0; i < nptn; i++)
     	pattern_lh[i] = (float)pattern_lh_orig[i];
 #else
     int maxnptn = get_safe_upper_limit(nptn);
     BootValType *pattern_lh = aligned_alloc<BootValType>(maxnptn);
     memset(pattern_lh, 0, maxnptn*sizeof(BootValType));
-    computePatternLikelihood(pattern_lh, &cur_logl);
+    if (ptn_lh)
+        memcpy(pattern_lh, ptn_lh, nptn*sizeof(double));
+    else
+        computePatternLikelihood(pattern_lh, &cur_logl);
 #endif
 
 
@@ -3533,53 +3588,64 @@ void IQTree::saveCurrentTree(double cur_logl) {
         ostringstream ostr;
         string tree_str;
         setRootNode(params->root);
+        int tree_format = WT_TAXON_ID + WT_SORT_TAXA;
         if (params->print_ufboot_trees == 2)
-            printTree(ostr, WT_TAXON_ID + WT_SORT_TAXA + WT_BR_LEN + WT_BR_LEN_SHORT);
-        else
-            printTree(ostr, WT_TAXON_ID + WT_SORT_TAXA);
-        tree_str = ostr.str();
-
-    #ifdef _OPENMP
-        int rand_seed = random_int(1000);
-        #pragma omp parallel
-        {
-        int *rstream;
-        init_random(rand_seed + omp_get_thread_num(), false, &rstream);
-        #pragma omp for
-    #else
-        int *rstream = randstream;
-    #endif
-        for (int sample = sample_start; sample < sample_end; sample++) {
-            double rell = 0.0;
-
-            {
-            	// SSE optimized version of the above loop
-				BootValType *boot_sample = boot_samples[sample];
-
-				BootValType res = (this->*dotProduct)(pattern_lh, boot_sample, nptn);
-
-				rell = res;
+            tree_format += WT_BR_LEN + WT_BR_LEN_SHORT;
+
+        if (boot_samples_ptn) {
+            // collect the tree, RELL is computed once the batch is full
+            printTree(ostr, tree_format);
+            tree_str = ostr.str();
+            memcpy(ufboot_batch_lh + ufboot_batch_logl.size()*maxnptn, pattern_lh, maxnptn*sizeof(BootValType));
+            ufboot_batch_logl.push_back(cur_logl);
+            ufboot_batch_trees.push_back(tree_str);
+            if (ufboot_batch_logl.size() >= params->ufboot_batch)
+                flushUFBootBatch();
+        } else {
+            // RELL of all replicates first: the sorted tree string is only printed
+            // if the tree can replace the UFBoot tree of some replicate
+            DoubleVector rell(sample_end - sample_start);
+            bool improved = false;
+        #ifdef _OPENMP
+            int rand_seed = random_int(1000);
+            #pragma omp parallel for reduction(||: improved)
+        #endif
+            for (int sample = sample_start; sample < sample_end; sample++) {
+                double sample_rell;
+                if (boot_samples_compact.empty()) {
+                    // SSE optimized version of the above loop
+                    BootValType *boot_sample = boot_samples[sample];
+                    sample_rell = (this->*dotProduct)(pattern_lh, boot_sample, nptn);
+                } else {
+                    sample_rell = (this->*dotProductCount)(pattern_lh, boot_samples_compact[sample], maxnptn);
+                    for (auto it = boot_samples_overflow[sample].begin(); it != boot_samples_overflow[sample].end(); it++)
+                        sample_rell += pattern_lh[it->first] * it->second;
+                }
+                rell[sample - sample_start] = sample_rell;
+                if (sample_rell > boot_logl[sample] - params->ufboot_epsilon)
+                    improved = true;
             }
 
-            bool better = rell > boot_logl[sample] + params->ufboot_epsilon;
-            if (!better && rell > boot_logl[sample] - params->ufboot_epsilon) {
-                better = (random_double(rstream) <= 1.0 / (boot_counts[sample] + 1));
-            }
-            if (better) {
-                if (rell <= boot_logl[sample] + params->ufboot_epsilon) {
-                    boot_counts[sample]++;
-                } else {
-                    boot_counts[sample] = 1;
+            if (improved) {
+                printTree(ostr, tree_format);
+                tree_str = ostr.str();
+        #ifdef _OPENMP
+                #pragma omp parallel
+                {
+                int *rstream;
+                init_random(rand_seed + omp_get_thread_num(), false, &rstream);
+                #pragma omp for
+        #else
+                int *rstream = randstream;
+        #endif
+                for (int sample = sample_start; sample < sample_end; sample++)
+                    updateBootTree(sample, rell[sample - sample_start], cur_logl, tree_str, rstream);
+        #ifdef _OPENMP
+                finish_random(rstream);
                 }
-                boot_logl[sample] = max(boot_logl[sample], rell);
-                boot_orig_logl[sample] = cur_logl;
-                boot_trees[sample] = tree_str;
+        #endif
             }
         }
-    #ifdef _OPENMP
-        finish_random(rstream);
-        }
-    #endif
     }
     if (Params::getInstance().print_tree_lh) {
         out_treelh << cur_logl;
@@ -3601,7 +3667,8 @@ void IQTree::saveCurrentTree(double cur_logl) {
 
     if (!boot_samples.empty()) {
 #ifdef BOOT_VAL_FLOAT
-    	aligned_free(pattern_lh_orig);
+        if (!ptn_lh)
+            aligned_free(pattern_lh_orig);
 #endif
     	aligned_free(pattern_lh);
     } else {
@@ -3612,19 +3679,76 @@ void IQTree::saveCurrentTree(double cur_logl) {
 
 }
 
-void IQTree::saveNNITrees(PhyloNode *node, PhyloNode *dad) {
+void IQTree::updateBootTree(int sample, double rell, double cur_logl, string &tree_str, int *rstream) {
+    bool better = rell > boot_logl[sample] + params->ufboot_epsilon;
+    if (!better && rell > boot_logl[sample] - params->ufboot_epsilon) {
+        better = (random_double(rstream) <= 1.0 / (boot_counts[sample] + 1));
+    }
+    if (better) {
+        if (rell <= boot_logl[sample] + params->ufboot_epsilon) {
+            boot_counts[sample]++;
+        } else {
+            boot_counts[sample] = 1;
+        }
+        boot_logl[sample] = max(boot_logl[sample], rell);
+        boot_orig_logl[sample] = cur_logl;
+        boot_trees[sample] = tree_str;
+    }
+}
+
+void IQTree::flushUFBootBatch() {
+    int ntrees = ufboot_batch_logl.size();
+    if (ntrees == 0)
+        return;
+    int nptn = getAlnNPattern();
+#ifdef BOOT_VAL_FLOAT
+    size_t maxnptn = get_safe_upper_limit_float(nptn);
+#else
+    size_t maxnptn = get_safe_upper_limit(nptn);
+#endif
+    // RELL of all trees (rows) on all replicates (columns) in one blocked kernel
+    BootValType *rell_mat = aligned_alloc<BootValType>(ntrees * boot_samples_stride);
+    (this->*matrixProduct)(ufboot_batch_lh, ntrees, maxnptn, boot_samples_ptn, boot_samples_stride, nptn, rell_mat);
+
+#ifdef _OPENMP
+    int rand_seed = random_int(1000);
+    #pragma omp parallel
+    {
+    int *rstream;
+    init_random(rand_seed + omp_get_thread_num(), false, &rstream);
+    #pragma omp for
+#else
+    int *rstream = randstream;
+#endif
+    for (int sample = sample_start; sample < sample_end; sample++) {
+        // trees are applied in the order they were saved
+        for (int tree = 0; tree < ntrees; tree++)
+            updateBootTree(sample, rell_mat[tree*boot_samples_stride + sample - sample_start],
+                ufboot_batch_logl[tree], ufboot_batch_trees[tree], rstream);
+    }
+#ifdef _OPENMP
+    finish_random(rstream);
+    }
+#endif
+    aligned_free(rell_mat);
+    ufboot_batch_logl.clear();
+    ufboot_batch_trees.clear();
+}
+
+void IQTree::saveNNITrees(PhyloNode *node, PhyloNode *dad, double *pat_lh1, double *pat_lh2) {
     if (!node) {
-        node = (PhyloNode*) root;
+        // the pattern likelihoods of both NNI trees are passed on to saveCurrentTree,
+        // so the same two buffers serve all branches
+        double *buffer = aligned_alloc<double>(2*get_safe_upper_limit(aln->getNPattern()));
+        saveNNITrees((PhyloNode*) root, NULL, buffer, buffer + get_safe_upper_limit(aln->getNPattern()));
+        aligned_free(buffer);
+        return;
     }
     if (dad && !node->isLeaf() && !dad->isLeaf()) {
-        double *pat_lh1 = new double[aln->getNPattern()];
-        double *pat_lh2 = new double[aln->getNPattern()];
         double lh1, lh2;
         computeNNIPatternLh(curScore, lh1, pat_lh1, lh2, pat_lh2, node, dad);
-        delete[] pat_lh2;
-        delete[] pat_lh1;
     }
-    FOR_NEIGHBOR_IT(node, dad, it)saveNNITrees((PhyloNode*) (*it)->node, node);
+    FOR_NEIGHBOR_IT(node, dad, it)saveNNITrees((PhyloNode*) (*it)->node, node, pat_lh1, pat_lh2);
 }
 
 void IQTree::summarizeBootstrap(Params &params, MTreeSet &trees) {
@@ -3734,6 +3858,7 @@ void IQTree::writeUFBootTrees(Params &params) {
 	filename += ".ufboot";
 	ofstream out(filename.c_str());
 
+    flushUFBootBatch();
     trees.init(boot_trees, rooted);
     for (i = 0; i < trees.size(); i++) {
         NodeVector taxa;
@@ -3758,12 +3883,14 @@ void IQTree::writeUFBootTrees(Params &params) {
 
 void IQTree::summarizeBootstrap(Params &params) {
 	setRootNode(params.root);
+    flushUFBootBatch();
     MTreeSet trees;
     trees.init(boot_trees, rooted);
     summarizeBootstrap(params, trees);
 }
 
 void IQTree::summarizeBootstrap(SplitGraph &sg) {
+    flushUFBootBatch();
     MTreeSet trees;
     //SplitGraph sg;
     trees.init(boot_trees, rooted);
@@ -762,9 +762,33 @@ public:
     /** log-likelihood threshold (l_min) */
     double logl_cutoff;
 
-    /** vector of bootstrap alignments generated */
+    /** vector of bootstrap alignments generated (entries are NULL with -bbatch or -bcompact) */
     vector<BootValType* > boot_samples;
 
+    /** replicate counts for -bcompact, counts >= the BootCountType maximum are capped */
+    vector<BootCountType* > boot_samples_compact;
+
+    /** for -bcompact: per replicate list of (pattern, count - capped count) for capped counts */
+    vector<vector<pair<int,int> > > boot_samples_overflow;
+
+    /**
+        pattern-major replicate weights for -bbatch: row ptn holds the weights of
+        samples sample_start...sample_end-1, padded to boot_samples_stride columns
+     */
+    BootValType *boot_samples_ptn;
+
+    /** number of columns of boot_samples_ptn */
+    size_t boot_samples_stride;
+
+    /** pattern log-likelihoods of trees waiting for the batched RELL update */
+    BootValType *ufboot_batch_lh;
+
+    /** log-likelihoods of trees waiting for the batched RELL update */
+    DoubleVector ufboot_batch_logl;
+
+    /** newick strings of trees waiting for the batched RELL update */
+    StrVector ufboot_batch_trees;
+
     /** starting sample for UFBoot, used for MPI */
     int sample_start;
 
@@ -840,10 +864,37 @@ protected:
 
     void estimateNNICutoff(Params* params);
 
-    virtual void saveCurrentTree(double logl); // save current tree
+    /**
+        save the current tree for ultrafast bootstrap
+        @param logl log-likelihood of the current tree
+        @param ptn_lh pattern log-likelihoods of the current tree if already computed
+            (e.g. by getBestNNIForBran), NULL to compute them from the current buffers
+     */
+    virtual void saveCurrentTree(double logl, double *ptn_lh = NULL); // save current tree
 
+    /**
+        update the UFBoot tree of a replicate with a newly evaluated tree
+        @param sample replicate ID
+        @param rell RELL log-likelihood of the tree on this replicate
+        @param cur_logl log-likelihood of the tree on the original alignment
+        @param tree_str newick string of the tree
+        @param rstream random stream to break ties
+     */
+    void updateBootTree(int sample, double rell, double cur_logl, string &tree_str, int *rstream);
 
-    void saveNNITrees(PhyloNode *node = NULL, PhyloNode *dad = NULL);
+    /**
+        compute RELL of all trees collected by saveCurrentTree with -bbatch
+        and update UFBoot trees in the order the trees were saved
+     */
+    void flushUFBootBatch();
+
+
+    /**
+        save the two NNI trees around every internal branch for ultrafast bootstrap
+        @param pat_lh1, pat_lh2 buffers for the pattern log-likelihoods of the NNI trees,
+            allocated in the top-level call
+     */
+    void saveNNITrees(PhyloNode *node = NULL, PhyloNode *dad = NULL, double *pat_lh1 = NULL, double *pat_lh2 = NULL);
 
     int duplication_counter;
 
@@ -25,6 +25,12 @@
 const int MEM_LOCKED = 1;
 const int MEM_SPECIAL = 2;
 
+MemSlotVector::MemSlotVector() {
+    free_count = 0;
+    inflation = 0.0;
+    num_hits = num_misses = num_recomputes = num_evictions = 0;
+}
+
 void MemSlotVector::init(PhyloTree *tree, int num_slot) {
     if (Params::getInstance().lh_mem_save != LM_MEM_SAVE)
         return;
@@ -45,9 +51,45 @@ void MemSlotVector::reset() {
     for (iterator it = begin(); it != end(); it++) {
         it->status = 0;
         it->nei = NULL;
+        it->priority = 0.0;
     }
     nei_id_map.clear();
+    evicted_neis.clear();
     free_count = 0;
+    inflation = 0.0;
+}
+
+double MemSlotVector::getCost(PhyloNeighbor *nei) {
+    // all partial_lh have the same number of patterns, only the subtree size matters
+    return max(nei->size, 2);
+}
+
+void MemSlotVector::touch(iterator it) {
+    it->priority = inflation + getCost(it->nei);
+}
+
+void MemSlotVector::hit(PhyloNeighbor *nei) {
+    if (Params::getInstance().lh_mem_save != LM_MEM_SAVE)
+        return;
+    if (nei->node->isLeaf())
+        return;
+    iterator it = findNei(nei);
+    if (it->status & MEM_SPECIAL)
+        return;
+    num_hits++;
+    touch(it);
+}
+
+void MemSlotVector::printStats(ostream &out) {
+    if (Params::getInstance().lh_mem_save != LM_MEM_SAVE)
+        return;
+    uint64_t total = num_hits + num_misses;
+    out << "Partial likelihood cache: " << size() << " slots, " << num_hits << " hits, "
+        << num_misses << " misses (" << num_recomputes << " recomputed after eviction), "
+        << num_evictions << " evictions";
+    if (total > 0)
+        out << ", hit rate " << (num_hits*100.0/total) << "%";
+    out << endl;
 }
 
 
@@ -72,6 +114,7 @@ void MemSlotVector::addSpecialNei(PhyloNeighbor *nei) {
         return;
     MemSlot ms;
     ms.status = MEM_SPECIAL + MEM_LOCKED;
+    ms.priority = 0.0;
     ms.nei = nei;
     ms.partial_lh = nei->partial_lh;
     ms.scale_num = nei->scale_num;
@@ -134,37 +177,44 @@ int MemSlotVector::allocate(PhyloNeighbor *nei) {
     if (Params::getInstance().lh_mem_save != LM_MEM_SAVE)
         return -1;
 
+    num_misses++;
+    if (evicted_neis.erase(nei))
+        num_recomputes++;
+
     // first find a free slot
     if (free_count < size() && (at(free_count).status & MEM_SPECIAL) == 0) {
         iterator it = begin() + free_count;
         ASSERT(it->nei == NULL);
         addNei(nei, it);
+        touch(it);
         free_count++;
         return it-begin();
     }
 
-    int min_size = INT_MAX;
+    double min_priority = DBL_MAX;
     iterator best = end();
 
-
-    // no free slot found, find an unlocked slot with minimal size
+    // no free slot found, find an unlocked slot with lowest priority
     for (iterator it = begin(); it != end(); it++)
-        if ((it->status & MEM_LOCKED) == 0 && (it->status & MEM_SPECIAL) == 0 && min_size > it->nei->size) {
+        if ((it->status & MEM_LOCKED) == 0 && (it->status & MEM_SPECIAL) == 0 && min_priority > it->priority) {
             best = it;
-            min_size = it->nei->size;
-            // 2 is the minimum size
-            if (min_size == 2)
-                break;
+            min_priority = it->priority;
         }
 
     if (best == end())
         return -1;
 
+    inflation = min_priority;
+    num_evictions++;
+    if (best->nei->partial_lh_computed & 1)
+        evicted_neis.insert(best->nei);
+
     // clear mem assigned to it->nei
     best->nei->clearPartialLh();
 
     // assign mem to nei
     addNei(nei, best);
+    touch(best);
     return best-begin();
 
 }
@@ -176,6 +226,7 @@ void MemSlotVector::update(PhyloNeighbor *nei) {
     iterator it = findNei(nei);
 //    if (it->status & MEM_SPECIAL)
 //        return;
+    num_misses++;
     if (it->nei != nei) {
         // clear mem assigned to it->nei
         it->nei->clearPartialLh();
@@ -183,6 +234,7 @@ void MemSlotVector::update(PhyloNeighbor *nei) {
         // assign mem to nei
         addNei(nei, it);
     }
+    touch(it);
 }
 
 /*
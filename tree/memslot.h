@@ -34,6 +34,7 @@ struct MemSlot {
     PhyloNeighbor *nei; // neighbor assigned to this slot
     double *partial_lh; // partial_lh assigned to this slot
     UBYTE *scale_num; // scale_num assigned to this slot
+    double priority; // eviction priority, the slot with lowest priority is evicted first
 
     PhyloNeighbor *saved_nei;
 };
@@ -44,6 +45,8 @@ struct MemSlot {
 class MemSlotVector : public vector<MemSlot> {
 public:
 
+    MemSlotVector();
+
     /** initialize with a specified number of slots */
     void init(PhyloTree *tree, int num_slot);
 
@@ -60,9 +63,21 @@ public:
     /** test if the memory assigned to nei is locked or not */
     bool locked(PhyloNeighbor *nei);
 
-    /** allocate free or unlocked memory to nei */
+    /**
+        allocate free or unlocked memory to nei.
+        If all slots are used, evict the unlocked slot of lowest priority (GreedyDual-Size):
+        a slot gets priority inflation + recomputation cost whenever it is used,
+        and inflation rises to the priority of each evicted slot. Thus cheap and
+        long unused partial_lh are evicted first.
+    */
     int allocate(PhyloNeighbor *nei);
 
+    /** record that the partial_lh assigned to nei was reused without recomputation */
+    void hit(PhyloNeighbor *nei);
+
+    /** print cache statistics (hits, misses, recomputations, evictions) */
+    void printStats(ostream &out);
+
     /** update neighbor */
     void update(PhyloNeighbor *nei);
 
@@ -105,6 +120,21 @@ protected:
     /** counter of free slot ID */
     int free_count;
 
+    /** priority of the last evicted slot */
+    double inflation;
+
+    /** neighbors whose partial_lh was evicted and not yet recomputed */
+    unordered_set<PhyloNeighbor*> evicted_neis;
+
+    /** cache statistics */
+    uint64_t num_hits, num_misses, num_recomputes, num_evictions;
+
+    /** @return cost to recompute partial_lh of nei, proportional to its subtree size */
+    double getCost(PhyloNeighbor *nei);
+
+    /** refresh the priority of a slot after it is used */
+    void touch(iterator it);
+
 };
 
 
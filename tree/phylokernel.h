@@ -67,6 +67,163 @@ Numeric PhyloTree::dotProductSIMD(Numeric *x, Numeric *y, int size) {
 	return horizontal_add(res);
 }
 
+/** load 16 replicate counts, or the last n < 16 counts, zero-extended to four Vec4i */
+inline void loadCounts(uint8_t const *y, int n, Vec4i *q) {
+    Vec16uc c;
+    c.load_partial(n, y);
+    Vec8us lo = extend_low(c), hi = extend_high(c);
+    q[0] = extend_low(lo);
+    q[1] = extend_high(lo);
+    q[2] = extend_low(hi);
+    q[3] = extend_high(hi);
+}
+
+inline void loadCounts(uint16_t const *y, int n, Vec4i *q) {
+    Vec8us lo, hi;
+    lo.load_partial(n, y);
+    hi.load_partial(n-8, y+8);
+    q[0] = extend_low(lo);
+    q[1] = extend_high(lo);
+    q[2] = extend_low(hi);
+    q[3] = extend_high(hi);
+}
+
+/** convert 16 counts from loadCounts into 16/VectorClass::size() vectors */
+inline void convertCounts(Vec4i const *q, Vec2d *w) {
+    for (int k = 0; k < 4; k++) {
+        w[2*k] = to_double_low(q[k]);
+        w[2*k+1] = to_double_high(q[k]);
+    }
+}
+
+inline void convertCounts(Vec4i const *q, Vec4f *w) {
+    for (int k = 0; k < 4; k++)
+        w[k] = to_float(q[k]);
+}
+
+inline void convertCounts(Vec4i const *q, Vec4d *w) {
+    for (int k = 0; k < 4; k++)
+        w[k] = to_double(q[k]);
+}
+
+inline void convertCounts(Vec4i const *q, Vec8f *w) {
+    w[0] = to_float(Vec8i(q[0], q[1]));
+    w[1] = to_float(Vec8i(q[2], q[3]));
+}
+
+#if MAX_VECTOR_SIZE >= 512
+inline void convertCounts(Vec4i const *q, Vec8d *w) {
+    w[0] = to_double(Vec8i(q[0], q[1]));
+    w[1] = to_double(Vec8i(q[2], q[3]));
+}
+
+inline void convertCounts(Vec4i const *q, Vec16f *w) {
+    w[0] = to_float(Vec16i(Vec8i(q[0], q[1]), Vec8i(q[2], q[3])));
+}
+#endif
+
+template <class Numeric, class VectorClass>
+Numeric PhyloTree::dotProductCountSIMD(Numeric *x, BootCountType *y, int size) {
+    const int VCSIZE = VectorClass::size();
+    const int NVEC = 16/VCSIZE;
+    Vec4i q[4];
+    VectorClass w[NVEC];
+    VectorClass res = 0.0;
+    // 16 counts at a time, widened in vector registers; size is a multiple of VCSIZE
+    for (int i = 0; i < size; i += 16) {
+        loadCounts(y+i, size-i, q);
+        convertCounts(q, w);
+        for (int j = 0; j < NVEC && i+j*VCSIZE < size; j++)
+            res = mul_add(VectorClass().load_a(&x[i+j*VCSIZE]), w[j], res);
+    }
+    return horizontal_add(res);
+}
+
+template <class Numeric, class VectorClass>
+void PhyloTree::matrixProductSIMD(Numeric *x, int nrows, size_t x_stride, Numeric *y, size_t ncols, size_t size, Numeric *res) {
+    const size_t VCSIZE = VectorClass::size();
+    // patterns per tile: keeps the tile of x rows in L1/L2 while y is streamed once
+    const size_t PTN_BLOCK = 256;
+    // replicate columns per thread task, multiple of 2*VCSIZE
+    const int64_t COL_BLOCK = 64;
+    memset(res, 0, sizeof(Numeric)*nrows*ncols);
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) if (ncols > COL_BLOCK)
+#endif
+    for (int64_t col_start = 0; col_start < (int64_t)ncols; col_start += COL_BLOCK) {
+        size_t col_end = min((size_t)col_start + COL_BLOCK, ncols);
+        for (size_t ptn_start = 0; ptn_start < size; ptn_start += PTN_BLOCK) {
+            size_t ptn_end = min(ptn_start + PTN_BLOCK, size);
+            size_t col;
+            // 4 x 2 register block: 4 rows of x against 2 vectors of columns
+            for (col = col_start; col + 2*VCSIZE <= col_end; col += 2*VCSIZE) {
+                int row;
+                for (row = 0; row+4 <= nrows; row += 4) {
+                    Numeric *res0 = res + row*ncols + col;
+                    Numeric *res1 = res0 + ncols, *res2 = res1 + ncols, *res3 = res2 + ncols;
+                    Numeric *x0 = x + row*x_stride;
+                    Numeric *x1 = x0 + x_stride, *x2 = x1 + x_stride, *x3 = x2 + x_stride;
+                    VectorClass c00, c01, c10, c11, c20, c21, c30, c31;
+                    c00.load_a(res0); c01.load_a(res0+VCSIZE);
+                    c10.load_a(res1); c11.load_a(res1+VCSIZE);
+                    c20.load_a(res2); c21.load_a(res2+VCSIZE);
+                    c30.load_a(res3); c31.load_a(res3+VCSIZE);
+                    Numeric *y_ptr = y + ptn_start*ncols + col;
+                    for (size_t ptn = ptn_start; ptn < ptn_end; ptn++, y_ptr += ncols) {
+                        VectorClass y0, y1, xv;
+                        y0.load_a(y_ptr);
+                        y1.load_a(y_ptr+VCSIZE);
+                        xv = x0[ptn];
+                        c00 = mul_add(xv, y0, c00);
+                        c01 = mul_add(xv, y1, c01);
+                        xv = x1[ptn];
+                        c10 = mul_add(xv, y0, c10);
+                        c11 = mul_add(xv, y1, c11);
+                        xv = x2[ptn];
+                        c20 = mul_add(xv, y0, c20);
+                        c21 = mul_add(xv, y1, c21);
+                        xv = x3[ptn];
+                        c30 = mul_add(xv, y0, c30);
+                        c31 = mul_add(xv, y1, c31);
+                    }
+                    c00.store_a(res0); c01.store_a(res0+VCSIZE);
+                    c10.store_a(res1); c11.store_a(res1+VCSIZE);
+                    c20.store_a(res2); c21.store_a(res2+VCSIZE);
+                    c30.store_a(res3); c31.store_a(res3+VCSIZE);
+                }
+                // remaining rows
+                for (; row < nrows; row++) {
+                    Numeric *res0 = res + row*ncols + col;
+                    Numeric *x0 = x + row*x_stride;
+                    VectorClass c00, c01;
+                    c00.load_a(res0); c01.load_a(res0+VCSIZE);
+                    Numeric *y_ptr = y + ptn_start*ncols + col;
+                    for (size_t ptn = ptn_start; ptn < ptn_end; ptn++, y_ptr += ncols) {
+                        VectorClass xv = x0[ptn];
+                        c00 = mul_add(xv, VectorClass().load_a(y_ptr), c00);
+                        c01 = mul_add(xv, VectorClass().load_a(y_ptr+VCSIZE), c01);
+                    }
+                    c00.store_a(res0); c01.store_a(res0+VCSIZE);
+                }
+            }
+            // remaining single vector of columns
+            for (; col < col_end; col += VCSIZE) {
+                for (int row = 0; row < nrows; row++) {
+                    Numeric *res0 = res + row*ncols + col;
+                    Numeric *x0 = x + row*x_stride;
+                    VectorClass c00;
+                    c00.load_a(res0);
+                    Numeric *y_ptr = y + ptn_start*ncols + col;
+                    for (size_t ptn = ptn_start; ptn < ptn_end; ptn++, y_ptr += ncols)
+                        c00 = mul_add(VectorClass(x0[ptn]), VectorClass().load_a(y_ptr), c00);
+                    c00.store_a(res0);
+                }
+            }
+        }
+    }
+}
+
 /************************************************************************************************
  *
  *   Highly optimized vectorized versions of likelihood functions
@@ -1437,6 +1594,43 @@ inline UINT fast_popcount(Vec8ui &x) {
 }
 
 
+#if defined(__AVX512F__) || defined(__AVX512__)
+
+inline UINT fast_popcount(Vec16ui &x) {
+    MEM_ALIGN_BEGIN uint64_t vec[8] MEM_ALIGN_END;
+    x.store(vec);
+#if defined (__GNUC__) || defined(__clang__)
+    return __builtin_popcountll(vec[0]) + __builtin_popcountll(vec[1]) + __builtin_popcountll(vec[2]) + __builtin_popcountll(vec[3]) +
+        __builtin_popcountll(vec[4]) + __builtin_popcountll(vec[5]) + __builtin_popcountll(vec[6]) + __builtin_popcountll(vec[7]);
+#else
+    return _mm_popcnt_u64(vec[0]) + _mm_popcnt_u64(vec[1]) + _mm_popcnt_u64(vec[2]) + _mm_popcnt_u64(vec[3]) +
+        _mm_popcnt_u64(vec[4]) + _mm_popcnt_u64(vec[5]) + _mm_popcnt_u64(vec[6]) + _mm_popcnt_u64(vec[7]);
+#endif
+}
+
+#if defined (__GNUC__) || defined(__clang__)
+
+/**
+    Vec16ui whose popcount uses the AVX512-VPOPCNTDQ instruction,
+    for parsimony kernels selected only if the CPU supports it
+*/
+class Vec16uiPopcnt : public Vec16ui {
+public:
+    Vec16uiPopcnt() {}
+    Vec16uiPopcnt(uint32_t i) : Vec16ui(i) {}
+    Vec16uiPopcnt(Vec16ui const &x) : Vec16ui(x) {}
+    Vec16uiPopcnt(__m512i const &x) : Vec16ui(x) {}
+};
+
+__attribute__((target("avx512vpopcntdq")))
+inline UINT fast_popcount(Vec16uiPopcnt &x) {
+    return _mm512_reduce_add_epi64(_mm512_popcnt_epi64(x));
+}
+
+#endif
+
+#endif
+
 inline void horizontal_popcount(Vec4ui &x) {
     MEM_ALIGN_BEGIN UINT vec[4] MEM_ALIGN_END;
     x.store_a(vec);
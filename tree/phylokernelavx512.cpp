@@ -27,11 +27,27 @@
 #error "You must compile this file with AVX512 enabled!"
 #endif
 
+void PhyloTree::setParsimonyKernelAVX512() {
+#if defined (__GNUC__) || defined(__clang__)
+    if (__builtin_cpu_supports("avx512vpopcntdq")) {
+        computeParsimonyBranchPointer = &PhyloTree::computeParsimonyBranchFastSIMD<Vec16uiPopcnt>;
+        computePartialParsimonyPointer = &PhyloTree::computePartialParsimonyFastSIMD<Vec16uiPopcnt>;
+        return;
+    }
+#endif
+    computeParsimonyBranchPointer = &PhyloTree::computeParsimonyBranchFastSIMD<Vec16ui>;
+    computePartialParsimonyPointer = &PhyloTree::computePartialParsimonyFastSIMD<Vec16ui>;
+}
+
 void PhyloTree::setDotProductAVX512() {
 #ifdef BOOT_VAL_FLOAT
 		dotProduct = &PhyloTree::dotProductSIMD<float, Vec16f>;
+		matrixProduct = &PhyloTree::matrixProductSIMD<float, Vec16f>;
+		dotProductCount = &PhyloTree::dotProductCountSIMD<float, Vec16f>;
 #else
 		dotProduct = &PhyloTree::dotProductSIMD<double, Vec8d>;
+		matrixProduct = &PhyloTree::matrixProductSIMD<double, Vec8d>;
+		dotProductCount = &PhyloTree::dotProductCountSIMD<double, Vec8d>;
 #endif
         dotProductDouble = &PhyloTree::dotProductSIMD<double, Vec8d>;
 }
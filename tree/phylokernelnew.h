@@ -1073,6 +1073,87 @@ void PhyloTree::computePartialInfo(TraversalInfo &info, VectorClass* buffer) {
 
 }
 
+/*******************************************************
+ *
+ * Single-precision storage of partial likelihoods
+ *
+ ******************************************************/
+
+#ifndef KERNEL_FIX_STATES
+/**
+    compress one pattern group of partial likelihoods into single precision.
+    Each pattern keeps a binary exponent (stored as float after the block)
+    so that the float mantissas are normalized to the largest entry
+    @param src partial likelihoods in double, block*VectorClass::size() entries
+    @param[out] dst single-precision storage, (block+1)*VectorClass::size() entries
+    @param block number of entries per pattern
+*/
+template <class VectorClass>
+inline void packPartialLh(double *src, float *dst, size_t block) {
+    const size_t V = VectorClass::size();
+    VectorClass *vsrc = (VectorClass*)src;
+    VectorClass vmax = 0.0;
+    double scale[8], tmp[8]; // at most 8 doubles per vector (AVX-512)
+    size_t i, x;
+    for (i = 0; i < block; i++)
+        vmax = max(vmax, abs(vsrc[i]));
+    vmax.store(scale);
+    for (x = 0; x < V; x++) {
+        // binary exponent of the largest entry, read directly from the IEEE bits
+        uint64_t bits;
+        memcpy(&bits, &scale[x], sizeof(bits));
+        int exponent = min(max((int)((bits >> 52) & 0x7ff) - 1022, -1022), 1022);
+        dst[block*V+x] = exponent;
+        bits = (uint64_t)(1023 - exponent) << 52;
+        memcpy(&scale[x], &bits, sizeof(bits));
+    }
+    VectorClass vscale;
+    vscale.load(scale);
+    for (i = 0; i < block; i++) {
+        (vsrc[i] * vscale).store(tmp);
+        for (x = 0; x < V; x++)
+            dst[i*V+x] = tmp[x];
+    }
+}
+
+/**
+    expand one pattern group of partial likelihoods stored by packPartialLh()
+    @param src single-precision storage, (block+1)*VectorClass::size() entries
+    @param[out] dst partial likelihoods in double, block*VectorClass::size() entries
+    @param block number of entries per pattern
+*/
+template <class VectorClass>
+inline void unpackPartialLh(float *src, double *dst, size_t block) {
+    const size_t V = VectorClass::size();
+    VectorClass *vdst = (VectorClass*)dst;
+    double scale[8], tmp[8]; // at most 8 doubles per vector (AVX-512)
+    size_t i, x;
+    for (x = 0; x < V; x++) {
+        uint64_t bits = (uint64_t)(1023 + (int)src[block*V+x]) << 52;
+        memcpy(&scale[x], &bits, sizeof(bits));
+    }
+    VectorClass vscale;
+    vscale.load(scale);
+    for (i = 0; i < block; i++) {
+        for (x = 0; x < V; x++)
+            tmp[x] = src[i*V+x];
+        vdst[i] = VectorClass().load(tmp) * vscale;
+    }
+}
+
+/**
+    @return pointer to the partial likelihoods of pattern group ptn,
+    expanded into buffer if they are stored in single precision
+*/
+template <class VectorClass>
+inline double *getPartialLhPtn(double *partial_lh, size_t ptn, size_t block, bool is_float, double *buffer) {
+    if (!is_float)
+        return partial_lh + ptn*block;
+    unpackPartialLh<VectorClass>((float*)partial_lh + ptn*(block+1), buffer, block);
+    return buffer;
+}
+#endif
+
 #ifndef KERNEL_FIX_STATES
 template<class VectorClass>
 inline void computeBounds(int threads, size_t elements, vector<size_t> &limits) {
@@ -1102,6 +1183,28 @@ inline void computeBounds(int threads, size_t elements, vector<size_t> &limits)
             outError("Too many threads may slow down analysis [-nt option]. Reduce threads or use -nt AUTO to automatically determine it");
     }
 }
+
+/** minimum #patterns per thread to compute partial likelihoods by pattern blocks only */
+const size_t TRAVERSAL_MIN_PTN_PER_THREAD = 512;
+
+/**
+    call body(thread_id) for thread_id = 0..num_threads-1, one thread per ID.
+    A single thread calls body directly: starting an OpenMP team, even of one thread,
+    costs about as much as a kernel call on a partition with few patterns
+*/
+template <class Body>
+inline void runThreads(int num_threads, Body body) {
+#ifdef _OPENMP
+    if (num_threads > 1) {
+#pragma omp parallel for schedule(static, 1) num_threads(num_threads)
+        for (int thread_id = 0; thread_id < num_threads; thread_id++)
+            body(thread_id);
+        return;
+    }
+#endif
+    for (int thread_id = 0; thread_id < num_threads; thread_id++)
+        body(thread_id);
+}
 #endif
 
 #ifdef KERNEL_FIX_STATES
@@ -1201,41 +1304,81 @@ void PhyloTree::computeTraversalInfo(PhyloNode *node, PhyloNode *dad, bool compu
         }
 
 #ifdef _OPENMP
-#pragma omp parallel if (num_info >= 3) num_threads(num_threads)
-        {
-            VectorClass *buffer_tmp = (VectorClass*)buffer + aln->num_states*omp_get_thread_num();
+        if (num_info >= 3 && num_threads > 1) {
+#pragma omp parallel num_threads(num_threads)
+            {
+                VectorClass *buffer_tmp = (VectorClass*)buffer + aln->num_states*omp_get_thread_num();
 #pragma omp for schedule(static)
-#else
-            VectorClass *buffer_tmp = (VectorClass*)buffer;
-#endif
-            for (int i = 0; i < num_info; i++) {
-            #ifdef KERNEL_FIX_STATES
-                computePartialInfo<VectorClass, nstates>(traversal_info[i], buffer_tmp);
-            #else
-                computePartialInfo<VectorClass>(traversal_info[i], buffer_tmp);
-            #endif
+                for (int i = 0; i < num_info; i++) {
+                #ifdef KERNEL_FIX_STATES
+                    computePartialInfo<VectorClass, nstates>(traversal_info[i], buffer_tmp);
+                #else
+                    computePartialInfo<VectorClass>(traversal_info[i], buffer_tmp);
+                #endif
+                }
             }
-#ifdef _OPENMP
-        }
+        } else
 #endif
+        for (int i = 0; i < num_info; i++) {
+        #ifdef KERNEL_FIX_STATES
+            computePartialInfo<VectorClass, nstates>(traversal_info[i], (VectorClass*)buffer);
+        #else
+            computePartialInfo<VectorClass>(traversal_info[i], (VectorClass*)buffer);
+        #endif
+        }
     }
 
-    if (compute_partial_lh) {
+    size_t orig_nptn = ((aln->size()+VectorClass::size()-1)/VectorClass::size())*VectorClass::size();
+    size_t nptn = ((orig_nptn+model_factory->unobserved_ptns.size()+VectorClass::size()-1)/VectorClass::size())*VectorClass::size();
+
+    if (!compute_partial_lh)
+        return;
+
+    // few patterns per thread: also run independent subtrees concurrently.
+    // Not with LM_MEM_SAVE, where a memory slot is reused as soon as its parent is computed
+    if (num_threads > 1 && traversal_info.size() > 1 && nptn < num_threads*TRAVERSAL_MIN_PTN_PER_THREAD &&
+        params->lh_mem_save != LM_MEM_SAVE)
+    {
+        int num_levels = computeTraversalLevels();
         vector<size_t> limits;
-        size_t orig_nptn = ((aln->size()+VectorClass::size()-1)/VectorClass::size())*VectorClass::size();
-        size_t nptn = ((orig_nptn+model_factory->unobserved_ptns.size()+VectorClass::size()-1)/VectorClass::size())*VectorClass::size();
         computeBounds<VectorClass>(num_threads, nptn, limits);
-
-        #ifdef _OPENMP
-        #pragma omp parallel for schedule(static, 1) num_threads(num_threads)
-        #endif
-        for (int thread_id = 0; thread_id < num_threads; thread_id++) {
-            for (vector<TraversalInfo>::iterator it = traversal_info.begin(); it != traversal_info.end(); it++)
-                computePartialLikelihood(*it, limits[thread_id], limits[thread_id+1], thread_id);
+        for (auto level = traversal_levels.begin(); level != traversal_levels.begin() + num_levels; level++) {
+            if (level->size() >= num_threads/2) {
+                // node-level: each thread takes whole entries
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1) num_threads(num_threads)
+#endif
+                for (int i = 0; i < level->size(); i++) {
+#ifdef _OPENMP
+                    int thread_id = omp_get_thread_num();
+#else
+                    int thread_id = 0;
+#endif
+                    computePartialLikelihood(traversal_info[level->at(i)], 0, nptn, thread_id);
+                }
+            } else {
+                // pattern-level for narrow levels close to the root
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static, 1) num_threads(num_threads)
+#endif
+                for (int thread_id = 0; thread_id < num_threads; thread_id++) {
+                    for (auto it = level->begin(); it != level->end(); it++)
+                        computePartialLikelihood(traversal_info[*it], limits[thread_id], limits[thread_id+1], thread_id);
+                }
+            }
         }
         traversal_info.clear();
+        return;
     }
-    return;
+
+    vector<size_t> limits;
+    computeBounds<VectorClass>(num_threads, nptn, limits);
+
+    runThreads(num_threads, [&](int thread_id) {
+        for (vector<TraversalInfo>::iterator it = traversal_info.begin(); it != traversal_info.end(); it++)
+            computePartialLikelihood(*it, limits[thread_id], limits[thread_id+1], thread_id);
+    });
+    traversal_info.clear();
 }
 
 /*******************************************************
@@ -1314,6 +1457,14 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
     // precomputed buffer to save times
     size_t thread_buf_size = (2*block+nstates)*VectorClass::size();
     double *buffer_partial_lh_ptr = buffer_partial_lh + (getBufferPartialLhSize() - thread_buf_size*num_threads);
+
+    // buffers to expand partial likelihoods stored in single precision
+    double *float_lh_out = NULL, *float_lh_left = NULL, *float_lh_right = NULL;
+    if (partial_lh_float) {
+        float_lh_out = buffer_float_lh + 3*block*VectorClass::size()*thread_id;
+        float_lh_left = float_lh_out + block*VectorClass::size();
+        float_lh_right = float_lh_left + block*VectorClass::size();
+    }
     double *echildren = NULL;
     double *partial_lh_leaves = NULL;
 
@@ -1407,7 +1558,7 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
                     } else {
                         // internal node
                         VectorClass *partial_lh = partial_lh_all;
-                        VectorClass *partial_lh_child = (VectorClass*)(child->partial_lh + ptn*block);
+                        VectorClass *partial_lh_child = (VectorClass*)getPartialLhPtn<VectorClass>(child->partial_lh, ptn, block, partial_lh_float, float_lh_left);
                         if (!SAFE_NUMERIC) {
                             for (i = 0; i < VectorClass::size(); i++)
                                 dad_branch->scale_num[ptn+i] += child->scale_num[ptn+i];
@@ -1467,7 +1618,7 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
                     } else {
                         // internal node
                         VectorClass *partial_lh = partial_lh_all;
-                        VectorClass *partial_lh_child = (VectorClass*)(child->partial_lh + ptn*block);
+                        VectorClass *partial_lh_child = (VectorClass*)getPartialLhPtn<VectorClass>(child->partial_lh, ptn, block, partial_lh_float, float_lh_left);
                         if (!SAFE_NUMERIC) {
                             for (i = 0; i < VectorClass::size(); i++)
                                 dad_branch->scale_num[ptn+i] += child->scale_num[ptn+i];
@@ -1543,7 +1694,7 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
         
             // compute dot-product with inv_eigenvector
             VectorClass *partial_lh_tmp = partial_lh_all;
-            VectorClass *partial_lh = (VectorClass*)(dad_branch->partial_lh + ptn*block);
+            VectorClass *partial_lh = (VectorClass*)(partial_lh_float ? float_lh_out : dad_branch->partial_lh + ptn*block);
             VectorClass lh_max = 0.0;
             double *inv_evec_ptr = SITE_MODEL ? &inv_evec[ptn*states_square] : NULL;
             for (c = 0; c < ncat_mix; c++) {
@@ -1565,6 +1716,8 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
                 partial_lh += nstates;
                 partial_lh_tmp += nstates;
             }
+            if (partial_lh_float)
+                packPartialLh<VectorClass>(float_lh_out, (float*)dad_branch->partial_lh + ptn*(block+1), block);
 
         } // for ptn
 
@@ -1584,7 +1737,7 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
         VectorClass *partial_lh_tmp = SITE_MODEL ? (VectorClass*)vec_right+nstates : (VectorClass*)vec_right+block;
 
 		for (ptn = ptn_lower; ptn < ptn_upper; ptn+=VectorClass::size()) {
-			VectorClass *partial_lh = (VectorClass*)(dad_branch->partial_lh + ptn*block);
+			VectorClass *partial_lh = (VectorClass*)(partial_lh_float ? float_lh_out : dad_branch->partial_lh + ptn*block);
 
             if (SITE_MODEL) {
                 VectorClass* expleft = (VectorClass*) vec_left;
@@ -1667,6 +1820,8 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
                     partial_lh += nstates;
                 } // FOR category
             } // IF SITE_MODEL
+            if (partial_lh_float)
+                packPartialLh<VectorClass>(float_lh_out, (float*)dad_branch->partial_lh + ptn*(block+1), block);
 		} // FOR LOOP
 
 
@@ -1687,8 +1842,9 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
         VectorClass *partial_lh_tmp = SITE_MODEL ? (VectorClass*)vec_left+2*nstates : (VectorClass*)vec_left+block;
 
 		for (ptn = ptn_lower; ptn < ptn_upper; ptn+=VectorClass::size()) {
-			VectorClass *partial_lh = (VectorClass*)(dad_branch->partial_lh + ptn*block);
-			VectorClass *partial_lh_right = (VectorClass*)(right->partial_lh + ptn*block);
+            double *dad_partial_lh = partial_lh_float ? float_lh_out : dad_branch->partial_lh + ptn*block;
+			VectorClass *partial_lh = (VectorClass*)dad_partial_lh;
+			VectorClass *partial_lh_right = (VectorClass*)getPartialLhPtn<VectorClass>(right->partial_lh, ptn, block, partial_lh_float, float_lh_right);
 //            memset(partial_lh, 0, sizeof(VectorClass)*block);
             VectorClass lh_max = 0.0;
 
@@ -1727,7 +1883,7 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
                             if (underflown[x]) {
                                 // BQM 2016-05-03: only scale for non-constant sites
                                 // now do the likelihood scaling
-                                double *partial_lh = dad_branch->partial_lh + (ptn*block + c*nstates*VectorClass::size() + x);
+                                double *partial_lh = dad_partial_lh + (c*nstates*VectorClass::size() + x);
                                 for (i = 0; i < nstates; i++)
                                     partial_lh[i*VectorClass::size()] = ldexp(partial_lh[i*VectorClass::size()], SCALING_THRESHOLD_EXP);
                                 dad_branch->scale_num[(ptn+x)*ncat_mix+c] += 1;
@@ -1790,7 +1946,7 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
                             if (underflown[x]) {
                                 // BQM 2016-05-03: only scale for non-constant sites
                                 // now do the likelihood scaling
-                                double *partial_lh = dad_branch->partial_lh + (ptn*block + c*nstates*VectorClass::size() + x);
+                                double *partial_lh = dad_partial_lh + (c*nstates*VectorClass::size() + x);
                                 for (i = 0; i < nstates; i++)
                                     partial_lh[i*VectorClass::size()] = ldexp(partial_lh[i*VectorClass::size()], SCALING_THRESHOLD_EXP);
                                 dad_branch->scale_num[(ptn+x)*ncat_mix+c] += 1;
@@ -1808,7 +1964,7 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
                 if (horizontal_or(underflown)) { // at least one site has numerical underflown
                     for (x = 0; x < VectorClass::size(); x++)
                     if (underflown[x]) {
-                        double *partial_lh = dad_branch->partial_lh + (ptn*block + x);
+                        double *partial_lh = dad_partial_lh + x;
                         // now do the likelihood scaling
                         for (i = 0; i < block; i++) {
                             partial_lh[i*VectorClass::size()] = ldexp(partial_lh[i*VectorClass::size()], SCALING_THRESHOLD_EXP);
@@ -1819,6 +1975,9 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
                 }
             }
 
+            if (partial_lh_float)
+                packPartialLh<VectorClass>(dad_partial_lh, (float*)dad_branch->partial_lh + ptn*(block+1), block);
+
 		} // big for loop over ptn
 
 	} else {
@@ -1827,9 +1986,10 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
 
         VectorClass *partial_lh_tmp = (VectorClass*)(buffer_partial_lh_ptr + thread_buf_size*thread_id);
 		for (ptn = ptn_lower; ptn < ptn_upper; ptn+=VectorClass::size()) {
-			VectorClass *partial_lh = (VectorClass*)(dad_branch->partial_lh + ptn*block);
-			VectorClass *partial_lh_left = (VectorClass*)(left->partial_lh + ptn*block);
-			VectorClass *partial_lh_right = (VectorClass*)(right->partial_lh + ptn*block);
+            double *dad_partial_lh = partial_lh_float ? float_lh_out : dad_branch->partial_lh + ptn*block;
+			VectorClass *partial_lh = (VectorClass*)dad_partial_lh;
+			VectorClass *partial_lh_left = (VectorClass*)getPartialLhPtn<VectorClass>(left->partial_lh, ptn, block, partial_lh_float, float_lh_left);
+			VectorClass *partial_lh_right = (VectorClass*)getPartialLhPtn<VectorClass>(right->partial_lh, ptn, block, partial_lh_float, float_lh_right);
             VectorClass lh_max = 0.0;
             UBYTE *scale_dad, *scale_left, *scale_right;
 
@@ -1913,7 +2073,7 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
                         if (underflown[x]) {
                             // BQM 2016-05-03: only scale for non-constant sites
                             // now do the likelihood scaling
-                            double *partial_lh = dad_branch->partial_lh + (ptn*block + c*nstates*VectorClass::size() + x);
+                            double *partial_lh = dad_partial_lh + (c*nstates*VectorClass::size() + x);
                             for (i = 0; i < nstates; i++)
                                 partial_lh[i*VectorClass::size()] = ldexp(partial_lh[i*VectorClass::size()], SCALING_THRESHOLD_EXP);
                             scale_dad[x*ncat_mix] += 1;
@@ -1933,7 +2093,7 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
                 if (horizontal_or(underflown)) { // at least one site has numerical underflown
                     for (x = 0; x < VectorClass::size(); x++)
                     if (underflown[x]) {
-                        double *partial_lh = dad_branch->partial_lh + (ptn*block + x);
+                        double *partial_lh = dad_partial_lh + x;
                         // now do the likelihood scaling
                         for (i = 0; i < block; i++) {
                             partial_lh[i*VectorClass::size()] = ldexp(partial_lh[i*VectorClass::size()], SCALING_THRESHOLD_EXP);
@@ -1944,6 +2104,9 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
                 }
             }
 
+            if (partial_lh_float)
+                packPartialLh<VectorClass>(dad_partial_lh, (float*)dad_branch->partial_lh + ptn*(block+1), block);
+
 		} // big for loop over ptn
 
 	}
@@ -1998,6 +2161,9 @@ void PhyloTree::computeLikelihoodBufferGenericSIMD(PhyloNeighbor *dad_branch, Ph
     for (vector<TraversalInfo>::iterator it = traversal_info.begin(); it != traversal_info.end(); it++)
         computePartialLikelihood(*it, ptn_lower, ptn_upper, thread_id);
 
+    double *float_lh_dad = partial_lh_float ? buffer_float_lh + 3*block*VectorClass::size()*thread_id : NULL;
+    double *float_lh_node = partial_lh_float ? float_lh_dad + block*VectorClass::size() : NULL;
+
     if (dad->isLeaf()) {
         // special treatment for TIP-INTERNAL NODE case
         double *tip_partial_lh_node = &tip_partial_lh[dad->id * max_orig_nptn*nstates];
@@ -2005,7 +2171,7 @@ void PhyloTree::computeLikelihoodBufferGenericSIMD(PhyloNeighbor *dad_branch, Ph
         double *vec_tip = buffer_partial_lh_ptr + tip_block*VectorClass::size()*thread_id;
 
         for (ptn = ptn_lower; ptn < ptn_upper; ptn+=VectorClass::size()) {
-            VectorClass *partial_lh_dad = (VectorClass*)(dad_branch->partial_lh + ptn*block);
+            VectorClass *partial_lh_dad = (VectorClass*)getPartialLhPtn<VectorClass>(dad_branch->partial_lh, ptn, block, partial_lh_float, float_lh_dad);
             VectorClass *theta = (VectorClass*)(theta_all + ptn*block);
             //load tip vector
             if (!SITE_MODEL)
@@ -2080,8 +2246,8 @@ void PhyloTree::computeLikelihoodBufferGenericSIMD(PhyloNeighbor *dad_branch, Ph
         // now compute theta
         for (ptn = ptn_lower; ptn < ptn_upper; ptn+=VectorClass::size()) {
             VectorClass *theta = (VectorClass*)(theta_all + ptn*block);
-            VectorClass *partial_lh_node = (VectorClass*)(node_branch->partial_lh + ptn*block);
-            VectorClass *partial_lh_dad = (VectorClass*)(dad_branch->partial_lh + ptn*block);
+            VectorClass *partial_lh_node = (VectorClass*)getPartialLhPtn<VectorClass>(node_branch->partial_lh, ptn, block, partial_lh_float, float_lh_node);
+            VectorClass *partial_lh_dad = (VectorClass*)getPartialLhPtn<VectorClass>(dad_branch->partial_lh, ptn, block, partial_lh_float, float_lh_dad);
             for (i = 0; i < block; i++)
                 theta[i] = partial_lh_node[i] * partial_lh_dad[i];
 
@@ -2148,11 +2314,15 @@ void PhyloTree::computeLikelihoodDervGenericSIMD(PhyloNeighbor *dad_branch, Phyl
     	node_branch = tmp_nei;
     }
 
+    // theta_all already holds the product of both partial likelihoods on this branch:
+    // Newton steps after the first one need no traversal
+    if (!theta_computed) {
 #ifdef KERNEL_FIX_STATES
-    computeTraversalInfo<VectorClass, nstates>(node, dad, false);
+        computeTraversalInfo<VectorClass, nstates>(node, dad, false);
 #else
-    computeTraversalInfo<VectorClass>(node, dad, false);
+        computeTraversalInfo<VectorClass>(node, dad, false);
 #endif
+    }
 
 //
 //    if ((dad_branch->partial_lh_computed & 1) == 0)
@@ -2275,10 +2445,8 @@ void PhyloTree::computeLikelihoodDervGenericSIMD(PhyloNeighbor *dad_branch, Phyl
 
 //    double tree_lh = node_branch->lh_scale_factor + dad_branch->lh_scale_factor;
 
-#ifdef _OPENMP
-#pragma omp parallel for schedule(static, 1) private(ptn, i, c) num_threads(num_threads)
-#endif
-    for (int thread_id = 0; thread_id < num_threads; thread_id++) {
+    runThreads(num_threads, [&](int thread_id) {
+        size_t ptn, i, c;
         VectorClass my_df(0.0), my_ddf(0.0), vc_prob_const(0.0), vc_df_const(0.0), vc_ddf_const(0.0);
         size_t ptn_lower = limits[thread_id];
         size_t ptn_upper = limits[thread_id+1];
@@ -2455,7 +2623,7 @@ void PhyloTree::computeLikelihoodDervGenericSIMD(PhyloNeighbor *dad_branch, Phyl
                 }
             }
         } // else isMixlen()
-    } // FOR thread
+    }); // FOR thread
 
     // mark buffer as computed
     theta_computed = true;
@@ -2669,10 +2837,8 @@ double PhyloTree::computeLikelihoodBranchGenericSIMD(PhyloNeighbor *dad_branch,
         }
 
     	// now do the real computation
-#ifdef _OPENMP
-#pragma omp parallel for private(ptn, i, c) schedule(static, 1) num_threads(num_threads)
-#endif
-        for (int thread_id = 0; thread_id < num_threads; thread_id++) {
+        runThreads(num_threads, [&](int thread_id) {
+            size_t ptn, i, c;
 
             VectorClass vc_tree_lh(0.0), vc_prob_const(0.0);
 
@@ -2686,13 +2852,16 @@ double PhyloTree::computeLikelihoodBranchGenericSIMD(PhyloNeighbor *dad_branch,
             for (vector<TraversalInfo>::iterator it = traversal_info.begin(); it != traversal_info.end(); it++)
                 computePartialLikelihood(*it, ptn_lower, ptn_upper, thread_id);
 
+            double *float_lh_dad = partial_lh_float ? buffer_float_lh + 3*block*VectorClass::size()*thread_id : NULL;
+            double *float_lh_node = partial_lh_float ? float_lh_dad + block*VectorClass::size() : NULL;
+
             double *vec_tip = buffer_partial_lh_ptr + block*VectorClass::size()*thread_id;
 
             for (ptn = ptn_lower; ptn < ptn_upper; ptn+=VectorClass::size()) {
                 VectorClass lh_ptn(0.0);
 //                lh_ptn.load_a(&ptn_invar[ptn]);
                 VectorClass *lh_cat = (VectorClass*)(_pattern_lh_cat + ptn*ncat_mix);
-                VectorClass *partial_lh_dad = (VectorClass*)(dad_branch->partial_lh + ptn*block);
+                VectorClass *partial_lh_dad = (VectorClass*)getPartialLhPtn<VectorClass>(dad_branch->partial_lh, ptn, block, partial_lh_float, float_lh_dad);
                 VectorClass *lh_node = SITE_MODEL ? (VectorClass*)&partial_lh_node[ptn*nstates] : (VectorClass*)vec_tip;
 
                 if (SITE_MODEL) {
@@ -2812,17 +2981,15 @@ double PhyloTree::computeLikelihoodBranchGenericSIMD(PhyloNeighbor *dad_branch,
                 if (isASC)
                     all_prob_const += vc_prob_const;
             }
-        } // FOR thread
+        }); // FOR thread
 
     } else {
 
 //        ASSERT(0 && "Don't compute tree log-likelihood from internal branch!");
     	//-------- both dad and node are internal nodes -----------/
 
-#ifdef _OPENMP
-#pragma omp parallel for private(ptn, i, c) schedule(static, 1) num_threads(num_threads)
-#endif
-        for (int thread_id = 0; thread_id < num_threads; thread_id++) {
+        runThreads(num_threads, [&](int thread_id) {
+            size_t ptn, i, c;
 
             size_t ptn_lower = limits[thread_id];
             size_t ptn_upper = limits[thread_id+1];
@@ -2836,12 +3003,15 @@ double PhyloTree::computeLikelihoodBranchGenericSIMD(PhyloNeighbor *dad_branch,
             for (vector<TraversalInfo>::iterator it = traversal_info.begin(); it != traversal_info.end(); it++)
                 computePartialLikelihood(*it, ptn_lower, ptn_upper, thread_id);
 
+            double *float_lh_dad = partial_lh_float ? buffer_float_lh + 3*block*VectorClass::size()*thread_id : NULL;
+            double *float_lh_node = partial_lh_float ? float_lh_dad + block*VectorClass::size() : NULL;
+
             for (ptn = ptn_lower; ptn < ptn_upper; ptn+=VectorClass::size()) {
                 VectorClass lh_ptn(0.0);
 //                lh_ptn.load_a(&ptn_invar[ptn]);
                 VectorClass *lh_cat = (VectorClass*)(_pattern_lh_cat + ptn*ncat_mix);
-                VectorClass *partial_lh_dad = (VectorClass*)(dad_branch->partial_lh + ptn*block);
-                VectorClass *partial_lh_node = (VectorClass*)(node_branch->partial_lh + ptn*block);
+                VectorClass *partial_lh_dad = (VectorClass*)getPartialLhPtn<VectorClass>(dad_branch->partial_lh, ptn, block, partial_lh_float, float_lh_dad);
+                VectorClass *partial_lh_node = (VectorClass*)getPartialLhPtn<VectorClass>(node_branch->partial_lh, ptn, block, partial_lh_float, float_lh_node);
 
                 // compute likelihood per category
                 if (SITE_MODEL) {
@@ -2944,7 +3114,7 @@ double PhyloTree::computeLikelihoodBranchGenericSIMD(PhyloNeighbor *dad_branch,
                 if (isASC)
                     all_prob_const += vc_prob_const;
             }
-        } // FOR thread
+        }); // FOR thread
     } // else
 
     tree_lh += horizontal_add(all_tree_lh);
@@ -3082,16 +3252,13 @@ double PhyloTree::computeLikelihoodFromBufferGenericSIMD()
 //    double tree_lh = node_branch->lh_scale_factor + dad_branch->lh_scale_factor;
 
     VectorClass all_tree_lh(0.0), all_prob_const(0.0);
+    vector<size_t> limits;
+    computeBounds<VectorClass>(num_threads, nptn, limits);
 
-#ifdef _OPENMP
-#pragma omp parallel private(ptn, i, c) num_threads(num_threads)
-    {
-#endif
+    runThreads(num_threads, [&](int thread_id) {
+        size_t ptn, i, c;
         VectorClass vc_tree_lh(0.0), vc_prob_const(0.0);
-#ifdef _OPENMP
-#pragma omp for schedule(static) nowait
-#endif
-    for (ptn = 0; ptn < nptn; ptn+=VectorClass::size()) {
+    for (ptn = limits[thread_id]; ptn < limits[thread_id+1]; ptn+=VectorClass::size()) {
 		VectorClass lh_ptn(0.0);
 		VectorClass *theta = (VectorClass*)(theta_all + ptn*block);
         if (SITE_MODEL) {
@@ -3140,16 +3307,13 @@ double PhyloTree::computeLikelihoodFromBufferGenericSIMD()
     }
 #ifdef _OPENMP
 #pragma omp critical
+#endif
         {
             all_tree_lh += vc_tree_lh;
             if (isASC)
                 all_prob_const += vc_prob_const;
         }
-    }
-#else
-    all_tree_lh = vc_tree_lh;
-    all_prob_const = vc_prob_const;
-#endif
+    }); // FOR thread
 
     double tree_lh = horizontal_add(all_tree_lh);
 
@@ -3310,10 +3474,8 @@ void PhyloTree::computeLikelihoodDervMixlenGenericSIMD(PhyloNeighbor *dad_branch
 
 //    double tree_lh = node_branch->lh_scale_factor + dad_branch->lh_scale_factor;
 
-#ifdef _OPENMP
-#pragma omp parallel for schedule(static, 1) private(ptn, i, c) num_threads(num_threads)
-#endif
-    for (int thread_id = 0; thread_id < num_threads; thread_id++) {
+    runThreads(num_threads, [&](int thread_id) {
+        size_t ptn, i, c;
         VectorClass my_df(0.0), my_ddf(0.0), vc_prob_const(0.0), vc_df_const(0.0), vc_ddf_const(0.0);
         size_t ptn_lower = limits[thread_id];
         size_t ptn_upper = limits[thread_id+1];
@@ -3379,7 +3541,7 @@ void PhyloTree::computeLikelihoodDervMixlenGenericSIMD(PhyloNeighbor *dad_branch
             }
         }
 
-    } // FOR thread
+    }); // FOR thread
 
     // mark buffer as computed
     theta_computed = true;
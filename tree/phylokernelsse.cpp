@@ -33,8 +33,12 @@ void PhyloTree::setParsimonyKernelSSE() {
 void PhyloTree::setDotProductSSE() {
 #ifdef BOOT_VAL_FLOAT
 		dotProduct = &PhyloTree::dotProductSIMD<float, Vec4f>;
+		matrixProduct = &PhyloTree::matrixProductSIMD<float, Vec4f>;
+		dotProductCount = &PhyloTree::dotProductCountSIMD<float, Vec4f>;
 #else
 		dotProduct = &PhyloTree::dotProductSIMD<double, Vec2d>;
+		matrixProduct = &PhyloTree::matrixProductSIMD<double, Vec2d>;
+		dotProductCount = &PhyloTree::dotProductCountSIMD<double, Vec2d>;
 #endif
         dotProductDouble = &PhyloTree::dotProductSIMD<double, Vec2d>;
 }
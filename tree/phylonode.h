@@ -52,6 +52,7 @@ public:
         partial_pars = NULL;
         direction = UNDEFINED_DIRECTION;
         size = 0;
+        traversal_level = 0;
     }
 
     /**
@@ -68,6 +69,7 @@ public:
         partial_pars = NULL;
         direction = UNDEFINED_DIRECTION;
         size = 0;
+        traversal_level = 0;
     }
 
     /**
@@ -159,6 +161,9 @@ private:
     /** size of subtree below this neighbor in terms of number of taxa */
     int size;
 
+    /** 1 + level in the traversal being scheduled, 0 otherwise, see PhyloTree::computeTraversalLevels() */
+    int traversal_level;
+
 };
 
 /**
@@ -22,17 +22,22 @@
 #include "alignment/superalignmentpairwise.h"
 #include "main/phylotesting.h"
 #include "model/partitionmodel.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 PhyloSuperTree::PhyloSuperTree()
  : IQTree()
 {
 	totalNNIs = evalNNIs = 0;
     rescale_codon_brlen = false;
+    num_part_threads = 1;
 	// Initialize the counter for evaluated NNIs on subtrees. FOR THIS CASE IT WON'T BE initialized.
 }
 
 PhyloSuperTree::PhyloSuperTree(SuperAlignment *alignment) :  IQTree(alignment) {
     totalNNIs = evalNNIs = 0;
+    num_part_threads = 1;
 
     rescale_codon_brlen = false;
     bool has_codon = false;
@@ -66,6 +71,7 @@ PhyloSuperTree::PhyloSuperTree(SuperAlignment *alignment) :  IQTree(alignment) {
 
 PhyloSuperTree::PhyloSuperTree(SuperAlignment *alignment, PhyloSuperTree *super_tree) :  IQTree(alignment) {
 	totalNNIs = evalNNIs = 0;
+    num_part_threads = 1;
     rescale_codon_brlen = super_tree->rescale_codon_brlen;
 	part_info = super_tree->part_info;
 	for (vector<Alignment*>::iterator it = alignment->partitions.begin(); it != alignment->partitions.end(); it++) {
@@ -205,8 +211,14 @@ void PhyloSuperTree::changeLikelihoodKernel(LikelihoodKernel lk) {
 
 void PhyloSuperTree::setNumThreads(int num_threads) {
     PhyloTree::setNumThreads((size() >= num_threads) ? num_threads : 1);
-    for (iterator it = begin(); it != end(); it++)
+    for (iterator it = begin(); it != end(); it++) {
         (*it)->setNumThreads((size() >= num_threads) ? 1 : num_threads);
+        // only partition groups in computePartitionGroups() run a partition with more threads
+        if ((*it)->aln)
+            (*it)->max_num_threads = max(1, min(num_threads, (*it)->aln->getNPattern()/MIN_PTN_PER_THREAD));
+    }
+    num_part_threads = num_threads;
+    part_groups.clear();
 }
 
 string PhyloSuperTree::getTreeString() {
@@ -521,9 +533,17 @@ void PhyloSuperTree::initializeAllPartialLh() {
 	for (iterator it = begin(); it != end(); it++) {
 		(*it)->initializeAllPartialLh();
 	}
+    // partition models may have changed
+    part_groups.clear();
 }
 
 
+void PhyloSuperTree::disablePartialLhFloat() {
+    PhyloTree::disablePartialLhFloat();
+    for (iterator it = begin(); it != end(); it++)
+        (*it)->disablePartialLhFloat();
+}
+
 void PhyloSuperTree::deleteAllPartialLh() {
 	for (iterator it = begin(); it != end(); it++) {
 		(*it)->deleteAllPartialLh();
@@ -597,6 +617,91 @@ void PhyloSuperTree::computePartitionOrder() {
 #endif // OPENMP
 }
 
+int PhyloSuperTree::getPartitionMaxThreads(int part) {
+    return max(at(part)->num_threads, at(part)->max_num_threads);
+}
+
+double PhyloSuperTree::getPartitionCost(int part) {
+    PhyloTree *tree = at(part);
+    double cost = ((double)tree->aln->getNSeq())*tree->aln->getNPattern()*tree->aln->num_states;
+    if (tree->getModelFactory() && tree->getModel() && tree->getRate())
+        cost *= tree->getNumLhCat(WSL_MIXTURE_RATECAT);
+    return cost;
+}
+
+void PhyloSuperTree::computePartitionGroups() {
+    if (!part_groups.empty())
+        return;
+    int part, ntrees = size();
+    DoubleVector costs(ntrees);
+    double total_cost = 0.0;
+    for (part = 0; part < ntrees; part++)
+        total_cost += (costs[part] = getPartitionCost(part));
+
+    // descending order of cost, ties in the order of part_order
+    if (part_order.empty()) computePartitionOrder();
+    IntVector order = part_order;
+    stable_sort(order.begin(), order.end(), [&costs](int a, int b) { return costs[a] > costs[b]; });
+
+    // a partition costing more than one thread's share gets its own group,
+    // with threads proportional to its cost
+    int num_threads = max(num_part_threads, 1);
+    double thread_cost = total_cost / num_threads;
+    int used_threads = 0, next;
+    for (next = 0; next < ntrees && costs[order[next]] > thread_cost; next++) {
+        PartitionGroup group;
+        group.parts.push_back(order[next]);
+        group.cost = costs[order[next]];
+        group.num_threads = max(1, min(getPartitionMaxThreads(order[next]), (int)(group.cost / thread_cost)));
+        used_threads += group.num_threads;
+        part_groups.push_back(group);
+    }
+    int num_large = part_groups.size();
+
+    // the other partitions are packed into single-thread groups, each time into the group of least cost
+    int num_small = min(ntrees - next, max(num_threads - used_threads, 1));
+    part_groups.resize(num_large + num_small);
+    for (int g = num_large; g < num_large + num_small; g++) {
+        part_groups[g].num_threads = 1;
+        part_groups[g].cost = 0.0;
+    }
+    for (; next < ntrees; next++) {
+        int best = num_large;
+        for (int g = num_large+1; g < num_large + num_small; g++)
+            if (part_groups[g].cost < part_groups[best].cost)
+                best = g;
+        part_groups[best].parts.push_back(order[next]);
+        part_groups[best].cost += costs[order[next]];
+    }
+
+    // spare threads go to the large partitions with the highest cost per thread
+    for (int spare = num_threads - used_threads - num_small; spare > 0; spare--) {
+        int best = -1;
+        for (int g = 0; g < num_large; g++)
+            if (part_groups[g].num_threads < getPartitionMaxThreads(part_groups[g].parts[0]) &&
+                (best < 0 || part_groups[g].cost/part_groups[g].num_threads > part_groups[best].cost/part_groups[best].num_threads))
+                best = g;
+        if (best < 0)
+            break;
+        part_groups[best].num_threads++;
+    }
+
+    // longest groups first for the dynamic schedule
+    stable_sort(part_groups.begin(), part_groups.end(), [](const PartitionGroup &a, const PartitionGroup &b) {
+        return a.cost/a.num_threads > b.cost/b.num_threads;
+    });
+
+    if (verbose_mode >= VB_MAX) {
+        cout << "Partition groups (#threads: partitions):" << endl;
+        for (vector<PartitionGroup>::iterator it = part_groups.begin(); it != part_groups.end(); it++) {
+            cout << "  " << it->num_threads << ":";
+            for (IntVector::iterator pit = it->parts.begin(); pit != it->parts.end(); pit++)
+                cout << " " << *pit;
+            cout << endl;
+        }
+    }
+}
+
 double PhyloSuperTree::computeLikelihood(double *pattern_lh) {
 	double tree_lh = 0.0;
 	int ntrees = size();
@@ -610,15 +715,27 @@ double PhyloSuperTree::computeLikelihood(double *pattern_lh) {
 			pattern_lh += at(i)->getAlnNPattern();
 		}
 	} else {
-        if (part_order.empty()) computePartitionOrder();
+        computePartitionGroups();
+        int num_groups = part_groups.size();
 		#ifdef _OPENMP
-		#pragma omp parallel for reduction(+: tree_lh) schedule(dynamic) if(num_threads > 1)
+        int saved_nested = omp_get_nested();
+        omp_set_nested(num_part_threads > num_groups);
+		#pragma omp parallel for reduction(+: tree_lh) schedule(dynamic) num_threads(num_groups) if(num_groups > 1)
 		#endif
-		for (int j = 0; j < ntrees; j++) {
-            int i = part_order[j];
-			part_info[i].cur_score = at(i)->computeLikelihood();
-			tree_lh += part_info[i].cur_score;
+		for (int g = 0; g < num_groups; g++) {
+            PartitionGroup &group = part_groups[g];
+            for (IntVector::iterator it = group.parts.begin(); it != group.parts.end(); it++) {
+                PhyloTree *tree = at(*it);
+                int saved_threads = tree->num_threads;
+                tree->num_threads = group.num_threads;
+                part_info[*it].cur_score = tree->computeLikelihood();
+                tree->num_threads = saved_threads;
+                tree_lh += part_info[*it].cur_score;
+            }
 		}
+		#ifdef _OPENMP
+        omp_set_nested(saved_nested);
+		#endif
 	}
 	return tree_lh;
 }
@@ -671,17 +788,29 @@ void PhyloSuperTree::computePatternProbabilityCategory(double *ptn_prob_cat, Sit
 double PhyloSuperTree::optimizeAllBranches(int my_iterations, double tolerance, int maxNRStep) {
 	double tree_lh = 0.0;
 	int ntrees = size();
-    if (part_order.empty()) computePartitionOrder();
+    computePartitionGroups();
+    int num_groups = part_groups.size();
 	#ifdef _OPENMP
-	#pragma omp parallel for reduction(+: tree_lh) schedule(dynamic) if(num_threads > 1)
+    int saved_nested = omp_get_nested();
+    omp_set_nested(num_part_threads > num_groups);
+	#pragma omp parallel for reduction(+: tree_lh) schedule(dynamic) num_threads(num_groups) if(num_groups > 1)
 	#endif
-	for (int j = 0; j < ntrees; j++) {
-        int i = part_order[j];
-		part_info[i].cur_score = at(i)->optimizeAllBranches(my_iterations, tolerance/min(ntrees,10), maxNRStep);
-		tree_lh += part_info[i].cur_score;
-		if (verbose_mode >= VB_MAX)
-			at(i)->printTree(cout, WT_BR_LEN + WT_NEWLINE);
+	for (int g = 0; g < num_groups; g++) {
+        PartitionGroup &group = part_groups[g];
+        for (IntVector::iterator it = group.parts.begin(); it != group.parts.end(); it++) {
+            int i = *it;
+            int saved_threads = at(i)->num_threads;
+            at(i)->num_threads = group.num_threads;
+            part_info[i].cur_score = at(i)->optimizeAllBranches(my_iterations, tolerance/min(ntrees,10), maxNRStep);
+            at(i)->num_threads = saved_threads;
+            tree_lh += part_info[i].cur_score;
+            if (verbose_mode >= VB_MAX)
+                at(i)->printTree(cout, WT_BR_LEN + WT_NEWLINE);
+        }
 	}
+	#ifdef _OPENMP
+    omp_set_nested(saved_nested);
+	#endif
 
 	if (my_iterations >= 100) computeBranchLengths();
 	return tree_lh;
@@ -929,7 +1058,7 @@ NNIMove PhyloSuperTree::getBestNNIForBran(PhyloNode *node1, PhyloNode *node2, NN
        		computePatternLikelihood(nniMoves[nniid].ptnlh, &nni_scores[nniid]);
         }
         if (save_all_trees == 2)
-        	saveCurrentTree(nni_scores[nniid]);
+        	saveCurrentTree(nni_scores[nniid], nniMoves ? nniMoves[nniid].ptnlh : NULL);
 
         // restore information
         for (part = 0; part < ntrees; part++) {
@@ -25,6 +25,21 @@
 #include "alignment/superalignment.h"
 
 
+/**
+    partitions computed one after another by a group of threads,
+    see PhyloSuperTree::computePartitionGroups()
+*/
+struct PartitionGroup {
+    /** partition IDs, in descending order of cost */
+    IntVector parts;
+
+    /** number of threads used by each partition of the group */
+    int num_threads;
+
+    /** total cost of the partitions */
+    double cost;
+};
+
 /**
 Phylogenetic tree for partition model (multi-gene alignment)
 
@@ -209,6 +224,11 @@ public:
      */
     virtual void initializeAllPartialLh();
 
+    /**
+            store partial likelihoods of all partition trees in double precision from now on
+     */
+    virtual void disablePartialLhFloat();
+
     /**
             de-allocate central_partial_lh
      */
@@ -323,6 +343,34 @@ public:
     /* compute part_order vector */
     void computePartitionOrder();
 
+    /**
+        groups of partitions for the nested parallelization: partitions with a large
+        cost get a group with several threads, small ones share a single-thread group
+    */
+    vector<PartitionGroup> part_groups;
+
+    /** number of threads shared by all partitions */
+    int num_part_threads;
+
+    /**
+        @return maximal number of threads of a partition in a group, limited by its buffers
+    */
+    int getPartitionMaxThreads(int part);
+
+    /**
+        @return estimated cost of the likelihood of a partition:
+            #sequences x #patterns x #states x #rate categories (and mixture classes)
+    */
+    double getPartitionCost(int part);
+
+    /**
+        compute part_groups with the longest-processing-time heuristic: each large partition
+        gets threads proportional to its cost, and the small partitions are packed into the
+        remaining single-thread groups. Computed once and recomputed only after the number of
+        threads or the partition models changed (setNumThreads(), initializeAllPartialLh()).
+    */
+    void computePartitionGroups();
+
     /**
             get the name of the model
     */
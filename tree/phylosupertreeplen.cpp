@@ -10,6 +10,9 @@
 #include "model/partitionmodelplen.h"
 #include <string.h>
 #include "utils/timeutil.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 
 
@@ -225,19 +228,29 @@ void PhyloSuperTreePlen::optimizeOneBranch(PhyloNode *node1, PhyloNode *node2, b
 	}
 
 	if(clearLH && current_len != current_it->length){
-		for (int part = 0; part < size(); part++) {
-			PhyloNeighbor *nei1_part = nei1->link_neighbors[part];
-			PhyloNeighbor *nei2_part = nei2->link_neighbors[part];
-			if(nei1_part){
-				((PhyloNode*)nei1_part->node)->clearReversePartialLh(((PhyloNode*)nei2_part->node));
-				((PhyloNode*)nei2_part->node)->clearReversePartialLh(((PhyloNode*)nei1_part->node));
-			}
-		}
+		clearReversePartialLh((SuperNode*)node2, (SuperNode*)node1, nei2->link_neighbors);
+		clearReversePartialLh((SuperNode*)node1, (SuperNode*)node2, nei1->link_neighbors);
 	}
 
 //	return tree_lh;
 }
 
+void PhyloSuperTreePlen::clearReversePartialLh(SuperNode *node, SuperNode *dad, PhyloNeighborVec &keep) {
+    int ntrees = size();
+    FOR_NEIGHBOR_IT(node, dad, it) {
+        SuperNeighbor *nei = (SuperNeighbor*)(*it)->node->findNeighbor(node);
+        for (int part = 0; part < ntrees; part++) {
+            PhyloNeighbor *nei_part = nei->link_neighbors[part];
+            // super branches on the path of the partition branch map to that branch
+            if (nei_part && keep[part] && nei_part != keep[part]) {
+                nei_part->partial_lh_computed = 0;
+                nei_part->size = 0;
+            }
+        }
+        clearReversePartialLh((SuperNode*)(*it)->node, node, keep);
+    }
+}
+
 double PhyloSuperTreePlen::computeFunction(double value) {
 
 	double tree_lh = 0.0;
@@ -253,12 +266,19 @@ double PhyloSuperTreePlen::computeFunction(double value) {
 	SuperNeighbor *nei2 = (SuperNeighbor*)current_it->node->findNeighbor(current_it_back->node);
 	ASSERT(nei1 && nei2);
 
-    if (part_order.empty()) computePartitionOrder();
+    computePartitionGroups();
+    int num_groups = part_groups.size();
     #ifdef _OPENMP
-    #pragma omp parallel for reduction(+: tree_lh) schedule(dynamic) if(num_threads > 1)
+    int saved_nested = omp_get_nested();
+    omp_set_nested(num_part_threads > num_groups);
+    #pragma omp parallel for reduction(+: tree_lh) schedule(dynamic) num_threads(num_groups) if(num_groups > 1)
     #endif    
-	for (int partid = 0; partid < ntrees; partid++) {
-            int part = part_order_by_nptn[partid];
+	for (int g = 0; g < num_groups; g++) {
+        PartitionGroup &group = part_groups[g];
+        for (IntVector::iterator it = group.parts.begin(); it != group.parts.end(); it++) {
+            int part = *it;
+            int saved_threads = at(part)->num_threads;
+            at(part)->num_threads = group.num_threads;
 			PhyloNeighbor *nei1_part = nei1->link_neighbors[part];
 			PhyloNeighbor *nei2_part = nei2->link_neighbors[part];
 			if (nei1_part && nei2_part) {
@@ -273,7 +293,12 @@ double PhyloSuperTreePlen::computeFunction(double value) {
 					part_info[part].cur_score = at(part)->computeLikelihood();
 				tree_lh += part_info[part].cur_score;
 			}
-		}
+            at(part)->num_threads = saved_threads;
+        }
+    }
+    #ifdef _OPENMP
+    omp_set_nested(saved_nested);
+    #endif
     return -tree_lh;
 }
 
@@ -311,13 +336,20 @@ void PhyloSuperTreePlen::computeFuncDerv(double value, double &df_ret, double &d
 	SuperNeighbor *nei2 = (SuperNeighbor*)current_it->node->findNeighbor(current_it_back->node);
 	ASSERT(nei1 && nei2);
 
-    if (part_order.empty()) computePartitionOrder();
+    computePartitionGroups();
+    int num_groups = part_groups.size();
     #ifdef _OPENMP
-    #pragma omp parallel for reduction(+: df, ddf) schedule(dynamic) if(num_threads > 1)
+    int saved_nested = omp_get_nested();
+    omp_set_nested(num_part_threads > num_groups);
+    #pragma omp parallel for reduction(+: df, ddf) schedule(dynamic) num_threads(num_groups) if(num_groups > 1)
     #endif    
-	for (int partid = 0; partid < ntrees; partid++) {
-        int part = part_order_by_nptn[partid];
-        double df_aux, ddf_aux;
+	for (int g = 0; g < num_groups; g++) {
+        PartitionGroup &group = part_groups[g];
+        for (IntVector::iterator it = group.parts.begin(); it != group.parts.end(); it++) {
+            int part = *it;
+            int saved_threads = at(part)->num_threads;
+            at(part)->num_threads = group.num_threads;
+            double df_aux, ddf_aux;
 			PhyloNeighbor *nei1_part = nei1->link_neighbors[part];
 			PhyloNeighbor *nei2_part = nei2->link_neighbors[part];
 			if (nei1_part && nei2_part) {
@@ -340,7 +372,12 @@ void PhyloSuperTreePlen::computeFuncDerv(double value, double &df_ret, double &d
 				if (part_info[part].cur_score == 0.0)
 					part_info[part].cur_score = at(part)->computeLikelihood();
 			}
-		}
+            at(part)->num_threads = saved_threads;
+        }
+    }
+    #ifdef _OPENMP
+    omp_set_nested(saved_nested);
+    #endif
     df_ret = -df;
     ddf_ret = -ddf;
 }
@@ -1171,7 +1208,7 @@ double PhyloSuperTreePlen::swapNNIBranch(double cur_score, PhyloNode *node1, Phy
 
 	    // Save current tree for ufboot analysis
 	    if (save_all_trees == 2) {
-	    		saveCurrentTree(score);
+	    		saveCurrentTree(score, nniMoves[cnt].ptnlh);
 	    }
 
 //	    // *************************** STORE INFO ABOUT NNI ***************************
@@ -1718,6 +1755,8 @@ void PhyloSuperTreePlen::initializeAllPartialLh() {
         }
     }
 
+    // partition models may have changed
+    part_groups.clear();
 }
 
 void PhyloSuperTreePlen::initializeAllPartialLh(double* &lh_addr, UBYTE* &scale_addr, UINT* &pars_addr, PhyloNode *node, PhyloNode *dad) {
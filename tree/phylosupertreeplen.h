@@ -168,6 +168,16 @@ public:
      */
     virtual void optimizeOneBranch(PhyloNode *node1, PhyloNode *node2, bool clearLH = true, int maxNRStep = 100);
 
+    /**
+            clear the partial likelihoods of all partition trees pointing towards a branch
+            in the subtree of node, by one traversal of the super tree instead of one per partition
+            @param node the subtree root
+            @param dad the other end of the branch
+            @param keep partition neighbors of the branch, whose partial likelihoods stay valid.
+                   Partitions with a NULL entry are not affected by the branch
+     */
+    void clearReversePartialLh(SuperNode *node, SuperNode *dad, PhyloNeighborVec &keep);
+
     /**
             search the best swap for a branch
             @return NNIMove The best Move/Swap
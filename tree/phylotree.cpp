@@ -21,6 +21,7 @@
  ***************************************************************************/
 #include "phylotree.h"
 #include "utils/bionj.h"
+#include "utils/bionjmatrix.h"
 //#include "rateheterogeneity.h"
 #include "alignment/alignmentpairwise.h"
 #include <algorithm>
@@ -78,7 +79,11 @@ void PhyloTree::init() {
     central_partial_lh = NULL;
     nni_partial_lh = NULL;
     tip_partial_lh = NULL;
+    partial_lh_float = false;
+    partial_lh_float_disabled = false;
+    buffer_float_lh = NULL;
     tip_partial_lh_computed = false;
+    tip_partial_lh_shared = false;
     ptn_freq_computed = false;
     central_scale_num = NULL;
     nni_scale_num = NULL;
@@ -98,10 +103,13 @@ void PhyloTree::init() {
     subTreeDistComputed = false;
     dist_matrix = NULL;
     var_matrix = NULL;
+    condensed_dist = NULL;
+    condensed_var = NULL;
     params = NULL;
     setLikelihoodKernel(LK_SSE2);  // FOR TUNG: you forgot to initialize this variable!
     setNumThreads(1);
     num_threads = 0;
+    max_num_threads = 0;
     max_lh_slots = 0;
     save_all_trees = 0;
     nodeBranchDists = NULL;
@@ -210,6 +218,7 @@ PhyloTree::~PhyloTree() {
     if (central_partial_pars)
         aligned_free(central_partial_pars);
     central_partial_pars = NULL;
+    deleteWorkerTrees();
     if (model_factory)
         delete model_factory;
     model_factory = NULL;
@@ -251,6 +260,14 @@ PhyloTree::~PhyloTree() {
         delete[] var_matrix;
     var_matrix = NULL;
 
+    if (condensed_dist)
+        delete condensed_dist;
+    condensed_dist = NULL;
+
+    if (condensed_var)
+        delete condensed_var;
+    condensed_var = NULL;
+
     if (pllPartitions)
     	myPartitionsDestroy(pllPartitions);
     if (pllAlignment)
@@ -713,13 +730,15 @@ void PhyloTree::initializeAllPartialPars(int &index, PhyloNode *node, PhyloNode
     FOR_NEIGHBOR_IT(node, dad, it)initializeAllPartialPars(index, (PhyloNode*) (*it)->node, node);
 }
 
-#define SIMD_BITS 256
+// widest parsimony kernel (AVX-512)
+#define SIMD_BITS 512
 
 size_t PhyloTree::getBitsBlockSize() {
     // reserve the last entry for parsimony score
 //    return (aln->num_states * aln->size() + UINT_BITS - 1) / UINT_BITS + 1;
     size_t len = aln->getMaxNumStates() * ((max(aln->size(), (size_t)aln->num_variant_sites) + SIMD_BITS - 1) / UINT_BITS) + 4;
-    len = ((len+7)/8)*8;
+    // keep every block aligned for 512-bit vectors
+    len = ((len+15)/16)*16;
     return len;
 }
 
@@ -765,16 +784,17 @@ size_t PhyloTree::getBufferPartialLhSize() {
     size_t block = model->num_states * ncat_mix;
     size_t buffer_size = get_safe_upper_limit(block * model->num_states * 2) * aln->getNSeq();
     buffer_size += get_safe_upper_limit(block *(aln->STATE_UNKNOWN+1)) * (aln->getNSeq()+1);
-    buffer_size += (block*2+model->num_states)*VECTOR_SIZE*num_threads;
+    size_t buffer_threads = max(num_threads, max_num_threads);
+    buffer_size += (block*2+model->num_states)*VECTOR_SIZE*buffer_threads;
 
     // always more buffer for non-rev kernel, in case switching between kernels
     buffer_size += get_safe_upper_limit(block)*(aln->STATE_UNKNOWN+1)*2;
-    buffer_size += block*2*VECTOR_SIZE*num_threads;
+    buffer_size += block*2*VECTOR_SIZE*buffer_threads;
     buffer_size += get_safe_upper_limit(3*block*model->num_states);
 
     if (isMixlen()) {
         size_t nmix = max(getMixlen(), getRate()->getNRate());
-        buffer_size += nmix*(nmix+1)*VECTOR_SIZE + (nmix+3)*nmix*VECTOR_SIZE*num_threads;
+        buffer_size += nmix*(nmix+1)*VECTOR_SIZE + (nmix+3)*nmix*VECTOR_SIZE*buffer_threads;
     }
     return buffer_size;
 }
@@ -787,6 +807,19 @@ void PhyloTree::initializeAllPartialLh() {
     // extra #numStates for ascertainment bias correction
     size_t mem_size = get_safe_upper_limit(getAlnNPattern()) + get_safe_upper_limit(numStates);
     size_t block_size = mem_size * numStates * site_rate->getNRate() * ((model_factory->fused_mix_rate)? 1 : model->getNMixtures());
+    bool lh_float = isPartialLhFloatSupported();
+    if (central_partial_lh && lh_float != partial_lh_float) {
+        // storage precision changed: reallocate partial likelihoods
+        aligned_free(central_partial_lh);
+        central_partial_lh = NULL;
+        if (nni_partial_lh)
+            aligned_free(nni_partial_lh);
+        nni_partial_lh = NULL;
+        if (buffer_float_lh)
+            aligned_free(buffer_float_lh);
+        buffer_float_lh = NULL;
+    }
+    partial_lh_float = lh_float;
     // make sure _pattern_lh size is divisible by 4 (e.g., 9->12, 14->16)
     if (!_pattern_lh)
         _pattern_lh = aligned_alloc<double>(mem_size);
@@ -799,6 +832,11 @@ void PhyloTree::initializeAllPartialLh() {
     if (!buffer_partial_lh) {
         buffer_partial_lh = aligned_alloc<double>(getBufferPartialLhSize());
     }
+    if (partial_lh_float && !buffer_float_lh) {
+        const size_t VECTOR_SIZE = 8;
+        size_t block = numStates * site_rate->getNRate() * ((model_factory->fused_mix_rate)? 1 : model->getNMixtures());
+        buffer_float_lh = aligned_alloc<double>(3*block*VECTOR_SIZE*max(num_threads, max_num_threads));
+    }
     if (!ptn_freq) {
         ptn_freq = aligned_alloc<double>(mem_size);
         ptn_freq_computed = false;
@@ -846,6 +884,8 @@ void PhyloTree::deleteAllPartialLh() {
         aligned_free(buffer_scale_all);
     if (buffer_partial_lh)
         aligned_free(buffer_partial_lh);
+    if (buffer_float_lh)
+        aligned_free(buffer_float_lh);
 	if (_pattern_lh_cat)
 		aligned_free(_pattern_lh_cat);
 	if (_pattern_lh)
@@ -860,6 +900,8 @@ void PhyloTree::deleteAllPartialLh() {
 	theta_all = NULL;
     buffer_scale_all = NULL;
     buffer_partial_lh = NULL;
+    buffer_float_lh = NULL;
+    partial_lh_float = false;
 	_pattern_lh_cat = NULL;
 	_pattern_lh = NULL;
 
@@ -896,6 +938,16 @@ uint64_t PhyloTree::getMemoryRequired(size_t ncategory, bool full_mem) {
     if (model)
     	mem_size += model->getMemoryRequired();
 
+    // per-pattern buffers (theta_all, _pattern_lh_cat, ...) and partial parsimony vectors,
+    // so that a -mem budget in bytes leaves the rest to partial likelihood slots
+    if (!full_mem && params->lh_mem_save == LM_MEM_SAVE && params->max_mem_size > 1) {
+        mem_size += (scale_block_size * (aln->num_states + 1) + 4 * nptn) * sizeof(double);
+        mem_size += (leafNum - 1) * 4 * getBitsBlockSize() * sizeof(UINT);
+    }
+
+    if (model && isPartialLhFloatSupported())
+        block_size = get_safe_upper_limit((block_size + nptn + 1)/2);
+
     int64_t lh_scale_size = block_size * sizeof(double) + scale_block_size * sizeof(UBYTE);
 
     max_lh_slots = leafNum-2;
@@ -959,7 +1011,7 @@ void PhyloTree::initializeAllPartialLh(int &index, int &indexlh, PhyloNode *node
     size_t nptn = get_safe_upper_limit(aln->size())+ get_safe_upper_limit(aln->num_states);
     uint64_t block_size;
     uint64_t scale_block_size = nptn * site_rate->getNRate() * ((model_factory->fused_mix_rate)? 1 : model->getNMixtures());
-    block_size = scale_block_size * model->num_states;
+    block_size = getPartialLhSize();
 
     if (!node) {
         node = (PhyloNode*) root;
@@ -977,12 +1029,17 @@ void PhyloTree::initializeAllPartialLh(int &index, int &indexlh, PhyloNode *node
         	uint64_t tip_partial_lh_size = aln->num_states * (aln->STATE_UNKNOWN+1) * model->getNMixtures();
             if (model->isSiteSpecificModel())
                 tip_partial_lh_size = get_safe_upper_limit(aln->size()) * model->num_states * leafNum;
+            if (tip_partial_lh_shared)
+                tip_partial_lh_size = 0;
 
             if (max_lh_slots == 0)
                 getMemoryRequired();
 
             uint64_t mem_size = (uint64_t)max_lh_slots * block_size + 4 + tip_partial_lh_size;
 
+            if (params->lh_mem_save == LM_MEM_SAVE && verbose_mode >= VB_MED)
+                cout << "Memory saving mode: " << max_lh_slots << " of " << leafNum-2
+                     << " partial likelihood vectors kept in RAM" << endl;
             if (verbose_mode >= VB_MAX)
                 cout << "Allocating " << mem_size * sizeof(double) << " bytes for partial likelihood vectors" << endl;
             try {
@@ -995,7 +1052,9 @@ void PhyloTree::initializeAllPartialLh(int &index, int &indexlh, PhyloNode *node
         }
 
         // now always assign tip_partial_lh
-        if (params->lh_mem_save == LM_PER_NODE) {
+        if (tip_partial_lh_shared) {
+            // assigned by the owner
+        } else if (params->lh_mem_save == LM_PER_NODE) {
             tip_partial_lh = central_partial_lh + ((nodeNum - leafNum)*block_size);
         } else {
             tip_partial_lh = central_partial_lh + (max_lh_slots*block_size);
@@ -1089,10 +1148,45 @@ double *PhyloTree::newPartialLh() {
 size_t PhyloTree::getPartialLhSize() {
     // +num_states for ascertainment bias correction
     size_t block_size = get_safe_upper_limit(aln->size())+get_safe_upper_limit(aln->num_states);
+    size_t nptn = block_size;
     block_size *= model->num_states * site_rate->getNRate() * ((model_factory->fused_mix_rate)? 1 : model->getNMixtures());
+    // single precision: two floats per double plus one float exponent per pattern,
+    // padded to keep the vectors behind it (e.g. tip_partial_lh) aligned
+    if (partial_lh_float)
+        return get_safe_upper_limit((block_size + nptn + 1)/2);
 	return block_size;
 }
 
+bool PhyloTree::isPartialLhFloatSupported() {
+    if (!params || !params->partial_lh_float || partial_lh_float_disabled)
+        return false;
+    // only the SIMD kernels of reversible models know the single-precision layout
+    if (sse < LK_SSE2 || params->kernel_nonrev || !model || !model->isReversible())
+        return false;
+    // mixture models share partial_lh with their component trees
+    if (model->isMixture() || model->isSiteSpecificModel() || isMixlen())
+        return false;
+    // partition models with linked branch lengths manage partial_lh themselves
+    if (params->partition_file && params->partition_type != BRLEN_OPTIMIZE)
+        return false;
+    // ancestral states and site frequencies read partial_lh directly
+    if (params->print_ancestral_sequence != AST_NONE || params->print_site_state_freq != WSF_NONE)
+        return false;
+    return true;
+}
+
+double PhyloTree::restorePartialLhDouble() {
+    if (!params->partial_lh_float || partial_lh_float_disabled)
+        return curScore;
+    double float_score = computeLikelihood();
+    disablePartialLhFloat();
+    initializeAllPartialLh();
+    curScore = computeLikelihood();
+    cout << "Partial likelihoods switched to double precision, log-likelihood "
+         << float_score << " -> " << curScore << endl;
+    return curScore;
+}
+
 size_t PhyloTree::getPartialLhBytes() {
     // +num_states for ascertainment bias correction
 	return getPartialLhSize() * sizeof(double);
@@ -1123,6 +1217,93 @@ Node *findFirstFarLeaf(Node *node, Node *dad = NULL) {
     
 }
 
+int PhyloTree::prepareWorkerTrees(int max_num, bool share_model) {
+    // copies made earlier in this optimization
+    if (!worker_trees.empty())
+        return min(max_num, (int)worker_trees.size());
+
+    // every thread gets its own single-threaded copy; with fewer evaluations than threads,
+    // the threads are better spent on the likelihood of this tree
+    if (num_threads < 2 || max_num < num_threads)
+        return 0;
+#ifdef _OPENMP
+    if (omp_in_parallel())
+        return 0;
+#endif
+    // memory saving mode: -mem or the RAM are already spent on the partial likelihoods of this tree
+    if (isSuperTree() || isMixlen() || !model_factory || params->lh_mem_save == LM_MEM_SAVE)
+        return 0;
+
+    // every copy needs its own partial likelihoods, next to those of this tree
+    uint64_t mem_required = getMemoryRequired();
+    uint64_t mem_avail = getMemorySize()*0.95;
+    mem_avail = (mem_avail > mem_required) ? mem_avail - mem_required : 0;
+    if (mem_avail/mem_required < num_threads)
+        return 0;
+    int num = num_threads;
+
+    // transfer current model parameters via a temporary checkpoint
+    Checkpoint *ckp = new Checkpoint;
+    Checkpoint *model_ckp = model->getCheckpoint();
+    Checkpoint *rate_ckp = site_rate->getCheckpoint();
+    model->setCheckpoint(ckp);
+    site_rate->setCheckpoint(ckp);
+    model->saveCheckpoint();
+    site_rate->saveCheckpoint();
+    model->setCheckpoint(model_ckp);
+    site_rate->setCheckpoint(rate_ckp);
+    if (share_model)
+        computeTipPartialLikelihood();
+
+    // model definitions do not change during a run
+    static ModelsBlock *models_block = readModelsDefinition(*params);
+    string model_name = getModelName();
+    while (worker_trees.size() < num) {
+        PhyloTree *tree = new PhyloTree;
+        tree->copyPhyloTree(this);
+        tree->setParams(params);
+        tree->optimize_by_newton = optimize_by_newton;
+        // build the optimized part, the other part and the model factory are those of this tree
+        ModelFactory *factory = new ModelFactory(*params, model_name, tree, models_block);
+        factory->setCheckpoint(ckp);
+        factory->restoreCheckpoint();
+        tree->setModelFactory(model_factory);
+        if (share_model) {
+            tree->setRate(factory->site_rate);
+            delete factory->model;
+        } else {
+            tree->setModel(factory->model);
+            tree->getModel()->decomposeRateMatrix();
+            delete factory->site_rate;
+        }
+        delete factory;
+        tree->current_it = tree->current_it_back = NULL;
+        tree->setLikelihoodKernel(sse);
+        tree->num_threads = 1;
+        tree->tip_partial_lh_shared = share_model;
+        tree->initializeAllPartialLh();
+        if (share_model)
+            tree->tip_partial_lh = tip_partial_lh;
+        worker_trees.push_back(tree);
+    }
+    delete ckp;
+    return num;
+}
+
+void PhyloTree::deleteWorkerTrees() {
+    for (vector<PhyloTree*>::iterator it = worker_trees.begin(); it != worker_trees.end(); it++) {
+        // the copy does not own what it shares with this tree
+        if ((*it)->model_factory == model_factory)
+            (*it)->model_factory = NULL;
+        if ((*it)->model == model)
+            (*it)->model = NULL;
+        if ((*it)->site_rate == site_rate)
+            (*it)->site_rate = NULL;
+        delete (*it);
+    }
+    worker_trees.clear();
+}
+
 double PhyloTree::computeLikelihood(double *pattern_lh) {
     ASSERT(model);
     ASSERT(site_rate);
@@ -1696,7 +1877,7 @@ double PhyloTree::optimizeOneBranchLS(PhyloNode *node1, PhyloNode *node2) {
     		computeNodeBranchDists();
     		for (int i = 0; i < leafNum; i++)
     			for (int j = 0; j < leafNum; j++)
-    				var_matrix[i*leafNum+j] = pow(2.0,nodeBranchDists[i*nodeNum+j]);
+    				setDistVar(i, j, pow(2.0,nodeBranchDists[i*nodeNum+j]));
     	}
         computeSubtreeDists();
     }
@@ -1975,15 +2156,13 @@ void PhyloTree::computeAllSubtreeDistForOneNode(PhyloNode* source, PhyloNode* so
     if (markedNodeList.find(dad->id) != markedNodeList.end()) {
         return;
     } else if (source->isLeaf() && dad->isLeaf()) {
-        ASSERT(dist_matrix);
-        int nseq = aln->getNSeq();
         if (params->ls_var_type == OLS) {
-        	dist = dist_matrix[dad->id * nseq + source->id];
+        	dist = getDist(dad->id, source->id);
         	weight = 1.0;
         } else {
         	// this will take into account variances, also work for OLS since var = 1
-        	weight = 1.0/var_matrix[dad->id * nseq + source->id];
-        	dist = dist_matrix[dad->id * nseq + source->id] * weight;
+        	weight = 1.0/getDistVar(dad->id, source->id);
+        	dist = getDist(dad->id, source->id) * weight;
         }
         subTreeDists.insert(StringDoubleMap::value_type(key, dist));
         subTreeWeights.insert(StringDoubleMap::value_type(key, weight));
@@ -2887,6 +3066,20 @@ double PhyloTree::correctDist(double *dist_mat) {
     return longest_dist;
 }
 
+double PhyloTree::computeDistVar(double dist, double d2l) {
+    if (params->ls_var_type == OLS)
+        return 1.0;
+    else if (params->ls_var_type == WLS_PAUPLIN)
+        return 0.0;
+    else if (params->ls_var_type == WLS_FIRST_TAYLOR)
+        return dist;
+    else if (params->ls_var_type == WLS_FITCH_MARGOLIASH)
+        return dist * dist;
+    else if (params->ls_var_type == WLS_SECOND_TAYLOR)
+        return -1.0 / d2l;
+    return 1.0;
+}
+
 double PhyloTree::computeDist(double *dist_mat, double *var_mat) {
     int nseqs = aln->getNSeq();
     int pos = 0;
@@ -2905,6 +3098,12 @@ double PhyloTree::computeDist(double *dist_mat, double *var_mat) {
             col_id[pos] = row_id[pos] + 1;
         }
     }
+    // if no initial distances are given, compute the observed or JC distances of all pairs at once
+    bool init_given = false;
+    for (pos = 0; pos < num_pairs && !init_given; pos++)
+        init_given = (dist_mat[row_id[pos] * nseqs + col_id[pos]] != 0.0);
+    bool init_computed = !init_given && aln->computeObsDistMatrix(dist_mat, !params->compute_obs_dist);
+
     // compute the upper-triangle of distance matrix
 #ifdef _OPENMP
 #pragma omp parallel for private(pos)
@@ -2915,17 +3114,10 @@ double PhyloTree::computeDist(double *dist_mat, double *var_mat) {
         int seq2 = col_id[pos];
         double d2l; // moved here for thread-safe (OpenMP)
         int sym_pos = seq1 * nseqs + seq2;
-        dist_mat[sym_pos] = computeDist(seq1, seq2, dist_mat[sym_pos], d2l);
-        if (params->ls_var_type == OLS)
-            var_mat[sym_pos] = 1.0;
-        else if (params->ls_var_type == WLS_PAUPLIN)
-            var_mat[sym_pos] = 0.0;
-        else if (params->ls_var_type == WLS_FIRST_TAYLOR)
-            var_mat[sym_pos] = dist_mat[sym_pos];
-        else if (params->ls_var_type == WLS_FITCH_MARGOLIASH)
-            var_mat[sym_pos] = dist_mat[sym_pos] * dist_mat[sym_pos];
-        else if (params->ls_var_type == WLS_SECOND_TAYLOR)
-            var_mat[sym_pos] = -1.0 / d2l;
+        // observed distances are not optimized further
+        if (!init_computed || !params->compute_obs_dist)
+            dist_mat[sym_pos] = computeDist(seq1, seq2, dist_mat[sym_pos], d2l);
+        var_mat[sym_pos] = computeDistVar(dist_mat[sym_pos], d2l);
     }
 
     // copy upper-triangle into lower-triangle and set diagonal = 0
@@ -2994,9 +3186,12 @@ double PhyloTree::computeObsDist(double *dist_mat) {
     int nseqs = aln->getNSeq();
     int pos = 0;
     double longest_dist = 0.0;
+    bool computed = aln->computeObsDistMatrix(dist_mat);
     for (int seq1 = 0; seq1 < nseqs; seq1++)
         for (int seq2 = 0; seq2 < nseqs; seq2++, pos++) {
-            if (seq1 == seq2)
+            if (computed) {
+                // already filled in by the alignment
+            } else if (seq1 == seq2)
                 dist_mat[pos] = 0.0;
             else if (seq2 > seq1) {
                 dist_mat[pos] = aln->computeObsDist(seq1, seq2);
@@ -3030,17 +3225,121 @@ double PhyloTree::computeObsDist(Params &params, Alignment *alignment, double* &
  compute BioNJ tree, a more accurate extension of Neighbor-Joining
  ****************************************************************************/
 
+double PhyloTree::computeCondensedDist(Params &params, Alignment *alignment, string &dist_file) {
+    this->params = &params;
+    aln = alignment;
+    dist_file = params.out_prefix;
+    if (!model_factory && params.compute_obs_dist)
+        dist_file += ".obsdist";
+    else
+        dist_file += ".mldist";
+
+    // release the previous matrices first, they may be mapped to the same file
+    if (condensed_dist)
+        delete condensed_dist;
+    if (condensed_var)
+        delete condensed_var;
+    condensed_dist = new CondensedDistMatrix;
+    condensed_var = NULL;
+    int nseqs = alignment->getNSeq();
+
+    if (params.dist_file) {
+        if (!CondensedDistMatrix::isBinaryFile(params.dist_file))
+            outError("-dbin requires a binary distance file: ", params.dist_file);
+        condensed_dist->load(params.dist_file);
+        dist_file = params.dist_file;
+        if (condensed_dist->getNames() != alignment->getSeqNames()) {
+            // reorder the taxa as in the alignment
+            CondensedDistMatrix *file_mat = condensed_dist;
+            if (file_mat->getNTaxa() != nseqs)
+                outError("Distance file has different number of taxa");
+            map<string, int> name_id;
+            for (int id = 0; id < nseqs; id++)
+                name_id[file_mat->getNames()[id]] = id;
+            IntVector file_id(nseqs);
+            for (int seq = 0; seq < nseqs; seq++) {
+                if (name_id.count(alignment->getSeqName(seq)) == 0)
+                    outError("Could not find taxa name " + alignment->getSeqName(seq));
+                file_id[seq] = name_id[alignment->getSeqName(seq)];
+            }
+            condensed_dist = new CondensedDistMatrix;
+            condensed_dist->create(alignment->getSeqNames());
+            for (int seq1 = 0; seq1 < nseqs; seq1++)
+                for (int seq2 = seq1+1; seq2 < nseqs; seq2++)
+                    condensed_dist->set(seq1, seq2, file_mat->get(file_id[seq1], file_id[seq2]));
+            delete file_mat;
+        }
+        cout << "Distance matrix was read from " << params.dist_file << endl;
+        return condensed_dist->getLongestDist();
+    }
+
+    condensed_dist->create(alignment->getSeqNames(), dist_file.c_str());
+    if (params.ls_var_type != OLS) {
+        condensed_var = new CondensedDistMatrix;
+        condensed_var->create(alignment->getSeqNames());
+    }
+    bool init_computed = aln->computeObsDistMatrix(*condensed_dist, !params.compute_obs_dist);
+
+    // compute the upper triangle row by row
+    int seq1;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (seq1 = 0; seq1 < nseqs; seq1++)
+        for (int seq2 = seq1+1; seq2 < nseqs; seq2++) {
+            double d2l;
+            double dist = condensed_dist->get(seq1, seq2);
+            // observed distances are not optimized further
+            if (!init_computed || !params.compute_obs_dist)
+                dist = computeDist(seq1, seq2, dist, d2l);
+            condensed_dist->set(seq1, seq2, dist);
+            if (condensed_var)
+                condensed_var->set(seq1, seq2, computeDistVar(dist, d2l));
+        }
+    condensed_dist->flush();
+    return condensed_dist->getLongestDist();
+}
+
 void PhyloTree::computeBioNJ(Params &params, Alignment *alignment, string &dist_file) {
     string bionj_file = params.out_prefix;
     bionj_file += ".bionj";
     cout << "Computing BIONJ tree..." << endl;
-    BioNj bionj;
-    bionj.create(dist_file.c_str(), bionj_file.c_str());
 //    bool my_rooted = false;
     bool non_empty_tree = (root != NULL);
 //    if (root)
 //        freeNode();
-    readTreeFile(bionj_file.c_str());
+    if (dist_matrix || condensed_dist) {
+        // build the tree directly from the distance matrix in memory
+        StrVector &names = alignment->getSeqNames();
+        stringstream tree_stream;
+        BioNjMatrix bionj;
+        if (dist_matrix)
+            bionj.create(dist_matrix, names, tree_stream);
+        else
+            bionj.create(*condensed_dist, tree_stream);
+        try {
+            ofstream out;
+            out.exceptions(ios::failbit | ios::badbit);
+            out.open(bionj_file.c_str());
+            out << tree_stream.str();
+            out.close();
+        } catch (ios::failure) {
+            outError(ERR_WRITE_OUTPUT, bionj_file);
+        }
+        freeNode();
+        readTree(tree_stream, rooted);
+        setAlignment(alignment);
+        if (isSuperTree()) {
+            ((PhyloSuperTree*) this)->mapTrees();
+        } else {
+            clearAllPartialLH();
+        }
+        current_it = current_it_back = NULL;
+    } else {
+        BioNj bionj;
+        bionj.create(dist_file.c_str(), bionj_file.c_str());
+        readTreeFile(bionj_file.c_str());
+    }
     
 
     if (non_empty_tree) {
@@ -3542,7 +3841,7 @@ NNIMove PhyloTree::getBestNNIForBran(PhyloNode *node1, PhyloNode *node2, NNIMove
 			computePatternLikelihood(nniMoves[cnt].ptnlh, &score);
 
 		if (save_all_trees == 2) {
-			saveCurrentTree(score); // BQM: for new bootstrap
+			saveCurrentTree(score, nniMoves[cnt].ptnlh); // BQM: for new bootstrap
 		}
 
         // reorient partial_lh before swap
@@ -4328,22 +4627,6 @@ void PhyloTree::computeNNIPatternLh(double cur_lh, double &lh2, double *pattern_
 		cout << "Alternative NNI shows better log-likelihood " << max(lh2,lh3) << " > " << cur_lh << endl;
 }
 
-void PhyloTree::resampleLh(double **pat_lh, double *lh_new, int *rstream) {
-    //int nsite = getAlnNSite();
-    int nptn = getAlnNPattern();
-    memset(lh_new, 0, sizeof(double) * 3);
-    int i;
-    int *boot_freq = aligned_alloc<int>(getAlnNPattern());
-    aln->createBootstrapAlignment(boot_freq, params->bootstrap_spec, rstream);
-    for (i = 0; i < nptn; i++) {
-
-        lh_new[0] += boot_freq[i] * pat_lh[0][i];
-        lh_new[1] += boot_freq[i] * pat_lh[1][i];
-        lh_new[2] += boot_freq[i] * pat_lh[2][i];
-    }
-    aligned_free(boot_freq);
-}
-
 /*********************************************************/
 /** THIS FUNCTION IS TAKEN FROM PHYML source code alrt.c
 * Convert an aLRT statistic to a none parametric support
@@ -4515,104 +4798,286 @@ double Statistics_To_Probabilities(double in)
   return rough_value;
 }
 
+/**
+    Replicate matrix of the resampling estimated log-likelihoods (RELL): the pattern
+    counts of all bootstrap replicates, drawn once from a stream seeded with the
+    random seed and kept as compact integers. Replicate r is the r-th draw of that
+    stream, so the supports do not depend on the number of threads.
+*/
+class RELLScorer {
+public:
+    virtual ~RELLScorer() {}
+
+    /**
+        score pattern log-likelihood vectors against all replicates
+        @param pat_lh num_vec pattern log-likelihood vectors
+        @param[out] lh_new lh_new[vec*times + rep] is the RELL log-likelihood of vector vec in replicate rep
+    */
+    virtual void score(double **pat_lh, int num_vec, double *lh_new) = 0;
+};
+
+/** replicates in a tile of the RELL kernel, summed by one thread */
+const int RELL_REP_TILE = 16;
+
+/** patterns in a block of the RELL kernel, sized so that the counts of a tile stay in cache */
+const int RELL_PTN_BLOCK = 512;
+
+/** memory for the RELL replicate matrix, beyond which replicates are redrawn in blocks */
+const size_t RELL_MAX_MEM = ((size_t)1) << 28;
+
+template <class T>
+class RELLReplicates : public RELLScorer {
+public:
+
+    RELLReplicates(Alignment *aln, int nptn, const char *spec, int seed, int times) {
+        this->aln = aln;
+        this->spec = spec;
+        this->seed = seed;
+        this->times = times;
+        this->nptn = nptn;
+        size_t max_reps = max((size_t)RELL_REP_TILE, RELL_MAX_MEM / (sizeof(T)*nptn) / RELL_REP_TILE * RELL_REP_TILE);
+        if (max_reps < times) {
+            block_reps = max_reps;
+        } else {
+            // the whole matrix fits, draw it once for all branches
+            block_reps = times;
+            draw(0, times);
+        }
+    }
+
+    virtual void score(double **pat_lh, int num_vec, double *lh_new) {
+        if (block_reps == times) {
+            scoreBlock(pat_lh, num_vec, lh_new, 0);
+            return;
+        }
+        // redraw the same replicates block by block
+        ASSERT(rstream == NULL);
+        for (int rep = 0; rep < times; rep += block_reps) {
+            draw(rep, min(block_reps, times - rep));
+            scoreBlock(pat_lh, num_vec, lh_new, rep);
+        }
+        finish_random(rstream);
+        rstream = NULL;
+    }
+
+    virtual ~RELLReplicates() {
+        if (rstream)
+            finish_random(rstream);
+    }
+
+private:
+
+    /**
+        draw replicates [rep_begin, rep_begin+num_reps) into freq, stored pattern-major.
+        The stream is started at replicate 0 and continued by the following blocks
+    */
+    void draw(int rep_begin, int num_reps) {
+        if (rep_begin == 0)
+            init_random(seed, false, &rstream);
+        num_block_reps = num_reps;
+        freq.resize((size_t)nptn*num_reps);
+        IntVector boot_freq(nptn);
+        for (int rep = 0; rep < num_reps; rep++) {
+            aln->createBootstrapAlignment(&boot_freq[0], spec, rstream);
+            for (int ptn = 0; ptn < nptn; ptn++)
+                freq[(size_t)ptn*num_reps + rep] = boot_freq[ptn];
+        }
+        if (block_reps == times) {
+            finish_random(rstream);
+            rstream = NULL;
+        }
+    }
+
+    /**
+        blocked kernel: each thread sums a tile of replicates over blocks of patterns for all
+        vectors, so that the counts of a block are reused by all vectors while in cache.
+        Every sum runs over the patterns in order, as the unblocked sum does
+    */
+    void scoreBlock(double **pat_lh, int num_vec, double *lh_new, int rep_begin) {
+        int num_reps = num_block_reps;
+        int num_tiles = (num_reps + RELL_REP_TILE - 1) / RELL_REP_TILE;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+        for (int tile = 0; tile < num_tiles; tile++) {
+            int tile_begin = tile*RELL_REP_TILE;
+            int tile_size = min(RELL_REP_TILE, num_reps - tile_begin);
+            // partial sums of this thread
+            double sum[RELL_REP_TILE];
+            for (int vec = 0; vec < num_vec; vec++)
+                for (int j = 0; j < tile_size; j++)
+                    lh_new[(size_t)vec*times + rep_begin + tile_begin + j] = 0.0;
+            for (int ptn_begin = 0; ptn_begin < nptn; ptn_begin += RELL_PTN_BLOCK) {
+                int ptn_end = min(ptn_begin + RELL_PTN_BLOCK, nptn);
+                for (int vec = 0; vec < num_vec; vec++) {
+                    double *vec_lh = pat_lh[vec];
+                    double *vec_sum = lh_new + (size_t)vec*times + rep_begin + tile_begin;
+                    int j;
+                    for (j = 0; j < tile_size; j++)
+                        sum[j] = vec_sum[j];
+                    for (int ptn = ptn_begin; ptn < ptn_end; ptn++) {
+                        double lh = vec_lh[ptn];
+                        T *ptn_freq = &freq[(size_t)ptn*num_reps + tile_begin];
+                        for (j = 0; j < tile_size; j++)
+                            sum[j] += ptn_freq[j] * lh;
+                    }
+                    for (j = 0; j < tile_size; j++)
+                        vec_sum[j] = sum[j];
+                }
+            }
+        }
+    }
+
+    Alignment *aln;
+    const char *spec;
+    int seed;
+    int *rstream = NULL;
+
+    /** number of patterns and replicates */
+    int nptn, times;
+
+    /** replicates held in memory at a time, and in the current block */
+    int block_reps, num_block_reps;
+
+    /** pattern counts of the replicates in the current block, pattern-major */
+    vector<T> freq;
+};
+
 // Implementation of testBranch follows Guindon et al. (2010)
 
-double PhyloTree::testOneBranch(double best_score, double *pattern_lh, int reps, int lbp_reps,
-        PhyloNode *node1, PhyloNode *node2, double &lbp_support, double &aLRT_support, double &aBayes_support) {
+void PhyloTree::testBranches(double best_score, double *pattern_lh, int reps, int lbp_reps,
+        NodeVector &nodes1, NodeVector &nodes2, DoubleVector &SH_aLRT_support,
+        DoubleVector &lbp_support, DoubleVector &aLRT_support, DoubleVector &aBayes_support) {
     const int NUM_NNI = 3;
-    double lh[NUM_NNI];
-    double *pat_lh[NUM_NNI];
-    lh[0] = best_score;
-    pat_lh[0] = pattern_lh;
+    int nbranch = nodes1.size();
     int nptn = getAlnNPattern();
-    pat_lh[1] = new double[nptn];
-    pat_lh[2] = new double[nptn];
-    int tmp = save_all_trees;
-    save_all_trees = 0;
-    computeNNIPatternLh(best_score, lh[1], pat_lh[1], lh[2], pat_lh[2], node1, node2);
-    save_all_trees = tmp;
-    double aLRT;
-    if (lh[1] > lh[2])
-        aLRT = (lh[0] - lh[1]);
-    else
-        aLRT = (lh[0] - lh[2]);
+    int times = max(reps, lbp_reps);
+    SH_aLRT_support.resize(nbranch);
+    lbp_support.resize(nbranch);
+    aLRT_support.resize(nbranch);
+    aBayes_support.resize(nbranch);
+    if (nbranch == 0)
+        return;
 
-    // compute parametric aLRT test support
-    double aLRT_stat = 2*aLRT;
-    aLRT_support = 0.0;
-    if (aLRT_stat >= 0) {
-        aLRT_support = Statistics_To_Probabilities(aLRT_stat);
+    RELLScorer *rell = NULL;
+    if (times > 0) {
+        if (!params->bootstrap_spec && getAlnNSite() <= numeric_limits<unsigned short>::max())
+            rell = new RELLReplicates<unsigned short>(aln, nptn, params->bootstrap_spec, params->ran_seed, times);
+        else
+            rell = new RELLReplicates<int>(aln, nptn, params->bootstrap_spec, params->ran_seed, times);
     }
 
-    aBayes_support = 1.0 / (1.0 + exp(lh[1]-lh[0]) + exp(lh[2]-lh[0]));
+    // branches are scored in batches, bounded by the memory of their pattern log-likelihoods
+    int batch_size = min((size_t)nbranch, max((size_t)1, RELL_MAX_MEM / (sizeof(double)*2*nptn)));
+    batch_size = min(batch_size, 256);
+    double *batch_pat_lh = new double[(size_t)batch_size*2*nptn];
+    double *batch_lh = new double[(size_t)batch_size*NUM_NNI];
+    double *rell_lh = new double[(size_t)(batch_size*2+1)*times];
+    double **pat_lh = new double*[batch_size*2+1];
+    pat_lh[0] = pattern_lh;
 
-    int SH_aLRT_support = 0;
-    int lbp_support_int = 0;
+    for (int batch_begin = 0; batch_begin < nbranch; batch_begin += batch_size) {
+        int num_branch = min(batch_size, nbranch - batch_begin);
+        int b;
+        // the NNIs change the tree, so their pattern log-likelihoods are computed one branch after another
+        for (b = 0; b < num_branch; b++) {
+            double *lh = batch_lh + b*NUM_NNI;
+            pat_lh[b*2+1] = batch_pat_lh + (size_t)b*2*nptn;
+            pat_lh[b*2+2] = pat_lh[b*2+1] + nptn;
+            lh[0] = best_score;
+            int tmp = save_all_trees;
+            save_all_trees = 0;
+            computeNNIPatternLh(best_score, lh[1], pat_lh[b*2+1], lh[2], pat_lh[b*2+2],
+                (PhyloNode*)nodes1[batch_begin+b], (PhyloNode*)nodes2[batch_begin+b]);
+            save_all_trees = tmp;
+        }
+        if (rell)
+            rell->score(pat_lh, num_branch*2+1, rell_lh);
+
+        for (b = 0; b < num_branch; b++) {
+            double *lh = batch_lh + b*NUM_NNI;
+            int branch = batch_begin + b;
+            double aLRT;
+            if (lh[1] > lh[2])
+                aLRT = (lh[0] - lh[1]);
+            else
+                aLRT = (lh[0] - lh[2]);
 
-    int times = max(reps, lbp_reps);
+            // compute parametric aLRT test support
+            double aLRT_stat = 2*aLRT;
+            aLRT_support[branch] = 0.0;
+            if (aLRT_stat >= 0) {
+                aLRT_support[branch] = Statistics_To_Probabilities(aLRT_stat);
+            }
 
-    if (max(lh[1],lh[2]) == -DBL_MAX) {
-        SH_aLRT_support = times;
-        outWarning("Branch where both NNIs violate constraint tree will show 100% SH-aLRT support");
-    } else
-#ifdef _OPENMP
-#pragma omp parallel
-    {
-        int *rstream;
-        init_random(params->ran_seed + omp_get_thread_num(), false, &rstream);
-#pragma omp for reduction(+: lbp_support_int, SH_aLRT_support)
-#endif
-    for (int i = 0; i < times; i++) {
-        double lh_new[NUM_NNI];
-        // resampling estimated log-likelihood (RELL)
-#ifdef _OPENMP
-        resampleLh(pat_lh, lh_new, rstream);
-#else
-        resampleLh(pat_lh, lh_new, randstream);
-#endif
-        if (lh_new[0] > lh_new[1] && lh_new[0] > lh_new[2])
-            lbp_support_int++;
-        double cs[NUM_NNI], cs_best, cs_2nd_best;
-        cs[0] = lh_new[0] - lh[0];
-        cs[1] = lh_new[1] - lh[1];
-        cs[2] = lh_new[2] - lh[2];
-        if (cs[0] >= cs[1] && cs[0] >= cs[2]) {
-            cs_best = cs[0];
-            if (cs[1] > cs[2])
-                cs_2nd_best = cs[1];
-            else
-                cs_2nd_best = cs[2];
-        } else if (cs[1] >= cs[2]) {
-            cs_best = cs[1];
-            if (cs[0] > cs[2])
-                cs_2nd_best = cs[0];
-            else
-                cs_2nd_best = cs[2];
-        } else {
-            cs_best = cs[2];
-            if (cs[0] > cs[1])
-                cs_2nd_best = cs[0];
-            else
-                cs_2nd_best = cs[1];
+            aBayes_support[branch] = 1.0 / (1.0 + exp(lh[1]-lh[0]) + exp(lh[2]-lh[0]));
+
+            int SH_aLRT_support_int = 0;
+            int lbp_support_int = 0;
+
+            if (max(lh[1],lh[2]) == -DBL_MAX) {
+                SH_aLRT_support_int = times;
+                outWarning("Branch where both NNIs violate constraint tree will show 100% SH-aLRT support");
+            } else
+            for (int i = 0; i < times; i++) {
+                // resampling estimated log-likelihood (RELL)
+                double lh_new[NUM_NNI];
+                lh_new[0] = rell_lh[i];
+                lh_new[1] = rell_lh[(size_t)(b*2+1)*times + i];
+                lh_new[2] = rell_lh[(size_t)(b*2+2)*times + i];
+                if (lh_new[0] > lh_new[1] && lh_new[0] > lh_new[2])
+                    lbp_support_int++;
+                double cs[NUM_NNI], cs_best, cs_2nd_best;
+                cs[0] = lh_new[0] - lh[0];
+                cs[1] = lh_new[1] - lh[1];
+                cs[2] = lh_new[2] - lh[2];
+                if (cs[0] >= cs[1] && cs[0] >= cs[2]) {
+                    cs_best = cs[0];
+                    if (cs[1] > cs[2])
+                        cs_2nd_best = cs[1];
+                    else
+                        cs_2nd_best = cs[2];
+                } else if (cs[1] >= cs[2]) {
+                    cs_best = cs[1];
+                    if (cs[0] > cs[2])
+                        cs_2nd_best = cs[0];
+                    else
+                        cs_2nd_best = cs[2];
+                } else {
+                    cs_best = cs[2];
+                    if (cs[0] > cs[1])
+                        cs_2nd_best = cs[0];
+                    else
+                        cs_2nd_best = cs[1];
+                }
+                if (aLRT > (cs_best - cs_2nd_best) + 0.05)
+                    SH_aLRT_support_int++;
+            }
+
+            lbp_support[branch] = 0.0;
+            SH_aLRT_support[branch] = 0.0;
+            if (times > 0) {
+                lbp_support[branch] = ((double)lbp_support_int) / times;
+                SH_aLRT_support[branch] = ((double)SH_aLRT_support_int) / times;
+            }
         }
-        if (aLRT > (cs_best - cs_2nd_best) + 0.05)
-            SH_aLRT_support++;
-    }
-#ifdef _OPENMP
-    finish_random(rstream);
     }
-#endif
-    delete[] pat_lh[2];
-    delete[] pat_lh[1];
-    
-    lbp_support = 0.0;
-    if (times > 0)
-        lbp_support = ((double)lbp_support_int) / times;
 
-    if (times > 0)
-        return ((double) SH_aLRT_support) / times;
-    else
-        return 0.0;
+    delete [] pat_lh;
+    delete [] rell_lh;
+    delete [] batch_lh;
+    delete [] batch_pat_lh;
+    if (rell)
+        delete rell;
+}
+
+void PhyloTree::getTestBranches(NodeVector &nodes1, NodeVector &nodes2, PhyloNode *node, PhyloNode *dad) {
+    if (dad && !node->isLeaf() && !dad->isLeaf()) {
+        nodes1.push_back(node);
+        nodes2.push_back(dad);
+    }
+    FOR_NEIGHBOR_IT(node, dad, it)
+        getTestBranches(nodes1, nodes2, (PhyloNode*) (*it)->node, node);
 }
 
 int PhyloTree::testAllBranches(int threshold, double best_score, double *pattern_lh, int reps, int lbp_reps, bool aLRT_test, bool aBayes_test,
@@ -4631,10 +5096,16 @@ int PhyloTree::testAllBranches(int threshold, double best_score, double *pattern
 			save_all_trees = tmp;
         }
     }
-    if (dad && !node->isLeaf() && !dad->isLeaf()) {
-        double lbp_support, aLRT_support, aBayes_support;
-        double SH_aLRT_support = (testOneBranch(best_score, pattern_lh, reps, lbp_reps,
-            node, dad, lbp_support, aLRT_support, aBayes_support) * 100);
+    NodeVector nodes1, nodes2;
+    getTestBranches(nodes1, nodes2, node, dad);
+    DoubleVector SH_aLRT_supports, lbp_supports, aLRT_supports, aBayes_supports;
+    testBranches(best_score, pattern_lh, reps, lbp_reps, nodes1, nodes2,
+        SH_aLRT_supports, lbp_supports, aLRT_supports, aBayes_supports);
+
+    for (int i = 0; i < nodes1.size(); i++) {
+        PhyloNode *node = (PhyloNode*) nodes1[i];
+        PhyloNode *dad = (PhyloNode*) nodes2[i];
+        double SH_aLRT_support = SH_aLRT_supports[i] * 100;
         ostringstream ss;
         ss.precision(3);
         ss << node->name;
@@ -4643,21 +5114,19 @@ int PhyloTree::testAllBranches(int threshold, double best_score, double *pattern
         if (reps)
             ss << SH_aLRT_support;
         if (lbp_reps)
-            ss << "/" << lbp_support * 100;
+            ss << "/" << lbp_supports[i] * 100;
         if (aLRT_test)
-            ss << "/" << aLRT_support;
+            ss << "/" << aLRT_supports[i];
         if (aBayes_test)
-            ss << "/" << aBayes_support;
+            ss << "/" << aBayes_supports[i];
         node->name = ss.str();
         if (SH_aLRT_support < threshold)
-            num_low_support = 1;
+            num_low_support++;
         if (((PhyloNeighbor*) node->findNeighbor(dad))->partial_pars) {
 			((PhyloNeighbor*) node->findNeighbor(dad))->partial_pars[0] = round(SH_aLRT_support);
 			((PhyloNeighbor*) dad->findNeighbor(node))->partial_pars[0] = round(SH_aLRT_support);
         }
     }
-    FOR_NEIGHBOR_IT(node, dad, it)
-        num_low_support += testAllBranches(threshold, best_score, pattern_lh, reps, lbp_reps, aLRT_test, aBayes_test, (PhyloNode*) (*it)->node, node);
 
     return num_low_support;
 }
@@ -5140,25 +5609,50 @@ void PhyloTree::reorientPartialLh(PhyloNeighbor* dad_branch, Node *dad) {
         helper functions for computing tree traversal
  ****************************************************************************/
 
+int PhyloTree::computeTraversalLevels() {
+    int num_levels = 0;
+    for (int i = 0; i < traversal_info.size(); i++) {
+        PhyloNode *node = (PhyloNode*)traversal_info[i].dad_branch->node;
+        int level = 0;
+        // children outside traversal_info are already computed and have traversal_level 0
+        FOR_NEIGHBOR_IT(node, traversal_info[i].dad, it)
+            level = max(level, ((PhyloNeighbor*)*it)->traversal_level);
+        traversal_info[i].dad_branch->traversal_level = level+1;
+        if (level >= traversal_levels.size())
+            traversal_levels.resize(level+1);
+        if (level >= num_levels) {
+            traversal_levels[level].clear();
+            num_levels = level+1;
+        }
+        traversal_levels[level].push_back(i);
+    }
+    for (int i = 0; i < traversal_info.size(); i++)
+        traversal_info[i].dad_branch->traversal_level = 0;
+    return num_levels;
+}
+
 bool PhyloTree::computeTraversalInfo(PhyloNeighbor *dad_branch, PhyloNode *dad, double* &buffer) {
 
     size_t nstates = aln->num_states;
     PhyloNode *node = (PhyloNode*)dad_branch->node;
 
     if ((dad_branch->partial_lh_computed & 1) || node->isLeaf()) {
+        mem_slots.hit(dad_branch);
         return mem_slots.lock(dad_branch);
     }
 
 
     size_t num_leaves = 0;
-    bool locked[node->degree()];
-    memset(locked, 0, node->degree());
-
-    // sort neighbor in desceding size order
-    NeighborVec neivec = node->neighbors;
-    NeighborVec::iterator it, i2;
-    for (it = neivec.begin(); it != neivec.end(); it++)
-        for (i2 = it+1; i2 != neivec.end(); i2++)
+    int degree = node->degree();
+    bool locked[degree];
+    memset(locked, 0, degree);
+
+    // sort neighbor in desceding size order, copied on the stack as this is called for every branch
+    Neighbor *neivec[degree];
+    copy(node->neighbors.begin(), node->neighbors.end(), neivec);
+    Neighbor **it, **i2;
+    for (it = neivec; it != neivec+degree; it++)
+        for (i2 = it+1; i2 != neivec+degree; i2++)
             if (((PhyloNeighbor*)*it)->size < ((PhyloNeighbor*)*i2)->size) {
                 Neighbor *nei = *it;
                 *it = *i2;
@@ -5167,9 +5661,9 @@ bool PhyloTree::computeTraversalInfo(PhyloNeighbor *dad_branch, PhyloNode *dad,
 
 
     // recursive
-    for (it = neivec.begin(); it != neivec.end(); it++)
+    for (it = neivec; it != neivec+degree; it++)
         if ((*it)->node != dad) {
-            locked[it - neivec.begin()] = computeTraversalInfo((PhyloNeighbor*)(*it), node, buffer);
+            locked[it - neivec] = computeTraversalInfo((PhyloNeighbor*)(*it), node, buffer);
             if ((*it)->node->isLeaf())
                 num_leaves++;
         }
@@ -5225,9 +5719,9 @@ bool PhyloTree::computeTraversalInfo(PhyloNeighbor *dad_branch, PhyloNode *dad,
         }
 
     if (params->lh_mem_save == LM_MEM_SAVE) {
-        for (it = neivec.begin(); it != neivec.end(); it++)
+        for (it = neivec; it != neivec+degree; it++)
             if ((*it)->node != dad) {
-                if (!(*it)->node->isLeaf() && locked[it-neivec.begin()])
+                if (!(*it)->node->isLeaf() && locked[it-neivec])
                     mem_slots.unlock((PhyloNeighbor*)*it);
             }
     }
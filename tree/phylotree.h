@@ -50,6 +50,10 @@
 #define BootValType float
 //#define BootValType double
 
+/** integer type of compact UFBoot replicate counts (-bcompact), larger counts go to an overflow table */
+#define BootCountType uint8_t
+//#define BootCountType uint16_t
+
 //extern int instruction_set;
 
 #define SAFE_LH   true  // safe likelihood scaling to avoid numerical underflow for ultra large trees
@@ -75,6 +79,9 @@ const double TOL_LIKELIHOOD_PARAMOPT = 0.001; // BQM: newly introduced for Model
 
 const int SPR_DEPTH = 2;
 
+/** minimal number of patterns per thread of the likelihood kernel */
+const int MIN_PTN_PER_THREAD = 8;
+
 //using namespace Eigen;
 
 inline size_t get_safe_upper_limit(size_t cur_limit) {
@@ -567,6 +574,36 @@ public:
 
     double dotProductDoubleCall(double *x, double *y, int size);
 
+    /**
+        dot product of pattern log-likelihoods with compact integer replicate counts,
+        counts are widened to Numeric on the fly
+        @param x pattern log-likelihoods, aligned
+        @param y replicate counts
+        @param size number of patterns, padded to vector size
+    */
+    template <class Numeric, class VectorClass>
+    Numeric dotProductCountSIMD(Numeric *x, BootCountType *y, int size);
+
+    typedef BootValType (PhyloTree::*DotProductCountType)(BootValType *x, BootCountType *y, int size);
+    DotProductCountType dotProductCount;
+
+    /**
+        cache-blocked matrix product res = x * y, used to score many trees against all
+        bootstrap replicates at once
+        @param x nrows x size matrix of pattern log-likelihoods, row i starts at x + i*x_stride
+        @param nrows number of rows of x
+        @param x_stride distance between two consecutive rows of x
+        @param y size x ncols matrix of replicate weights stored pattern-major
+        @param ncols number of columns of y and res, must be a multiple of 16
+        @param size number of patterns
+        @param[out] res nrows x ncols result matrix, must be aligned like y
+    */
+    template <class Numeric, class VectorClass>
+    void matrixProductSIMD(Numeric *x, int nrows, size_t x_stride, Numeric *y, size_t ncols, size_t size, Numeric *res);
+
+    typedef void (PhyloTree::*MatrixProductType)(BootValType *x, int nrows, size_t x_stride, BootValType *y, size_t ncols, size_t size, BootValType *res);
+    MatrixProductType matrixProduct;
+
 #if defined(BINARY32) || defined(__NOAVX__)
     void setDotProductAVX() {}
     void setDotProductFMA() {}
@@ -656,6 +693,7 @@ public:
     virtual void setParsimonyKernelAVX() {}
 #else
     virtual void setParsimonyKernelAVX();
+    void setParsimonyKernelAVX512();
 #endif
 
     virtual void setParsimonyKernelSSE();
@@ -708,8 +746,39 @@ public:
 
     /** get the number of bytes occupied by partial_lh */
     size_t getPartialLhBytes();
+
+    /**
+        @return number of doubles occupied by one partial_lh vector,
+        fewer if partial likelihoods are stored in single precision
+    */
     size_t getPartialLhSize();
 
+    /**
+        @return true if partial likelihoods can be stored in single precision (-lhfloat)
+        for the current model and likelihood kernel
+    */
+    bool isPartialLhFloatSupported();
+
+    /**
+        switch partial likelihood storage back to double precision if single precision was used
+        and recompute the tree log-likelihood
+        @return the log-likelihood in double precision
+    */
+    double restorePartialLhDouble();
+
+    /**
+        store partial likelihoods of this tree in double precision from now on,
+        despite -lhfloat; takes effect at the next initializeAllPartialLh()
+    */
+    virtual void disablePartialLhFloat() {
+        partial_lh_float_disabled = true;
+    }
+
+    /** print hit/miss statistics of the partial likelihood slots in memory saving mode (-mem) */
+    void printPartialLhCacheStats(ostream &out) {
+        mem_slots.printStats(out);
+    }
+
     /**
             allocate memory for a scale num vector
      */
@@ -726,6 +795,9 @@ public:
     double *tip_partial_lh;
     bool tip_partial_lh_computed;
 
+    /** true if tip_partial_lh belongs to another tree with the same model object (see prepareWorkerTrees) */
+    bool tip_partial_lh_shared;
+
     bool ptn_freq_computed;
 
     /** vector size used by SIMD kernel */
@@ -734,9 +806,24 @@ public:
     /** true if using safe numeric for likelihood kernel */
     bool safe_numeric;
 
+    /** true if partial likelihoods of internal nodes are stored in single precision */
+    bool partial_lh_float;
+
+    /** true if restorePartialLhDouble() switched this tree back to double precision */
+    bool partial_lh_float_disabled;
+
+    /** per-thread buffers to expand single-precision partial likelihoods */
+    double *buffer_float_lh;
+
     /** number of threads used for likelihood kernel */
     int num_threads;
 
+    /**
+        number of threads the per-thread likelihood buffers are allocated for, if larger than num_threads;
+        PhyloSuperTree runs a partition with up to that many threads, see PhyloSuperTree::computePartitionGroups()
+    */
+    int max_num_threads;
+
 
     /****************************************************************************
             helper functions for computing tree traversal
@@ -757,6 +844,13 @@ public:
     template<class VectorClass>
     void computeTraversalInfo(PhyloNode *node, PhyloNode *dad, bool compute_partial_lh);
 
+    /**
+        group traversal_info into traversal_levels of independent partial likelihood updates:
+        an entry only depends on the entries of its child branches, which are in lower levels
+        @return number of levels, the first ones of traversal_levels
+    */
+    int computeTraversalLevels();
+
     /**
         precompute info for models
     */
@@ -1011,6 +1105,61 @@ public:
      */
     void computeAncestralState(PhyloNeighbor *dad_branch, PhyloNode *dad, int *C, int *ancestral_seqs);
 
+    /****************************************************************************
+            analytic gradient w.r.t. the rate matrix
+     ****************************************************************************/
+
+    /**
+        @return TRUE if computeRateMatrixGradient() can be used with the current model and kernel
+    */
+    bool isRateMatrixGradientSupported();
+
+    /**
+        compute the derivatives of the log-likelihood w.r.t. all entries of the rate matrix Q
+        of a reversible model in one pass over all branches, using the eigen-decomposition of Q.
+        The partial likelihoods must correspond to the current model parameters.
+        @param[out] df_dQ nstates*nstates matrix, df_dQ[x*nstates+y] = d(log-likelihood)/d(Q[x][y])
+        @return FALSE if not supported (see isRateMatrixGradientSupported()), TRUE otherwise
+    */
+    bool computeRateMatrixGradient(double *df_dQ);
+
+    /**
+        accumulate the contribution of one branch to the rate matrix gradient in eigen space
+        @param dad_branch branch leading to node
+        @param dad dad of node
+        @param[in,out] grad_eigen nstates*nstates matrix of the gradient in eigen space
+        @param buffer workspace of ncat*(nstates+2) + num_threads*ncat*(nstates*nstates+1) doubles
+    */
+    void computeRateMatrixGradientBranch(PhyloNeighbor *dad_branch, PhyloNode *dad, double *grad_eigen, double *buffer);
+
+    /****************************************************************************
+            concurrent likelihood evaluation of perturbed model parameters
+     ****************************************************************************/
+
+    /**
+        copies of this tree with their own partial likelihoods and their own copy of either the
+        substitution model or the rate heterogeneity, used to evaluate finite differences of
+        model parameters concurrently
+    */
+    vector<PhyloTree*> worker_trees;
+
+    /**
+        create worker_trees with the current tree and model parameters, once per optimization:
+        the copies are kept until deleteWorkerTrees(), as the optimized object sets all its
+        parameters in every targetFunk(). There is one single-threaded copy per thread, used only
+        if max_num is at least the number of threads, outside of other parallel regions, not in
+        memory saving mode, and if the partial likelihoods of all copies fit into the RAM left by this tree.
+        @param max_num maximal number of copies needed
+        @param share_model true if the copies optimize the rate heterogeneity and share the substitution
+               model object of this tree and its tip_partial_lh, false if they optimize the substitution
+               model and share the rate heterogeneity object of this tree
+        @return number of copies ready in worker_trees, 0 if concurrent evaluation is not possible
+    */
+    int prepareWorkerTrees(int max_num, bool share_model);
+
+    /** free worker_trees at the end of an optimization */
+    void deleteWorkerTrees();
+
     /**
             compute pattern likelihoods only if the accumulated scaling factor is non-zero.
             Otherwise, copy the pattern_lh attribute
@@ -1250,14 +1399,31 @@ public:
      */
     int addTaxonMPFast(Node *added_taxon, Node *added_node, Node *node, Node *dad);
 
+    /**
+            parallel version of addTaxonMPFast() over all candidate branches, used by computeParsimonyTree()
+            with several threads. Each thread attaches the taxon via its own private internal node to the
+            two ends of a branch, so that the tree itself is not modified
+            @param added_taxon taxon to add
+            @param nodes1 one end of the candidate branches
+            @param nodes2 other end of the candidate branches
+            @return index of the first branch with the best parsimony score, which is stored in best_pars_score
+     */
+    int addTaxonMPParallel(Node *added_taxon, NodeVector &nodes1, NodeVector &nodes2);
+
+    /**
+            compute all missing partial parsimony vectors, in parallel over the nodes of the same depth
+     */
+    void computeAllPartialParsParallel();
+
 
     /**
      * FAST VERSION: compute parsimony tree by step-wise addition
      * @param out_prefix prefix for .parstree file
      * @param alignment input alignment
+     * @param rstream random number generator stream for the addition order, NULL for the global stream
      * @return parsimony score
      */
-    int computeParsimonyTree(const char *out_prefix, Alignment *alignment);
+    int computeParsimonyTree(const char *out_prefix, Alignment *alignment, int *rstream = NULL);
 
 
     /****************************************************************************
@@ -1400,6 +1566,9 @@ public:
 
     vector<TraversalInfo> traversal_info;
 
+    /** entry IDs of traversal_info for each level, reused by computeTraversalLevels() */
+    vector<IntVector> traversal_levels;
+
 
     /****************************************************************************
             Nearest Neighbor Interchange by maximum likelihood
@@ -1511,6 +1680,13 @@ public:
 
     virtual double computeDist(int seq1, int seq2, double initial_dist);
 
+    /**
+            @param dist distance between two sequences
+            @param d2l second derivative of the log-likelihood at dist, from computeDist()
+            @return variance of dist according to params->ls_var_type
+     */
+    double computeDistVar(double dist, double d2l);
+
     /**
             compute distance and variance matrix, assume dist_mat and var_mat are allocated by memory of size num_seqs * num_seqs.
             @param dist_mat (OUT) distance matrix between all pairs of sequences in the alignment
@@ -1546,6 +1722,47 @@ public:
      */
     double computeObsDist(Params &params, Alignment *alignment, double* &dist_mat, string &dist_file);
 
+    /**
+            compute distance matrix into condensed_dist (and variances into condensed_var if not OLS),
+            memory-mapped to the binary distance file. Replaces the previous condensed matrices.
+            @param params program parameters
+            @param alignment input alignment
+            @param dist_file (OUT) name of the distance file
+            @return the longest distance
+     */
+    double computeCondensedDist(Params &params, Alignment *alignment, string &dist_file);
+
+    /**
+            @return distance between taxa i and j, from dist_matrix or condensed_dist
+     */
+    inline double getDist(int i, int j) {
+        if (dist_matrix)
+            return dist_matrix[i * aln->getNSeq() + j];
+        ASSERT(condensed_dist);
+        return condensed_dist->get(i, j);
+    }
+
+    /**
+            @return variance of the distance between taxa i and j, from var_matrix or condensed_var
+     */
+    inline double getDistVar(int i, int j) {
+        if (var_matrix)
+            return var_matrix[i * aln->getNSeq() + j];
+        if (condensed_var)
+            return condensed_var->get(i, j);
+        return 1.0;
+    }
+
+    /**
+            set variance of the distance between taxa i and j in var_matrix or condensed_var
+     */
+    inline void setDistVar(int i, int j, double var) {
+        if (var_matrix)
+            var_matrix[i * aln->getNSeq() + j] = var;
+        else if (condensed_var)
+            condensed_var->set(i, j, var);
+    }
+
     /**
             correct the distances to follow metric property of triangle inequalities.
             Using the Floyd alogrithm.
@@ -1674,17 +1891,23 @@ public:
             PhyloNode *node1, PhyloNode *node2);
 
     /**
-            Resampling estimated log-likelihood (RELL)
+            Test branches with aLRT SH-like interpretation. The RELL replicates are drawn
+            once and shared by all branches, whose NNI pattern log-likelihoods are scored
+            against them in batches
+            @param nodes1, nodes2 the branches to test
+            @param[out] SH_aLRT_support, lbp_support, aLRT_support, aBayes_support supports of the branches
      */
-    void resampleLh(double **pat_lh, double *lh_new, int *rstream);
+    void testBranches(double best_score, double *pattern_lh,
+            int reps, int lbp_reps,
+            NodeVector &nodes1, NodeVector &nodes2, DoubleVector &SH_aLRT_support,
+            DoubleVector &lbp_support, DoubleVector &aLRT_support, DoubleVector &aBayes_support);
 
     /**
-            Test one branch of the tree with aLRT SH-like interpretation
+            get the internal branches below node in the order they are labeled by testAllBranches
+            @param[out] nodes1 the node below each branch, which gets the support label
+            @param[out] nodes2 the node above each branch
      */
-    double testOneBranch(double best_score, double *pattern_lh, 
-            int reps, int lbp_reps,
-            PhyloNode *node1, PhyloNode *node2, 
-            double &lbp_support, double &aLRT_support, double &aBayes_support);
+    void getTestBranches(NodeVector &nodes1, NodeVector &nodes2, PhyloNode *node, PhyloNode *dad);
 
     /**
             Test all branches of the tree with aLRT SH-like interpretation
@@ -1796,6 +2019,16 @@ public:
      */
     double *var_matrix;
 
+    /**
+     * Condensed distance matrix, used instead of dist_matrix with -dbin
+     */
+    CondensedDistMatrix *condensed_dist;
+
+    /**
+     * Condensed variance matrix, used instead of var_matrix with -dbin
+     */
+    CondensedDistMatrix *condensed_var;
+
     /** distance matrix file */
     string dist_file;
     
@@ -2154,7 +2387,12 @@ protected:
      */
     UINT *newBitsBlock();
 
-    virtual void saveCurrentTree(double logl) {
+    /**
+        save the current tree, e.g. for ultrafast bootstrap
+        @param logl log-likelihood of the current tree
+        @param ptn_lh pattern log-likelihoods of the current tree if already computed, NULL otherwise
+     */
+    virtual void saveCurrentTree(double logl, double *ptn_lh = NULL) {
     } // save current tree
 
 
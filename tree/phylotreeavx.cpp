@@ -32,8 +32,12 @@ void PhyloTree::setParsimonyKernelAVX() {
 void PhyloTree::setDotProductAVX() {
 #ifdef BOOT_VAL_FLOAT
 		dotProduct = &PhyloTree::dotProductSIMD<float, Vec8f>;
+		matrixProduct = &PhyloTree::matrixProductSIMD<float, Vec8f>;
+		dotProductCount = &PhyloTree::dotProductCountSIMD<float, Vec8f>;
 #else
 		dotProduct = &PhyloTree::dotProductSIMD<double, Vec4d>;
+		matrixProduct = &PhyloTree::matrixProductSIMD<double, Vec4d>;
+		dotProductCount = &PhyloTree::dotProductCountSIMD<double, Vec4d>;
 #endif
         dotProductDouble = &PhyloTree::dotProductSIMD<double, Vec4d>;
 }
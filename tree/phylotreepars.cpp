@@ -11,6 +11,10 @@
 //#include "vectorclass/vectorclass.h"
 #include "phylosupertree.h"
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #if defined (__GNUC__) || defined(__clang__)
 #define vml_popcnt __builtin_popcount
 #else
@@ -323,7 +327,7 @@ void PhyloTree::computeAllPartialPars(PhyloNode *node, PhyloNode *dad) {
 // pointer object to it:
 //ptrdiff_t (*p_myrandom)(ptrdiff_t) = myrandom;
 
-int PhyloTree::computeParsimonyTree(const char *out_prefix, Alignment *alignment) {
+int PhyloTree::computeParsimonyTree(const char *out_prefix, Alignment *alignment, int *rstream) {
     aln = alignment;
     int size = aln->getNSeq();
     if (size < 3)
@@ -338,7 +342,7 @@ int PhyloTree::computeParsimonyTree(const char *out_prefix, Alignment *alignment
         for (int i = 0; i < size; i++)
             taxon_order[i] = i;
         // randomize the addition order
-        my_random_shuffle(taxon_order.begin(), taxon_order.end());
+        my_random_shuffle(taxon_order.begin(), taxon_order.end(), rstream);
 
         root = newNode(size);
 
@@ -385,8 +389,8 @@ int PhyloTree::computeParsimonyTree(const char *out_prefix, Alignment *alignment
                 taxon_order.push_back(i);
             }
         // randomize the addition order
-        my_random_shuffle(taxon_order.begin()+leafNum, taxon_order.begin()+constraintTree.leafNum);
-        my_random_shuffle(taxon_order.begin()+constraintTree.leafNum, taxon_order.end());
+        my_random_shuffle(taxon_order.begin()+leafNum, taxon_order.begin()+constraintTree.leafNum, rstream);
+        my_random_shuffle(taxon_order.begin()+constraintTree.leafNum, taxon_order.end(), rstream);
 
     }
     root = findNodeID(taxon_order[0]);
@@ -426,6 +430,17 @@ int PhyloTree::computeParsimonyTree(const char *out_prefix, Alignment *alignment
         added_node->addNeighbor((Node*) 1, -1.0);
         added_node->addNeighbor((Node*) 2, -1.0);
 
+#ifdef _OPENMP
+        // constraint compatibility is checked on the modified tree, thus sequentially
+        if (num_threads > 1 && !omp_in_parallel() && leafNum >= constraintTree.leafNum) {
+            int nodeid = addTaxonMPParallel(new_taxon, nodes1, nodes2);
+            target_node = (PhyloNode*)nodes1[nodeid];
+            target_dad = (PhyloNode*)nodes2[nodeid];
+            // partial parsimony of the new internal node towards the taxon
+            addTaxonMPFast(new_taxon, added_node, target_node, target_dad);
+            memcpy(new_taxon_partial_pars, tmp_partial_pars, pars_block_size*sizeof(UINT));
+        } else
+#endif
         for (int nodeid = 0; nodeid < nodes1.size(); nodeid++) {
         
             int score = addTaxonMPFast(new_taxon, added_node, nodes1[nodeid], nodes2[nodeid]);
@@ -489,6 +504,113 @@ int PhyloTree::computeParsimonyTree(const char *out_prefix, Alignment *alignment
     return best_pars_score;
 }
 
+int PhyloTree::addTaxonMPParallel(Node *added_taxon, NodeVector &nodes1, NodeVector &nodes2) {
+    computeAllPartialParsParallel();
+    int nbranches = nodes1.size();
+    int best_branch = nbranches;
+    best_pars_score = INT_MAX;
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(num_threads)
+#endif
+    {
+        // private copy of the taxon and an internal node joining it with the two ends of a branch
+        PhyloNode *taxon = new PhyloNode(added_taxon->id, added_taxon->name.c_str());
+        PhyloNode *node = new PhyloNode();
+        node->addNeighbor(taxon, -1.0);
+        taxon->addNeighbor(node, -1.0);
+        node->addNeighbor(nodes1[0], -1.0);
+        node->addNeighbor(nodes2[0], -1.0);
+        PhyloNeighbor *taxon_nei = (PhyloNeighbor*)node->neighbors[0];
+        PhyloNeighbor *node_nei = (PhyloNeighbor*)taxon->neighbors[0];
+        taxon_nei->partial_pars = newBitsBlock();
+        node_nei->partial_pars = newBitsBlock();
+        int thread_score = INT_MAX;
+        int thread_branch = nbranches;
+
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+        for (int branch = 0; branch < nbranches; branch++) {
+            for (int i = 1; i <= 2; i++) {
+                PhyloNeighbor *nei = (PhyloNeighbor*)node->neighbors[i];
+                nei->node = (i == 1) ? nodes1[branch] : nodes2[branch];
+                nei->partial_pars = ((PhyloNeighbor*)((i == 1) ? nodes2[branch] : nodes1[branch])->findNeighbor(nei->node))->partial_pars;
+                nei->partial_lh_computed = 2;
+            }
+            node_nei->clearPartialLh();
+            int score = computeParsimonyBranch(taxon_nei, node);
+            // iterations of a thread are increasing, thus the first best branch is kept
+            if (score < thread_score) {
+                thread_score = score;
+                thread_branch = branch;
+            }
+        }
+
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+        if (thread_score < best_pars_score || (thread_score == best_pars_score && thread_branch < best_branch)) {
+            best_pars_score = thread_score;
+            best_branch = thread_branch;
+        }
+
+        aligned_free(node_nei->partial_pars);
+        aligned_free(taxon_nei->partial_pars);
+        delete node;
+        delete taxon;
+    }
+    ASSERT(best_branch < nbranches);
+    return best_branch;
+}
+
+void PhyloTree::computeAllPartialParsParallel() {
+    // nodes of each depth below the root, with their parents
+    vector<NodeVector> level_nodes, level_dads;
+    level_nodes.push_back(NodeVector(1, root->neighbors[0]->node));
+    level_dads.push_back(NodeVector(1, root));
+    while (true) {
+        NodeVector &nodes = level_nodes.back();
+        NodeVector &dads = level_dads.back();
+        NodeVector next_nodes, next_dads;
+        for (int i = 0; i < nodes.size(); i++)
+            FOR_NEIGHBOR_IT(nodes[i], dads[i], it) {
+                next_nodes.push_back((*it)->node);
+                next_dads.push_back(nodes[i]);
+            }
+        if (next_nodes.empty())
+            break;
+        level_nodes.push_back(next_nodes);
+        level_dads.push_back(next_dads);
+    }
+    int level, nlevels = level_nodes.size();
+
+    // first partial parsimony of the subtrees, deepest level first, then of the rest of the tree
+    for (int pass = 0; pass < 2; pass++)
+        for (int l = 0; l < nlevels; l++) {
+            level = (pass == 0) ? nlevels-1-l : l;
+            NodeVector &nodes = level_nodes[level];
+            NodeVector &dads = level_dads[level];
+            int nnodes = nodes.size();
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) num_threads(num_threads) if(nnodes >= 2*num_threads)
+#endif
+            for (int i = 0; i < nnodes; i++) {
+                PhyloNeighbor *nei;
+                PhyloNode *dad;
+                if (pass == 0) {
+                    nei = (PhyloNeighbor*)dads[i]->findNeighbor(nodes[i]);
+                    dad = (PhyloNode*)dads[i];
+                } else {
+                    nei = (PhyloNeighbor*)nodes[i]->findNeighbor(dads[i]);
+                    dad = (PhyloNode*)nodes[i];
+                }
+                if ((nei->partial_lh_computed & 2) == 0)
+                    computePartialParsimony(nei, dad);
+            }
+        }
+}
+
 int PhyloTree::addTaxonMPFast(Node *added_taxon, Node* added_node, Node* node, Node* dad) {
     Neighbor *dad_nei = dad->findNeighbor(node);
 
@@ -41,10 +41,10 @@
 //#define USING_SSE
 
 void PhyloTree::setNumThreads(int num_threads) {
-    if (!isSuperTree() && aln && num_threads > 1 && num_threads > aln->getNPattern()/8) {
+    if (!isSuperTree() && aln && num_threads > 1 && num_threads > aln->getNPattern()/MIN_PTN_PER_THREAD) {
         outWarning(convertIntToString(num_threads) + " threads for alignment length " +
                    convertIntToString(aln->getNPattern()) + " will slow down analysis");
-        num_threads = max(aln->getNPattern()/8,1);
+        num_threads = max(aln->getNPattern()/MIN_PTN_PER_THREAD,1);
     }
     this->num_threads = num_threads;
 }
@@ -56,6 +56,12 @@ void PhyloTree::setParsimonyKernel(LikelihoodKernel lk) {
         computePartialParsimonyPointer = &PhyloTree::computePartialParsimonyFast;
     	return;
     }
+#ifdef __AVX512KNL
+    if (lk >= LK_AVX512) {
+        setParsimonyKernelAVX512();
+        return;
+    }
+#endif
     if (lk >= LK_AVX) {
         setParsimonyKernelAVX();
         return;
@@ -336,6 +342,10 @@ void PhyloTree::computeTipPartialLikelihood() {
 	// for +I model
 	computePtnInvar();
 
+    // computed by the tree that owns them
+    if (tip_partial_lh_shared)
+        return;
+
     if (getModel()->isSiteSpecificModel()) {
 //        ModelSet *models = (ModelSet*)model;
         size_t nptn = aln->getNPattern(), max_nptn = ((nptn+vector_size-1)/vector_size)*vector_size, tip_block_size = max_nptn * aln->num_states;
@@ -1969,3 +1979,201 @@ void PhyloTree::computeAncestralState(PhyloNeighbor *dad_branch, PhyloNode *dad,
 
 
 
+/****************************************************************************
+        analytic gradient w.r.t. the rate matrix
+ ****************************************************************************/
+
+bool PhyloTree::isRateMatrixGradientSupported() {
+    return model && model->isReversible() && !model->isMixture() && !model->isSiteSpecificModel() &&
+        sse >= LK_SSE2 && !params->kernel_nonrev && !isMixlen() && !isSuperTree() &&
+        model_factory->unobserved_ptns.empty() && !partial_lh_float && leafNum >= 3;
+}
+
+bool PhyloTree::computeRateMatrixGradient(double *df_dQ) {
+    if (!isRateMatrixGradientSupported())
+        return false;
+
+    size_t nstates = aln->num_states;
+    size_t nstatesqr = nstates*nstates;
+    size_t i, j, x, y;
+    double *evec = model->getEigenvectors();
+    double *inv_evec = model->getInverseEigenvectors();
+    double *grad_eigen = new double[nstatesqr];
+    memset(grad_eigen, 0, sizeof(double)*nstatesqr);
+
+    // workspace of computeRateMatrixGradientBranch, shared by all branches
+    size_t ncat = site_rate->getNRate();
+    double *buffer = new double[ncat*(2 + nstates) + num_threads*ncat*(nstatesqr + 1)];
+
+    // visit branches in pre-order so that at most one partial likelihood is recomputed per branch
+    NodeVector nodes, nodes2;
+    computeBestTraversal(nodes, nodes2);
+    for (i = 0; i < nodes.size(); i++) {
+        PhyloNeighbor *nei = (PhyloNeighbor*)nodes[i]->findNeighbor(nodes2[i]);
+        computeRateMatrixGradientBranch(nei, (PhyloNode*)nodes[i], grad_eigen, buffer);
+    }
+    delete [] buffer;
+
+    // transform back from eigen space: df_dQ = U^{-T} * grad_eigen * U^T
+    double *tmp = new double[nstatesqr];
+    for (x = 0; x < nstates; x++)
+        for (j = 0; j < nstates; j++) {
+            double sum = 0.0;
+            for (i = 0; i < nstates; i++)
+                sum += inv_evec[i*nstates+x] * grad_eigen[i*nstates+j];
+            tmp[x*nstates+j] = sum;
+        }
+    for (x = 0; x < nstates; x++)
+        for (y = 0; y < nstates; y++) {
+            double sum = 0.0;
+            for (j = 0; j < nstates; j++)
+                sum += tmp[x*nstates+j] * evec[y*nstates+j];
+            df_dQ[x*nstates+y] = sum;
+        }
+
+    delete [] tmp;
+    delete [] grad_eigen;
+    return true;
+}
+
+void PhyloTree::computeRateMatrixGradientBranch(PhyloNeighbor *dad_branch, PhyloNode *dad, double *grad_eigen, double *buffer) {
+    // make sure that partial likelihoods on both sides of the branch are computed
+    computeLikelihoodBranch(dad_branch, dad);
+
+    PhyloNode *node = (PhyloNode*)dad_branch->node;
+    PhyloNeighbor *node_branch = (PhyloNeighbor*)node->findNeighbor(dad);
+    if (node->isLeaf()) {
+        // as in the likelihood kernel, the tip (if any) is dad
+        PhyloNode *tmp_node = dad;
+        dad = node;
+        node = tmp_node;
+        PhyloNeighbor *tmp_nei = dad_branch;
+        dad_branch = node_branch;
+        node_branch = tmp_nei;
+    }
+
+    size_t nstates = aln->num_states;
+    size_t nstatesqr = nstates*nstates;
+    size_t ncat = site_rate->getNRate();
+    size_t block = ncat * nstates;
+    size_t nptn = aln->size();
+    size_t c, i, j;
+    double *eval = model->getEigenvalues();
+
+    // val[c*nstates+i] = prop_c * exp(eval_i * rate_c * length), exactly as in the kernel
+    double *cat_length = buffer;
+    double *cat_prop = cat_length + ncat;
+    double *val = cat_prop + ncat;
+    for (c = 0; c < ncat; c++) {
+        cat_length[c] = site_rate->getRate(c) * dad_branch->length;
+        cat_prop[c] = site_rate->getProp(c);
+        for (i = 0; i < nstates; i++)
+            val[c*nstates+i] = exp(eval[i]*cat_length[c]) * cat_prop[c];
+    }
+
+    // per category: sum over patterns of freq/lh * outer product of the two partial likelihood vectors
+    size_t outer_size = ncat*nstatesqr;
+    double *outer = val + block;
+    memset(outer, 0, sizeof(double)*outer_size*num_threads);
+    double *cat_scales = outer + outer_size*num_threads;
+
+#ifdef _OPENMP
+#pragma omp parallel for private(c, i, j) schedule(static, 1) num_threads(num_threads)
+#endif
+    for (int thread_id = 0; thread_id < num_threads; thread_id++) {
+        size_t ptn_lower = nptn*thread_id/num_threads;
+        size_t ptn_upper = nptn*(thread_id+1)/num_threads;
+        double *this_outer = outer + thread_id*outer_size;
+        double *cat_scale = cat_scales + thread_id*ncat;
+
+        for (size_t ptn = ptn_lower; ptn < ptn_upper; ptn++) {
+            // partial likelihoods are interleaved over vector_size patterns
+            size_t ptn_vec = (ptn/vector_size)*vector_size;
+            double *lh_dad = dad_branch->partial_lh + ptn_vec*block + (ptn-ptn_vec);
+            double *lh_node;
+            size_t node_stride, node_cat_stride;
+            if (dad->isLeaf()) {
+                lh_node = tip_partial_lh + (aln->at(ptn))[dad->id]*nstates;
+                node_stride = 1;
+                node_cat_stride = 0;
+            } else {
+                lh_node = node_branch->partial_lh + ptn_vec*block + (ptn-ptn_vec);
+                node_stride = vector_size;
+                node_cat_stride = nstates*vector_size;
+            }
+
+            // relative scaling between categories, only for per-category scaling
+            if (safe_numeric) {
+                UBYTE *scale_dad = dad_branch->scale_num + ptn*ncat;
+                UBYTE *scale_node = dad->isLeaf() ? NULL : node_branch->scale_num + ptn*ncat;
+                int min_scale = INT_MAX;
+                for (c = 0; c < ncat; c++) {
+                    cat_scale[c] = scale_dad[c] + (scale_node ? scale_node[c] : 0);
+                    min_scale = min(min_scale, (int)cat_scale[c]);
+                }
+                for (c = 0; c < ncat; c++) {
+                    if (cat_scale[c] == min_scale)
+                        cat_scale[c] = 1.0;
+                    else if (cat_scale[c] == min_scale+1)
+                        cat_scale[c] = SCALING_THRESHOLD;
+                    else
+                        cat_scale[c] = 0.0;
+                }
+            } else {
+                for (c = 0; c < ncat; c++)
+                    cat_scale[c] = 1.0;
+            }
+
+            double lh_ptn = 0.0;
+            for (c = 0; c < ncat; c++) {
+                double lh_cat = 0.0;
+                double *this_val = val + c*nstates;
+                double *this_lh_dad = lh_dad + c*nstates*vector_size;
+                double *this_lh_node = lh_node + c*node_cat_stride;
+                for (i = 0; i < nstates; i++)
+                    lh_cat += this_val[i] * this_lh_dad[i*vector_size] * this_lh_node[i*node_stride];
+                lh_ptn += lh_cat * cat_scale[c];
+            }
+            // invariant sites are added to the scaled likelihood, as in the kernel
+            lh_ptn = fabs(lh_ptn) + ptn_invar[ptn];
+            if (lh_ptn <= 0.0)
+                continue;
+            double weight = ptn_freq[ptn] / lh_ptn;
+
+            for (c = 0; c < ncat; c++) {
+                if (cat_scale[c] == 0.0)
+                    continue;
+                double *this_lh_dad = lh_dad + c*nstates*vector_size;
+                double *this_lh_node = lh_node + c*node_cat_stride;
+                double *this_outer_cat = this_outer + c*nstatesqr;
+                double weight_cat = weight * cat_scale[c];
+                for (i = 0; i < nstates; i++) {
+                    double lh_dad_i = weight_cat * this_lh_dad[i*vector_size];
+                    double *row = this_outer_cat + i*nstates;
+                    for (j = 0; j < nstates; j++)
+                        row[j] += lh_dad_i * this_lh_node[j*node_stride];
+                }
+            }
+        }
+    }
+
+    for (int thread_id = 1; thread_id < num_threads; thread_id++) {
+        double *this_outer = outer + thread_id*outer_size;
+        for (i = 0; i < outer_size; i++)
+            outer[i] += this_outer[i];
+    }
+
+    // d exp(Q*t)/d theta in eigen space is the Hadamard product of
+    // U^-1 * dQ/d theta * U with the divided differences of exp(eval*t)
+    for (c = 0; c < ncat; c++) {
+        double len = cat_length[c];
+        double *this_outer = outer + c*nstatesqr;
+        for (i = 0; i < nstates; i++)
+            for (j = 0; j < nstates; j++) {
+                double diff = eval[i] - eval[j];
+                double exp_j = exp(eval[j]*len);
+                double div_diff = (diff == 0.0) ? len*exp_j : exp_j*expm1(diff*len)/diff;
+                grad_eigen[i*nstates+j] += cat_prop[c] * div_diff * this_outer[i*nstates+j];
+            }
+    }
+}
@@ -0,0 +1,304 @@
+/***************************************************************************
+ *   Copyright (C) 2009-2019 by                                            *
+ *   BUI Quang Minh <minh.bui@univie.ac.at>                                *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "bionjmatrix.h"
+#include "vectorclass/vectorclass.h"
+#include <limits>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/** minimum number of clusters to scan Q in parallel */
+const int BIONJ_MIN_PARALLEL = 512;
+
+void BioNjMatrix::create(double *dist_mat, StrVector &names, ostream &out) {
+    n = names.size();
+    ASSERT(n >= 3);
+
+    // symmetrize the matrix
+    delta.resize((size_t)n*(n-1)/2);
+    int i, j;
+#ifdef _OPENMP
+#pragma omp parallel for private(j) schedule(dynamic, 64)
+#endif
+    for (i = 0; i < n; i++) {
+        float *row = &delta[0] + index(i, i+1);
+        for (j = i+1; j < n; j++)
+            row[j-i-1] = ((float)dist_mat[(size_t)i*n + j] + (float)dist_mat[(size_t)j*n + i]) / 2;
+    }
+    build(names, out);
+}
+
+void BioNjMatrix::create(CondensedDistMatrix &dist_mat, ostream &out) {
+    n = dist_mat.getNTaxa();
+    ASSERT(n >= 3);
+
+    // same layout, but BIONJ overwrites the distances of agglomerated clusters, while the
+    // tree search still needs the original ones. Hence a copy in RAM, also of a memory-mapped
+    // matrix: working on a private mapping would end up with the same dirty pages
+    delta.resize((size_t)n*(n-1)/2);
+    int i, j;
+#ifdef _OPENMP
+#pragma omp parallel for private(j) schedule(dynamic, 64)
+#endif
+    for (i = 0; i < n; i++) {
+        float *row = &delta[0] + index(i, i+1);
+        for (j = i+1; j < n; j++)
+            row[j-i-1] = dist_mat.get(i, j);
+    }
+    build(dist_mat.getNames(), out);
+}
+
+void BioNjMatrix::build(StrVector &names, ostream &out) {
+    const float inf = numeric_limits<float>::infinity();
+    // the variances are initialized as the distances
+    var_offset.assign(n, 0.0);
+    sum_dist.resize(n);
+    row_min.resize(n);
+    int i, j;
+#ifdef _OPENMP
+#pragma omp parallel for private(j)
+#endif
+    for (i = 0; i < n; i++) {
+        float row_dist = inf;
+        for (j = i+1; j < n; j++)
+            row_dist = min(row_dist, delta[index(i, j)]);
+        row_min[i] = row_dist;
+    }
+#ifdef _OPENMP
+#pragma omp parallel for private(j)
+#endif
+    for (i = 0; i < n; i++) {
+        double sum = 0.0;
+        for (j = 0; j < n; j++)
+            if (j != i)
+                sum += distance(i, j);
+        sum_dist[i] = sum;
+    }
+
+    removed.assign(n, false);
+    cluster.resize(n);
+    for (i = 0; i < n; i++)
+        cluster[i] = i;
+    child1.clear();
+    child2.clear();
+    length1.clear();
+    length2.clear();
+
+    for (int r = n; r > 3; r--) {
+        int a, b;
+        findBestPair(r, a, b);
+        agglomerate(a, b, r);
+    }
+
+    // join the last three subtrees
+    int last[3];
+    for (i = 0, j = 0; i < n; i++)
+        if (!removed[i])
+            last[j++] = i;
+    ASSERT(j == 3);
+    out.precision(8);
+    out << fixed << "(";
+    for (i = 0; i < 3; i++) {
+        int k1 = last[(i+1)%3], k2 = last[(i+2)%3];
+        double length = 0.5*(distance(last[i], k1) + distance(last[i], k2) - distance(k1, k2));
+        if (i > 0)
+            out << ",";
+        printSubtree(out, names, cluster[last[i]]);
+        out << ":" << length;
+    }
+    out << ");" << endl;
+}
+
+void BioNjMatrix::findBestPair(int r, int &a, int &b) {
+    const float inf = numeric_limits<float>::infinity();
+    const float rr = r - 2;
+
+    // single precision sums for the vectorized scan
+    vector<float> sums(n, 0.0);
+    float max_sum = -inf;
+    for (int i = 0; i < n; i++)
+        if (!removed[i]) {
+            sums[i] = sum_dist[i];
+            max_sum = max(max_sum, sums[i]);
+        }
+
+    // lower bound of Q in each row: rows are scanned in increasing order of
+    // their bound and skipped once the bound exceeds the best Q found
+    vector<pair<float,int> > rows;
+    rows.reserve(r);
+    for (int i = 0; i < n-1; i++)
+        if (!removed[i])
+            rows.push_back(make_pair(rr*row_min[i] - max_sum - sums[i], i));
+    sort(rows.begin(), rows.end());
+
+    float best_q = inf;
+    int best_i = -1, best_j = -1;
+    int nrows = rows.size();
+
+#ifdef _OPENMP
+#pragma omp parallel if(r >= BIONJ_MIN_PARALLEL)
+#endif
+    {
+        float thread_q = inf;
+        int thread_i = -1, thread_j = -1;
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 16)
+#endif
+        for (int k = 0; k < nrows; k++) {
+            if (rows[k].first > thread_q)
+                continue;
+            int i = rows[k].second;
+            // columns j > i of row i, and their sums
+            int len = n-i-1;
+            float *row = &delta[0] + index(i, i+1);
+            float *row_sums = &sums[i+1];
+            Vec4f vec_rr(rr), vec_id(0.0, 1.0, 2.0, 3.0);
+            Vec4f min_q(inf), min_id(0.0), min_dist(inf);
+            int j;
+            for (j = 0; j+4 <= len; j += 4) {
+                Vec4f dist, sum;
+                dist.load(row + j);
+                sum.load(row_sums + j);
+                Vec4f q = vec_rr*dist - sum;
+                Vec4fb smaller = q < min_q;
+                min_q = select(smaller, q, min_q);
+                min_id = select(smaller, vec_id, min_id);
+                min_dist = min(min_dist, dist);
+                vec_id += 4.0;
+            }
+            float lane_q[4], lane_id[4], lane_dist[4];
+            min_q.store(lane_q);
+            min_id.store(lane_id);
+            min_dist.store(lane_dist);
+            float row_q = inf, row_dist = inf;
+            int row_j = -1;
+            for (int lane = 0; lane < 4; lane++) {
+                if (lane_q[lane] < row_q || (lane_q[lane] == row_q && (int)lane_id[lane] < row_j)) {
+                    row_q = lane_q[lane];
+                    row_j = lane_id[lane];
+                }
+                row_dist = min(row_dist, lane_dist[lane]);
+            }
+            for (; j < len; j++) {
+                float q = rr*row[j] - row_sums[j];
+                if (q < row_q) {
+                    row_q = q;
+                    row_j = j;
+                }
+                row_dist = min(row_dist, row[j]);
+            }
+            // the scan gives the exact row minimum, a tighter bound for the next round
+            row_min[i] = row_dist;
+            if (row_j < 0)
+                continue;
+            row_q -= sums[i];
+            if (row_q < thread_q || (row_q == thread_q && i < thread_i)) {
+                thread_q = row_q;
+                thread_i = i;
+                thread_j = i+1+row_j;
+            }
+        }
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+        {
+            // same tie-breaking as the serial scan: smallest row, then smallest column
+            if (thread_i >= 0 && (thread_q < best_q || (thread_q == best_q && thread_i < best_i))) {
+                best_q = thread_q;
+                best_i = thread_i;
+                best_j = thread_j;
+            }
+        }
+    }
+    a = best_j;
+    b = best_i;
+    ASSERT(a > b && b >= 0);
+}
+
+void BioNjMatrix::agglomerate(int a, int b, int r) {
+    const float inf = numeric_limits<float>::infinity();
+    double dab = distance(a, b);
+    double vab = variance(a, b);
+    // branch lengths, formula (2)
+    double la = 0.5*(dab + (sum_dist[a] - sum_dist[b])/(r-2));
+    double lb = 0.5*(dab + (sum_dist[b] - sum_dist[a])/(r-2));
+    int k;
+
+    // lambda, formula (9), constrained to [0,1]: the sum over the other clusters k of
+    // variance(b,k) - variance(a,k) follows from the distance sums and the offsets
+    double lambda = 0.5;
+    if (vab != 0.0) {
+        double sum = (sum_dist[b] - sum_dist[a]) + (r-2)*(var_offset[b] - var_offset[a]);
+        lambda = 0.5 + sum/(2*(r-2)*vab);
+    }
+    if (lambda > 1.0)
+        lambda = 1.0;
+    if (lambda < 0.0)
+        lambda = 0.0;
+
+    // reduction of distances, formula (4); formula (10) for the variances
+    // amounts to the new offset of a, as (4) shifts the distances by la and lb
+    double new_sum = 0.0;
+    for (k = 0; k < n; k++) {
+        if (k == a || k == b || removed[k])
+            continue;
+        float &dak = distance(a, k);
+        float dbk = distance(b, k);
+        float duk = lambda*(dak - la) + (1.0-lambda)*(dbk - lb);
+        sum_dist[k] += (double)duk - dak - dbk;
+        dak = duk;
+        new_sum += duk;
+        if (k < a)
+            row_min[k] = min(row_min[k], duk);
+    }
+    sum_dist[a] = new_sum;
+    var_offset[a] = lambda*var_offset[a] + (1.0-lambda)*var_offset[b]
+        + lambda*la + (1.0-lambda)*lb - lambda*(1.0-lambda)*vab;
+
+    // remove b
+    removed[b] = true;
+    sum_dist[b] = 0.0;
+    for (k = 0; k < b; k++)
+        delta[index(k, b)] = inf;
+    float row_dist = inf;
+    for (k = a+1; k < n; k++)
+        row_dist = min(row_dist, delta[index(a, k)]);
+    row_min[a] = row_dist;
+
+    child1.push_back(cluster[a]);
+    child2.push_back(cluster[b]);
+    length1.push_back(la);
+    length2.push_back(lb);
+    cluster[a] = n + child1.size() - 1;
+}
+
+void BioNjMatrix::printSubtree(ostream &out, StrVector &names, int node) {
+    if (node < n) {
+        out << names[node];
+        return;
+    }
+    node -= n;
+    out << "(";
+    printSubtree(out, names, child1[node]);
+    out << ":" << length1[node] << ",";
+    printSubtree(out, names, child2[node]);
+    out << ":" << length2[node] << ")";
+}
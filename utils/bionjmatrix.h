@@ -0,0 +1,123 @@
+/***************************************************************************
+ *   Copyright (C) 2009-2019 by                                            *
+ *   BUI Quang Minh <minh.bui@univie.ac.at>                                *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef BIONJMATRIX_H
+#define BIONJMATRIX_H
+
+#include "tools.h"
+#include "distmatrix.h"
+
+/**
+    BIONJ (Gascuel 1997) on a distance matrix held in memory.
+    Same algorithm as BioNj in bionj.h, which reads the matrix from a file.
+    Distances are kept as the condensed upper triangle in single precision, as in
+    CondensedDistMatrix, i.e. n*(n-1)/2 floats. Variances need no matrix: formula (10)
+    keeps every variance at the distance plus one offset per cluster of the pair.
+    The pair to agglomerate is found by a vectorized, multithreaded scan of the
+    agglomerative criterion Q; rows whose lower bound of Q cannot beat the best
+    pair found so far are skipped.
+*/
+class BioNjMatrix {
+public:
+
+    /**
+        compute the BIONJ tree
+        @param dist_mat n*n distance matrix, row-major (e.g. PhyloTree::dist_matrix)
+        @param names taxon names of the n rows of dist_mat
+        @param out (OUT) output stream for the tree in NEWICK format
+    */
+    void create(double *dist_mat, StrVector &names, ostream &out);
+
+    /**
+        compute the BIONJ tree on a copy of the matrix, which is left unchanged.
+        The copy takes n*(n-1)/2 floats of RAM, even if dist_mat is memory-mapped (-dbin)
+        @param dist_mat condensed distance matrix with the taxon names
+        @param out (OUT) output stream for the tree in NEWICK format
+    */
+    void create(CondensedDistMatrix &dist_mat, ostream &out);
+
+private:
+
+    /** number of taxa */
+    int n;
+
+    /**
+        condensed upper triangle of the distances between clusters, row i holds the
+        distances to clusters j > i. Distances to removed clusters are set to infinity
+    */
+    vector<float> delta;
+
+    /** variance between clusters i and j is distance(i,j) + var_offset[i] + var_offset[j] */
+    DoubleVector var_offset;
+
+    /** sum of distances from each cluster to all other clusters */
+    DoubleVector sum_dist;
+
+    /** lower bound of the distances in the upper-triangle row of each cluster */
+    vector<float> row_min;
+
+    /** true if a cluster was agglomerated into another one */
+    BoolVector removed;
+
+    /** the two children and their branch lengths of each internal node, internal node IDs start from n */
+    IntVector child1, child2;
+    DoubleVector length1, length2;
+
+    /** node ID (taxon ID or internal node ID) of the cluster at each row */
+    IntVector cluster;
+
+    /** @return position of the pair (i,j), i < j, in delta */
+    inline size_t index(int i, int j) {
+        return (size_t)i*(2*(size_t)n - i - 1)/2 + (j - i - 1);
+    }
+
+    inline float &distance(int i, int j) {
+        return (i < j) ? delta[index(i, j)] : delta[index(j, i)];
+    }
+
+    inline double variance(int i, int j) {
+        return distance(i, j) + var_offset[i] + var_offset[j];
+    }
+
+    /**
+        run BIONJ once the distances are set in delta
+        @param names taxon names
+        @param out (OUT) output stream for the tree in NEWICK format
+    */
+    void build(StrVector &names, ostream &out);
+
+    /**
+        find the pair of clusters minimizing the agglomerative criterion
+        @param r number of remaining clusters
+        @param a (OUT) cluster with the larger index
+        @param b (OUT) cluster with the smaller index
+    */
+    void findBestPair(int r, int &a, int &b);
+
+    /**
+        agglomerate clusters a and b into a, using formulae (2), (4), (9) and (10) of BIONJ
+        @param r number of remaining clusters
+    */
+    void agglomerate(int a, int b, int r);
+
+    /** print the subtree of \a node */
+    void printSubtree(ostream &out, StrVector &names, int node);
+};
+
+#endif
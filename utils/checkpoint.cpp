@@ -10,10 +10,65 @@
 #include "timeutil.h"
 #include "gzstream.h"
 #include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <sys/stat.h>
 
 const char* CKP_HEADER =     "--- # IQ-TREE Checkpoint ver >= 1.6";
 const char* CKP_HEADER_OLD = "--- # IQ-TREE Checkpoint";
 
+/** magic bytes at the start of a binary checkpoint file */
+const char CKP_BIN_MAGIC[] = "IQCKPBIN";
+const size_t CKP_BIN_MAGIC_LEN = 8;
+const uint64_t CKP_BIN_VERSION = 1;
+
+/** rewrite binary checkpoint file if it is this many times larger than its live entries */
+const size_t CKP_BIN_COMPACT_RATIO = 3;
+
+/** append an unsigned integer in LEB128 encoding */
+static void writeVarint(string &buf, uint64_t value) {
+    while (value >= 0x80) {
+        buf.push_back((char)(value | 0x80));
+        value >>= 7;
+    }
+    buf.push_back((char)value);
+}
+
+static bool readVarint(istream &in, uint64_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int byte = in.get();
+        if (byte == EOF)
+            return false;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+static void writeString(string &buf, const string &str) {
+    writeVarint(buf, str.length());
+    buf.append(str);
+}
+
+static bool readString(istream &in, string &str) {
+    uint64_t len;
+    if (!readVarint(in, len) || len > ((uint64_t)1 << 40))
+        return false;
+    str.resize(len);
+    return len == 0 || in.read(&str[0], len);
+}
+
+static void writeRecord(string &buf, CkpRecordType type, const string &key, uint32_t version, const string *value) {
+    buf.push_back((char)type);
+    writeString(buf, key);
+    writeVarint(buf, version);
+    if (type == CKP_REC_PUT)
+        writeString(buf, *value);
+}
+
 Checkpoint::Checkpoint() {
 	filename = "";
     prev_dump_time = 0;
@@ -21,6 +76,8 @@ Checkpoint::Checkpoint() {
     struct_name = "";
     compression = true;
     header = CKP_HEADER;
+    binary = false;
+    dumped_size = 0;
 }
 
 
@@ -28,8 +85,25 @@ Checkpoint::~Checkpoint() {
 }
 
 
-void Checkpoint::setFileName(string filename) {
+void Checkpoint::setFileName(string filename, string old_filename) {
 	this->filename = filename;
+	this->old_filename = old_filename;
+}
+
+/** @return modification time of a file, 0 if it does not exist */
+static time_t getFileModTime(const string &file) {
+    struct stat st;
+    if (stat(file.c_str(), &st) != 0)
+        return 0;
+    return st.st_mtime;
+}
+
+string Checkpoint::getLoadFileName() {
+    if (old_filename.empty() || !fileExists(old_filename))
+        return filename;
+    if (!fileExists(filename) || getFileModTime(old_filename) > getFileModTime(filename))
+        return old_filename;
+    return filename;
 }
 
 
@@ -74,12 +148,23 @@ void Checkpoint::load(istream &in) {
 
 bool Checkpoint::load() {
 	ASSERT(filename != "");
-    if (!fileExists(filename)) return false;
+    string load_file = getLoadFileName();
+    if (!fileExists(load_file)) return false;
     try {
+        // binary checkpoint format
+        ifstream bin_in(load_file.c_str(), ios::binary);
+        char magic[CKP_BIN_MAGIC_LEN];
+        if (bin_in.read(magic, CKP_BIN_MAGIC_LEN) && memcmp(magic, CKP_BIN_MAGIC, CKP_BIN_MAGIC_LEN) == 0) {
+            loadBinary(bin_in, load_file);
+            bin_in.close();
+            return true;
+        }
+        bin_in.close();
+
         igzstream in;
         // set the failbit and badbit
         in.exceptions(ios::failbit | ios::badbit);
-        in.open(filename.c_str());
+        in.open(load_file.c_str());
         // remove the failbit
         in.exceptions(ios::badbit);
         string line;
@@ -90,7 +175,7 @@ bool Checkpoint::load() {
         if (line == CKP_HEADER_OLD)
             throw "Incompatible checkpoint file from version 1.5.X or older.\nEither overwrite it with -redo option or run older version";
         if (line != header)
-        	throw ("Invalid checkpoint file " + filename);
+        	throw ("Invalid checkpoint file " + load_file);
         // call load from the stream
         load(in);
         in.clear();
@@ -108,6 +193,78 @@ bool Checkpoint::load() {
     return false;
 }
 
+void Checkpoint::loadBinary(istream &in, string load_file) {
+    uint64_t version;
+    string file_header;
+    if (!readVarint(in, version) || !readString(in, file_header))
+        throw ("Invalid checkpoint file " + load_file);
+    if (version > CKP_BIN_VERSION)
+        throw ("Checkpoint file " + load_file + " was written by a newer version");
+    if (file_header != header)
+        throw ("Invalid checkpoint file " + load_file);
+
+    // records of a dump are applied only when its commit record was read
+    struct Record {
+        char type;
+        string key;
+        uint64_t version;
+        string value;
+    };
+    vector<Record> pending;
+    map<string, uint32_t> versions;
+    size_t valid_size = in.tellg();
+    while (true) {
+        int type = in.get();
+        if (type == EOF)
+            break;
+        if (type == CKP_REC_COMMIT) {
+            uint64_t num_records;
+            if (!readVarint(in, num_records) || num_records != pending.size())
+                break;
+            for (auto rec = pending.begin(); rec != pending.end(); rec++) {
+                auto ver = versions.find(rec->key);
+                // skip stale entries
+                if (ver != versions.end() && ver->second >= rec->version)
+                    continue;
+                if (rec->type == CKP_REC_PUT) {
+                    (*this)[rec->key].swap(rec->value);
+                    versions[rec->key] = rec->version;
+                } else {
+                    erase(rec->key);
+                    versions.erase(rec->key);
+                }
+            }
+            pending.clear();
+            valid_size = in.tellg();
+            continue;
+        }
+        if (type != CKP_REC_PUT && type != CKP_REC_ERASE)
+            break;
+        pending.resize(pending.size()+1);
+        Record &rec = pending.back();
+        rec.type = type;
+        if (!readString(in, rec.key) || !readVarint(in, rec.version) ||
+            (type == CKP_REC_PUT && !readString(in, rec.value))) {
+            pending.pop_back();
+            break;
+        }
+    }
+    in.clear();
+    in.seekg(0, ios::end);
+    if (valid_size < (size_t)in.tellg())
+        outWarning("Incomplete last dump in checkpoint file " + load_file + " is ignored");
+
+    // the next dump rewrites the file, keeping the key versions
+    std::hash<string> hash_value;
+    dumped_keys.clear();
+    for (auto ver = versions.begin(); ver != versions.end(); ver++) {
+        string &value = (*this)[ver->first];
+        CkpKeyState state = {ver->second, value.length(), hash_value(value)};
+        dumped_keys.insert(dumped_keys.end(), make_pair(ver->first, state));
+    }
+    dumped_size = 0;
+}
+
 void Checkpoint::setCompression(bool compression) {
     this->compression = compression;
 }
@@ -120,6 +277,10 @@ void Checkpoint::setHeader(string header) {
     this->header = "--- # " + header;
 }
 
+void Checkpoint::setBinary(bool binary) {
+    this->binary = binary;
+}
+
 void Checkpoint::setDumpInterval(double interval) {
     dump_interval = interval;
 }
@@ -151,36 +312,90 @@ void Checkpoint::dump(bool force) {
     }
     prev_dump_time = getRealTime();
     string filename_tmp = filename + ".tmp";
-    if (fileExists(filename_tmp)) {
+    if (writer.isIdle() && fileExists(filename_tmp)) {
         outWarning("IQ-TREE was killed while writing temporary checkpoint file " + filename_tmp);
         outWarning("You should increase checkpoint interval from the default 60 seconds");
         outWarning("via -cptime option to avoid too frequent checkpoint for large datasets");
     }
-    try {
-        ostream *out;
-        if (compression) 
-            out = new ogzstream(filename_tmp.c_str());
-        else
-            out = new ofstream(filename_tmp.c_str());
-        out->exceptions(ios::failbit | ios::badbit);
-        *out << header << endl;
+    if (binary) {
+        dumpBinary();
+    } else {
+        ostringstream out;
+        out << header << endl;
         // call dump stream
-        dump(*out);
-        if (compression)
-            ((ogzstream*)out)->close();
-        else
-            ((ofstream*)out)->close();
-        delete out;
-//        cout << "Checkpoint dumped" << endl;
-        if (fileExists(filename)) {
-            if (std::remove(filename.c_str()) != 0)
-                outError("Cannot remove file ", filename);
+        dump(out);
+        CkpWriteJob job = {filename, out.str(), false, compression, old_filename};
+        writer.submit(job);
+    }
+    // file must be on disk when a forced dump returns
+    if (force)
+        writer.wait();
+}
+
+void Checkpoint::dumpBinary() {
+    // compare entries against the keys in file, both sorted, and update the keys in file
+    string batch;
+    size_t num_records = 0, live_size = 0;
+    std::hash<string> hash_value;
+    auto old_it = dumped_keys.begin();
+    for (iterator it = begin(); it != end(); it++, old_it++) {
+        for (; old_it != dumped_keys.end() && old_it->first < it->first; num_records++) {
+            writeRecord(batch, CKP_REC_ERASE, old_it->first, old_it->second.version+1, NULL);
+            old_it = dumped_keys.erase(old_it);
         }
-        if (std::rename(filename_tmp.c_str(), filename.c_str()) != 0)
-            outError("Cannot rename file ", filename_tmp);
-    } catch (ios::failure &) {
-        outError(ERR_WRITE_OUTPUT, filename.c_str());
+        if (old_it == dumped_keys.end() || old_it->first != it->first) {
+            CkpKeyState state = {0, 0, 0};
+            old_it = dumped_keys.insert(old_it, make_pair(it->first, state));
+        } else if (old_it->second.length == it->second.length() &&
+                   old_it->second.hash == hash_value(it->second)) {
+            live_size += it->first.length() + it->second.length() + 8;
+            continue;
+        }
+        old_it->second.version++;
+        old_it->second.length = it->second.length();
+        old_it->second.hash = hash_value(it->second);
+        writeRecord(batch, CKP_REC_PUT, it->first, old_it->second.version, &it->second);
+        num_records++;
+        live_size += it->first.length() + it->second.length() + 8;
+    }
+    for (; old_it != dumped_keys.end(); num_records++) {
+        writeRecord(batch, CKP_REC_ERASE, old_it->first, old_it->second.version+1, NULL);
+        old_it = dumped_keys.erase(old_it);
     }
+
+    if (dumped_size == 0 || dumped_size + batch.length() > CKP_BIN_COMPACT_RATIO * live_size + 4096) {
+        compactBinary();
+        return;
+    }
+    if (num_records == 0)
+        return;
+    batch.push_back((char)CKP_REC_COMMIT);
+    writeVarint(batch, num_records);
+    size_t batch_size = batch.length();
+    CkpWriteJob job = {filename, std::move(batch), true, false, ""};
+    if (!writer.submit(job)) {
+        // too many records waiting for the file system, replace them by a snapshot
+        compactBinary();
+        return;
+    }
+    dumped_size += batch_size;
+}
+
+void Checkpoint::compactBinary() {
+    string buf(CKP_BIN_MAGIC, CKP_BIN_MAGIC_LEN);
+    writeVarint(buf, CKP_BIN_VERSION);
+    writeString(buf, header);
+    auto key = dumped_keys.begin();
+    for (iterator it = begin(); it != end(); it++, key++) {
+        ASSERT(key->first == it->first);
+        writeRecord(buf, CKP_REC_PUT, it->first, key->second.version, &it->second);
+    }
+    buf.push_back((char)CKP_REC_COMMIT);
+    writeVarint(buf, size());
+
+    dumped_size = buf.length();
+    CkpWriteJob job = {filename, std::move(buf), false, false, old_filename};
+    writer.submit(job);
 }
 
 bool Checkpoint::hasKey(string key) {
@@ -336,6 +551,142 @@ void Checkpoint::getSubCheckpoint(Checkpoint *target, string partial_key) {
 }
 */
 
+/*-------------------------------------------------------------
+ * CkpWriter
+ *-------------------------------------------------------------*/
+
+/** maximal size of records waiting to be appended to a checkpoint file */
+const size_t CKP_WRITER_MAX_PENDING = 64*1024*1024;
+
+CkpWriter::CkpWriter() {
+    started = false;
+#ifdef _OPENMP
+    has_pending = false;
+    busy = false;
+    stop = false;
+#endif
+}
+
+CkpWriter::~CkpWriter() {
+#ifdef _OPENMP
+    if (started) {
+        {
+            lock_guard<mutex> guard(lock);
+            stop = true;
+        }
+        cond.notify_all();
+        worker.join();
+    }
+#endif
+    if (!error.empty())
+        outWarning(error);
+}
+
+bool CkpWriter::submit(CkpWriteJob &job) {
+#ifdef _OPENMP
+    unique_lock<mutex> guard(lock);
+    if (!error.empty()) {
+        string err = error;
+        error = "";
+        guard.unlock();
+        outError(err);
+    }
+    if (!started) {
+        started = true;
+        worker = thread(&CkpWriter::run, this);
+    }
+    // jobs for another file are not merged
+    cond.wait(guard, [&] { return !has_pending || pending.filename == job.filename; });
+    if (has_pending && job.append) {
+        if (pending.data.length() + job.data.length() > CKP_WRITER_MAX_PENDING)
+            return false;
+        pending.data += job.data;
+    } else {
+        pending = std::move(job);
+        has_pending = true;
+    }
+    cond.notify_all();
+#else
+    started = true;
+    string err = write(job);
+    if (!err.empty())
+        outError(err);
+#endif
+    return true;
+}
+
+void CkpWriter::wait() {
+#ifdef _OPENMP
+    unique_lock<mutex> guard(lock);
+    cond.wait(guard, [this] { return !has_pending && !busy; });
+    if (!error.empty()) {
+        string err = error;
+        error = "";
+        guard.unlock();
+        outError(err);
+    }
+#endif
+}
+
+#ifdef _OPENMP
+void CkpWriter::run() {
+    unique_lock<mutex> guard(lock);
+    while (true) {
+        cond.wait(guard, [this] { return has_pending || stop; });
+        if (!has_pending)
+            break;
+        CkpWriteJob job = std::move(pending);
+        has_pending = false;
+        busy = true;
+        guard.unlock();
+        string err = write(job);
+        guard.lock();
+        busy = false;
+        if (!err.empty() && error.empty())
+            error = err;
+        cond.notify_all();
+    }
+}
+#endif
+
+string CkpWriter::write(CkpWriteJob &job) {
+    try {
+        if (job.append) {
+            ofstream out;
+            out.exceptions(ios::failbit | ios::badbit);
+            out.open(job.filename.c_str(), ios::binary | ios::app);
+            out.write(job.data.c_str(), job.data.length());
+            out.close();
+            return "";
+        }
+        string filename_tmp = job.filename + ".tmp";
+        ostream *out;
+        if (job.compress)
+            out = new ogzstream(filename_tmp.c_str());
+        else
+            out = new ofstream(filename_tmp.c_str(), ios::binary);
+        out->exceptions(ios::failbit | ios::badbit);
+        out->write(job.data.c_str(), job.data.length());
+        if (job.compress)
+            ((ogzstream*)out)->close();
+        else
+            ((ofstream*)out)->close();
+        delete out;
+        if (fileExists(job.filename)) {
+            if (std::remove(job.filename.c_str()) != 0)
+                return "Cannot remove file " + job.filename;
+        }
+        if (std::rename(filename_tmp.c_str(), job.filename.c_str()) != 0)
+            return "Cannot rename file " + filename_tmp;
+        // the replaced file holds the complete checkpoint, the superseded one would be stale
+        if (!job.superseded.empty() && fileExists(job.superseded) && std::remove(job.superseded.c_str()) != 0)
+            return "Cannot remove file " + job.superseded;
+    } catch (ios::failure &) {
+        return ERR_WRITE_OUTPUT + job.filename;
+    }
+    return "";
+}
+
 /*-------------------------------------------------------------
  * CheckpointFactory
  *-------------------------------------------------------------*/
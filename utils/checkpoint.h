@@ -16,6 +16,11 @@
 #include <vector>
 #include <typeinfo>
 #include "tools.h"
+#ifdef _OPENMP
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#endif
 
 using namespace std;
 
@@ -40,6 +45,19 @@ using namespace std;
 
 const char CKP_SEP = '!';
 
+/** record types of the binary checkpoint format */
+enum CkpRecordType {CKP_REC_PUT = 'P', CKP_REC_ERASE = 'E', CKP_REC_COMMIT = 'C'};
+
+/** state of a key written to a binary checkpoint file */
+struct CkpKeyState {
+    /** number of times the value was written */
+    uint32_t version;
+    /** length of the value written last */
+    size_t length;
+    /** hash of the value written last, compared with the length to find changed entries */
+    size_t hash;
+};
+
 /** checkpoint stream */
 class CkpStream : public stringstream {
 public:
@@ -50,6 +68,87 @@ public:
 
 };
 
+/** a checkpoint file write, prepared in memory */
+struct CkpWriteJob {
+    /** target file name */
+    string filename;
+    /** file content, or records to append */
+    string data;
+    /** true to append data to the file, false to replace the file via a temporary file */
+    bool append;
+    /** true to gzip data when replacing the file */
+    bool compress;
+    /** file superseded by this one, removed once the file was replaced */
+    string superseded;
+};
+
+/**
+    Background thread writing checkpoint files, so that the caller does not wait
+    for the file system. At most one job is pending besides the one being written;
+    a new replacing job supersedes the pending one and appending jobs are merged.
+    Copies of a checkpoint do not share the writer.
+*/
+class CkpWriter {
+public:
+
+    CkpWriter();
+
+    CkpWriter(const CkpWriter &writer) : CkpWriter() {}
+
+    CkpWriter &operator=(const CkpWriter &writer) { return *this; }
+
+    /** wait for all pending jobs and stop the thread */
+    ~CkpWriter();
+
+    /**
+        submit a job to the writer thread, or write it directly without OpenMP
+        @param job job to write, its data is moved away
+        @return false if an appending job would exceed the pending memory limit
+    */
+    bool submit(CkpWriteJob &job);
+
+    /**
+        block until all submitted jobs are on disk; report the first write error
+    */
+    void wait();
+
+    /** @return true if the writer has not written any job yet */
+    bool isIdle() { return !started; }
+
+    /**
+        write a job to disk
+        @return error message, empty on success
+    */
+    static string write(CkpWriteJob &job);
+
+private:
+
+    /** true once the first job was submitted */
+    bool started;
+
+#ifdef _OPENMP
+    /** main loop of the writer thread */
+    void run();
+
+    thread worker;
+    mutex lock;
+    condition_variable cond;
+
+    /** job waiting to be written */
+    CkpWriteJob pending;
+    bool has_pending;
+
+    /** true while a job is being written */
+    bool busy;
+
+    /** true to stop the thread */
+    bool stop;
+#endif
+
+    /** first write error */
+    string error;
+};
+
 /* overload operators */
 //ostream& operator<<(ostream& os, const T& obj) {
 //        return os;
@@ -73,11 +172,17 @@ public:
 
 	/**
 	 * @param filename file name
+	 * @param old_filename file loaded instead if it is newer than filename or filename
+	 *        does not exist, e.g. the text checkpoint of an earlier run; dumps always go
+	 *        to filename and old_filename is removed after the first complete dump
 	 */
-	void setFileName(string filename);
+	void setFileName(string filename, string old_filename = "");
 
     string &getFileName() { return filename; }
 
+    /** @return file read by load(): the newer of the file name and the old file name */
+    string getLoadFileName();
+
     /** 
         set compression for checkpoint file
         @param compression true to compress checkpoint file, or false: no compression 
@@ -90,12 +195,25 @@ public:
     */
     void setHeader(string header);
 
+    /**
+        set the binary checkpoint format, where each dump appends only the changed entries
+        @param binary true for binary format, false for the text format
+    */
+    void setBinary(bool binary);
+
 	/**
 	 * load checkpoint information from an input stram
      * @param in input stream
 	 */
 	void load(istream &in);
 
+	/**
+	 * load checkpoint information in binary format, skipping an incomplete last dump
+     * @param in input stream positioned after the magic bytes
+     * @param load_file name of the file read, for messages
+	 */
+	void loadBinary(istream &in, string load_file);
+
 	/**
 	 * load checkpoint information from file
      * @return TRUE if loaded successfully, otherwise FALSE
@@ -109,11 +227,23 @@ public:
 	void dump(ostream &out);
 
 	/**
-	 * dump checkpoint information into file
-	 * @param force TRUE to dump no matter if time interval exceeded or not
+	 * dump checkpoint information into file; the file is written by a background thread
+	 * @param force TRUE to dump no matter if time interval exceeded or not,
+	 * and to wait until the file is written
 	 */
 	void dump(bool force = false);
 
+	/**
+	 * append entries changed since the previous dump to the binary checkpoint file,
+	 * or rewrite the file if appended records take too much space
+	 */
+	void dumpBinary();
+
+	/**
+	 * rewrite binary checkpoint file with all current entries
+	 */
+	void compactBinary();
+
     /**
         set dumping interval in seconds
         @param interval dumping interval
@@ -384,6 +514,9 @@ protected:
 
     /** filename to write checkpoint */
 	string filename;
+
+    /** file to load if it is newer than filename */
+    string old_filename;
     
     /** previous dump time in seconds */
     double prev_dump_time;
@@ -396,7 +529,19 @@ protected:
     
     /** header line of checkpoint file */
     string header;
-    
+
+    /** true to write checkpoint file in binary, append-only format */
+    bool binary;
+
+    /** version and value hash of every key in the binary checkpoint file */
+    map<string, CkpKeyState> dumped_keys;
+
+    /** size of binary checkpoint file in bytes, 0 if it must be rewritten */
+    size_t dumped_size;
+
+    /** writer of checkpoint files in background */
+    CkpWriter writer;
+
 private:
 
     /** name of the current nested key */
@@ -0,0 +1,209 @@
+/***************************************************************************
+ *   Copyright (C) 2009-2019 by                                            *
+ *   BUI Quang Minh <minh.bui@univie.ac.at>                                *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "distmatrix.h"
+#include <string.h>
+
+#if !defined WIN32 && !defined _WIN32 && !defined __WIN32__
+#define USE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+const char DIST_MAGIC[] = "IQDIST01";
+const size_t DIST_MAGIC_LEN = 8;
+
+CondensedDistMatrix::CondensedDistMatrix() {
+    n = 0;
+    data = NULL;
+    map_addr = NULL;
+    map_size = 0;
+}
+
+CondensedDistMatrix::~CondensedDistMatrix() {
+    clear();
+}
+
+void CondensedDistMatrix::clear() {
+#ifdef USE_MMAP
+    if (map_addr) {
+        munmap(map_addr, map_size);
+        map_addr = NULL;
+        data = NULL;
+    }
+#endif
+    if (data)
+        delete [] data;
+    data = NULL;
+    map_size = 0;
+    n = 0;
+    names.clear();
+    file_name = "";
+}
+
+size_t CondensedDistMatrix::headerSize() {
+    size_t names_size = 0;
+    for (StrVector::iterator it = names.begin(); it != names.end(); it++)
+        names_size += it->length() + 1;
+    names_size = (names_size + 7) / 8 * 8;
+    return DIST_MAGIC_LEN + 2*sizeof(uint64_t) + names_size;
+}
+
+void CondensedDistMatrix::writeHeader(char *buf) {
+    size_t header_size = headerSize();
+    memset(buf, 0, header_size);
+    memcpy(buf, DIST_MAGIC, DIST_MAGIC_LEN);
+    uint64_t num = n;
+    memcpy(buf + DIST_MAGIC_LEN, &num, sizeof(uint64_t));
+    num = header_size - DIST_MAGIC_LEN - 2*sizeof(uint64_t);
+    memcpy(buf + DIST_MAGIC_LEN + sizeof(uint64_t), &num, sizeof(uint64_t));
+    char *pos = buf + DIST_MAGIC_LEN + 2*sizeof(uint64_t);
+    for (StrVector::iterator it = names.begin(); it != names.end(); it++) {
+        memcpy(pos, it->c_str(), it->length() + 1);
+        pos += it->length() + 1;
+    }
+}
+
+void CondensedDistMatrix::create(StrVector &taxon_names, const char *file_name) {
+    clear();
+    names = taxon_names;
+    n = names.size();
+    size_t num_pairs = (size_t)n*(n-1)/2;
+#ifdef USE_MMAP
+    if (file_name) {
+        size_t header_size = headerSize();
+        map_size = header_size + num_pairs*sizeof(float);
+        int fd = open(file_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            outError(ERR_WRITE_OUTPUT, file_name);
+        if (ftruncate(fd, map_size) != 0) {
+            close(fd);
+            outError(ERR_WRITE_OUTPUT, file_name);
+        }
+        void *addr = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED)
+            outError("Cannot memory-map distance file ", file_name);
+        map_addr = (char*)addr;
+        writeHeader(map_addr);
+        // the file was truncated, so the distances are already zero
+        data = (float*)(map_addr + header_size);
+        return;
+    }
+#endif
+    if (file_name)
+        this->file_name = file_name;
+    data = new float[num_pairs];
+    memset(data, 0, sizeof(float)*num_pairs);
+}
+
+bool CondensedDistMatrix::isBinaryFile(const char *file_name) {
+    char magic[DIST_MAGIC_LEN];
+    ifstream in(file_name, ios::binary);
+    if (!in.is_open())
+        return false;
+    in.read(magic, DIST_MAGIC_LEN);
+    return in.gcount() == (streamsize)DIST_MAGIC_LEN && memcmp(magic, DIST_MAGIC, DIST_MAGIC_LEN) == 0;
+}
+
+void CondensedDistMatrix::load(const char *file_name) {
+    clear();
+    uint64_t num, names_size;
+    ifstream in(file_name, ios::binary);
+    if (!in.is_open() || !isBinaryFile(file_name))
+        outError(ERR_READ_INPUT, file_name);
+    in.seekg(DIST_MAGIC_LEN);
+    in.read((char*)&num, sizeof(uint64_t));
+    in.read((char*)&names_size, sizeof(uint64_t));
+    if (!in.good())
+        outError(ERR_READ_INPUT, file_name);
+    string names_buf(names_size, '\0');
+    in.read(&names_buf[0], names_size);
+    if (!in.good())
+        outError(ERR_READ_INPUT, file_name);
+    n = num;
+    size_t pos = 0;
+    for (int i = 0; i < n; i++) {
+        if (pos >= names_size)
+            outError("Distance file has fewer taxon names than taxa: ", file_name);
+        names.push_back(names_buf.c_str() + pos);
+        pos += names.back().length() + 1;
+    }
+    size_t header_size = headerSize();
+    size_t num_pairs = (size_t)n*(n-1)/2;
+    in.seekg(0, ios::end);
+    if ((size_t)in.tellg() < header_size + num_pairs*sizeof(float))
+        outError("Distance file is truncated: ", file_name);
+#ifdef USE_MMAP
+    in.close();
+    int fd = open(file_name, O_RDONLY);
+    if (fd < 0)
+        outError(ERR_READ_INPUT, file_name);
+    map_size = header_size + num_pairs*sizeof(float);
+    // private mapping: changes are not written back to the file
+    void *addr = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        outError("Cannot memory-map distance file ", file_name);
+    map_addr = (char*)addr;
+    data = (float*)(map_addr + header_size);
+#else
+    data = new float[num_pairs];
+    in.seekg(header_size);
+    in.read((char*)data, num_pairs*sizeof(float));
+    if (!in.good())
+        outError(ERR_READ_INPUT, file_name);
+#endif
+}
+
+void CondensedDistMatrix::flush() {
+#ifdef USE_MMAP
+    if (map_addr) {
+        msync(map_addr, map_size, MS_SYNC);
+        return;
+    }
+#endif
+    if (file_name.empty())
+        return;
+    try {
+        ofstream out;
+        out.exceptions(ios::failbit | ios::badbit);
+        out.open(file_name.c_str(), ios::binary);
+        size_t header_size = headerSize();
+        char *header = new char[header_size];
+        writeHeader(header);
+        out.write(header, header_size);
+        delete [] header;
+        out.write((char*)data, (size_t)n*(n-1)/2*sizeof(float));
+        out.close();
+    } catch (ios::failure) {
+        outError(ERR_WRITE_OUTPUT, file_name);
+    }
+}
+
+double CondensedDistMatrix::getLongestDist() {
+    double longest_dist = 0.0;
+    size_t num_pairs = (size_t)n*(n-1)/2;
+    for (size_t i = 0; i < num_pairs; i++)
+        if (data[i] > longest_dist)
+            longest_dist = data[i];
+    return longest_dist;
+}
@@ -0,0 +1,124 @@
+/***************************************************************************
+ *   Copyright (C) 2009-2019 by                                            *
+ *   BUI Quang Minh <minh.bui@univie.ac.at>                                *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef DISTMATRIX_H
+#define DISTMATRIX_H
+
+#include "tools.h"
+
+/**
+    Symmetric distance matrix with zero diagonal, stored as the condensed upper
+    triangle in single precision (n*(n-1)/2 floats instead of n*n doubles).
+    The matrix can be memory-mapped to a binary distance file, which then holds
+    the taxon names followed by the condensed triangle:
+
+        "IQDIST01" | uint64 n | uint64 size of names | names ('\0'-terminated, padded to 8 bytes) | floats
+
+    Without mmap support (Windows) the matrix is kept in memory and written by flush().
+*/
+class CondensedDistMatrix {
+public:
+
+    CondensedDistMatrix();
+
+    ~CondensedDistMatrix();
+
+    /**
+        allocate the matrix with all distances set to zero
+        @param taxon_names names of the taxa
+        @param file_name if not NULL, the binary distance file backing the matrix
+    */
+    void create(StrVector &taxon_names, const char *file_name = NULL);
+
+    /**
+        map a binary distance file. Changes to the matrix are not written back
+        @param file_name binary distance file
+    */
+    void load(const char *file_name);
+
+    /** write the matrix to its binary distance file, if any */
+    void flush();
+
+    /** release the matrix and its mapping */
+    void clear();
+
+    /** @return true if file_name is a binary distance file */
+    static bool isBinaryFile(const char *file_name);
+
+    /** @return number of taxa */
+    inline int getNTaxa() {
+        return n;
+    }
+
+    /** @return the names of the taxa */
+    inline StrVector &getNames() {
+        return names;
+    }
+
+    /** @return distance between taxa i and j */
+    inline float get(int i, int j) {
+        if (i == j)
+            return 0.0;
+        return data[index(i, j)];
+    }
+
+    /** set the distance between taxa i and j, distances on the diagonal are ignored */
+    inline void set(int i, int j, float value) {
+        if (i != j)
+            data[index(i, j)] = value;
+    }
+
+    /** @return the longest distance */
+    double getLongestDist();
+
+private:
+
+    /** @return position of the pair (i,j) in the condensed upper triangle */
+    inline size_t index(int i, int j) {
+        if (i > j)
+            swap(i, j);
+        return (size_t)i*(2*(size_t)n - i - 1)/2 + (j - i - 1);
+    }
+
+    /** header size of the binary file for the current names */
+    size_t headerSize();
+
+    /** write the header of the binary file into buf */
+    void writeHeader(char *buf);
+
+    /** number of taxa */
+    int n;
+
+    /** taxon names */
+    StrVector names;
+
+    /** the condensed upper triangle */
+    float *data;
+
+    /** memory-mapped file, or NULL if the matrix is held in memory */
+    char *map_addr;
+
+    /** size of the memory-mapped file */
+    size_t map_size;
+
+    /** binary distance file written by flush() if the matrix is held in memory */
+    string file_name;
+};
+
+#endif
@@ -20,8 +20,6 @@
 
 using namespace std;
 
-const double ERROR_X = 1.0e-4;
-
 double ran1(long *idum);
 double *new_vector(long nl, long nh);
 void free_vector(double *v, long nl, long nh);
@@ -737,6 +735,7 @@ double Optimization::minimizeMultiDimen(double guess[], int ndim, double lower[]
 			guess[i] = minx[i];
 		fret = minf;
 	}
+	releaseFunkWorkers();
 	delete [] minx;
 	
 	return fret;
@@ -867,24 +866,74 @@ double Optimization::derivativeFunk(double x[], double dfx[]) {
 	if (!checkRange(x))
 		return INFINITIVE;
 	*/
-	int ndim = getNDim();
-	double *h = new double[ndim+1];
-    double temp;
-    int dim;
 	double fx = targetFunk(x);
-	for (dim = 1; dim <= ndim; dim++ ){
-		temp = x[dim];
-		h[dim] = ERROR_X * fabs(temp);
-		if (h[dim] == 0.0) h[dim] = ERROR_X;
-		x[dim] = temp + h[dim];
-		h[dim] = x[dim] - temp;
-		dfx[dim] = (targetFunk(x));
+	computeFiniteDifferences(x, fx, dfx);
+	return fx;
+}
+
+void Optimization::computeFiniteDifferences(double x[], double fx, double dfx[], bool *skip) {
+	int ndim = getNDim();
+	int dim;
+	vector<int> dims;
+	for (dim = 1; dim <= ndim; dim++)
+		if (!skip || !skip[dim])
+			dims.push_back(dim);
+
+	// with two dimensions the extra evaluation below outweighs the concurrency
+	vector<Optimization*> workers;
+	if (dims.size() > 2)
+		getFunkWorkers(dims.size()+1, workers);
+
+	if (workers.empty()) {
+		for (vector<int>::iterator it = dims.begin(); it != dims.end(); it++) {
+			dim = *it;
+			double temp = x[dim];
+			double h = ERROR_X * fabs(temp);
+			if (h == 0.0) h = ERROR_X;
+			x[dim] = temp + h;
+			h = x[dim] - temp;
+			dfx[dim] = (targetFunk(x) - fx) / h;
+			x[dim] = temp;
+		}
+		return;
+	}
+
+	// the copies hold the current parameters only up to checkpoint precision, thus the
+	// unperturbed point is evaluated by a copy as well (task 0) to keep the differences consistent
+	int num_workers = workers.size();
+	int num_tasks = dims.size() + 1;
+	double *fy = new double[num_tasks];
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static, 1) num_threads(num_workers)
+#endif
+	for (int worker = 0; worker < num_workers; worker++) {
+		double *y = new double[ndim+1];
+		memcpy(y, x, sizeof(double)*(ndim+1));
+		for (int task = worker; task < num_tasks; task += num_workers) {
+			if (task == 0) {
+				fy[task] = workers[worker]->targetFunk(y);
+				continue;
+			}
+			int d = dims[task-1];
+			double h = ERROR_X * fabs(x[d]);
+			if (h == 0.0) h = ERROR_X;
+			y[d] = x[d] + h;
+			fy[task] = workers[worker]->targetFunk(y);
+			y[d] = x[d];
+		}
+		delete [] y;
+	}
+	for (int task = 1; task < num_tasks; task++) {
+		dim = dims[task-1];
+		double temp = x[dim];
+		double h = ERROR_X * fabs(temp);
+		if (h == 0.0) h = ERROR_X;
+		x[dim] = temp + h;
+		h = x[dim] - temp;
 		x[dim] = temp;
+		dfx[dim] = (fy[task] - fy[0]) / h;
 	}
-	for (dim = 1; dim <= ndim; dim++ )
-        dfx[dim] = (dfx[dim] - fx) / h[dim];
-    delete [] h;
-	return fx;
+	delete [] fy;
 }
 
 
@@ -1111,6 +1160,7 @@ double Optimization::L_BFGS_B(int n, double* x, double* l, double* u, double pgt
         cout << msg << endl;
     }
 
+	releaseFunkWorkers();
 	delete[] nbd;
     
     return Fmin;
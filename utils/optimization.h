@@ -13,6 +13,10 @@
 #define OPTIMIZATION_H
 
 #include <iostream>
+#include <vector>
+
+/** relative step size for finite-difference derivatives */
+const double ERROR_X = 1.0e-4;
 
 /**
 Optimization class, implement some methods like Brent, Newton-Raphson (for 1 variable function), BFGS (for multi-dimensional function)
@@ -144,6 +148,30 @@ public:
 	*/
 	virtual double derivativeFunk(double x[], double dfx[]);
 
+	/**
+		forward finite differences of targetFunk, evaluated concurrently on the
+		copies returned by getFunkWorkers() if there are any
+		@param x the input vector x
+		@param fx the function value at x
+		@param dfx (OUT) the derivative at x
+		@param skip if not NULL, dimensions with skip[dim] == true are left unchanged in dfx
+	*/
+	void computeFiniteDifferences(double x[], double fx, double dfx[], bool *skip = NULL);
+
+	/**
+		get independent copies of this object whose targetFunk() can be called
+		concurrently with each other. Default: none
+		@param max_num maximal number of copies needed
+		@param workers (OUT) the copies, owned by the callee
+	*/
+	virtual void getFunkWorkers(int max_num, std::vector<Optimization*> &workers) {}
+
+	/**
+		free the copies of getFunkWorkers() at the end of a minimization,
+		which keeps them from one derivativeFunk() call to the next. Default: nothing
+	*/
+	virtual void releaseFunkWorkers() {}
+
 	/**
 	        Controls restarting of optimization if optimization gets
                 stuck on the boundary. Models are free to override this
@@ -147,6 +147,8 @@ void outWarning(string warn) {
     outWarning(warn.c_str());
 }
 
+string *thread_cout_buffer = NULL;
+
 double randomLen(Params &params) {
     double ran = static_cast<double> (random_int(999) + 1) / 1000;
     double len = -params.mean_len * log(ran);
@@ -723,6 +725,7 @@ void parseArg(int argc, char *argv[], Params &params) {
     params.dist_file = NULL;
     params.compute_obs_dist = false;
     params.compute_jc_dist = true;
+    params.dist_binary = false;
     params.compute_ml_dist = true;
     params.compute_ml_tree = true;
     params.budget_file = NULL;
@@ -774,10 +777,12 @@ void parseArg(int argc, char *argv[], Params &params) {
 
     params.aln_file = NULL;
     params.phylip_sequential_format = false;
+    params.mmap_alignment = false;
     params.treeset_file = NULL;
     params.topotest_replicates = 0;
     params.do_weighted_test = false;
     params.do_au_test = false;
+    params.topotest_parallel_trees = false;
     params.siteLL_file = NULL; //added by MA
     params.partition_file = NULL;
     params.partition_type = BRLEN_OPTIMIZE;
@@ -877,6 +882,7 @@ void parseArg(int argc, char *argv[], Params &params) {
     params.lk_safe_scaling = false;
     params.numseq_safe_scaling = 2000;
     params.kernel_nonrev = false;
+    params.partial_lh_float = false;
     params.print_site_lh = WSL_NONE;
     params.print_partition_lh = false;
     params.print_site_prob = WSL_NONE;
@@ -932,6 +938,8 @@ void parseArg(int argc, char *argv[], Params &params) {
     params.step_iterations = 100;
 //    params.store_candidate_trees = false;
 	params.print_ufboot_trees = 0;
+    params.ufboot_batch = 0;
+    params.ufboot_compact = false;
     params.jackknife_prop = 0.0;
     //const double INF_NNI_CUTOFF = -1000000.0;
     params.nni_cutoff = -1000000.0;
@@ -1010,6 +1018,7 @@ void parseArg(int argc, char *argv[], Params &params) {
     params.link_alpha = false;
     params.ignore_checkpoint = false;
     params.checkpoint_dump_interval = 60;
+    params.checkpoint_text = false;
     params.force_unfinished = false;
     params.suppress_output_flags = 0;
     params.ufboot2corr = false;
@@ -1259,6 +1268,10 @@ void parseArg(int argc, char *argv[], Params &params) {
 				params.compute_obs_dist = true;
 				continue;
 			}
+			if (strcmp(argv[cnt], "-dbin") == 0) {
+				params.dist_binary = true;
+				continue;
+			}
 			if (strcmp(argv[cnt], "-r") == 0) {
 				cnt++;
 				if (cnt >= argc)
@@ -1641,6 +1654,10 @@ void parseArg(int argc, char *argv[], Params &params) {
                 params.phylip_sequential_format = true;
                 continue;
             }
+			if (strcmp(argv[cnt], "-mmap") == 0) {
+				params.mmap_alignment = true;
+				continue;
+			}
 			if (strcmp(argv[cnt], "-z") == 0) {
 				cnt++;
 				if (cnt >= argc)
@@ -1665,6 +1682,10 @@ void parseArg(int argc, char *argv[], Params &params) {
 				params.do_au_test = true;
 				continue;
 			}
+			if (strcmp(argv[cnt], "-zpar") == 0) {
+				params.topotest_parallel_trees = true;
+				continue;
+			}
 			if (strcmp(argv[cnt], "-sp") == 0) {
 				cnt++;
 				if (cnt >= argc)
@@ -2058,6 +2079,11 @@ void parseArg(int argc, char *argv[], Params &params) {
 				continue;
 			}
 
+			if (strcmp(argv[cnt], "-lhfloat") == 0) {
+				params.partial_lh_float = true;
+				continue;
+			}
+
 			if (strcmp(argv[cnt], "-safe-seq") == 0) {
 				cnt++;
 				if (cnt >= argc)
@@ -2775,6 +2801,19 @@ void parseArg(int argc, char *argv[], Params &params) {
 				params.print_ufboot_trees = 2;
 				continue;
 			}
+			if (strcmp(argv[cnt], "-bbatch") == 0) {
+				cnt++;
+				if (cnt >= argc)
+					throw "Use -bbatch <#trees>";
+				params.ufboot_batch = convert_int(argv[cnt]);
+				if (params.ufboot_batch < 0)
+					throw "#trees must be non-negative";
+				continue;
+			}
+			if (strcmp(argv[cnt], "-bcompact") == 0) {
+				params.ufboot_compact = true;
+				continue;
+			}
 			if (strcmp(argv[cnt], "-bs") == 0) {
 				cnt++;
 				if (cnt >= argc)
@@ -3426,6 +3465,11 @@ void parseArg(int argc, char *argv[], Params &params) {
 				params.checkpoint_dump_interval = convert_int(argv[cnt]);
 				continue;
 			}
+
+			if (strcmp(argv[cnt], "-cptext") == 0) {
+				params.checkpoint_text = true;
+				continue;
+			}
             
 			if (strcmp(argv[cnt], "--no-log") == 0) {
 				params.suppress_output_flags |= OUT_LOG;
@@ -3547,6 +3591,15 @@ void parseArg(int argc, char *argv[], Params &params) {
 		params.print_ufboot_trees = 2; // 2017-09-25: fix bug regarding the order of -bb 1000 -bnni -wbt
 	}
 
+    if (params.ufboot_batch > 0 && params.pll)
+        outError("-bbatch does not work with -pll");
+
+    if (params.ufboot_compact && params.pll)
+        outError("-bcompact does not work with -pll");
+
+    if (params.ufboot_compact && params.ufboot_batch > 0)
+        outError("-bcompact does not work with -bbatch");
+
     if (!params.out_prefix) {
     	if (params.eco_dag_file)
     		params.out_prefix = params.eco_dag_file;
@@ -3647,6 +3700,7 @@ void usage_iqtree(char* argv[], bool full_command) {
             << "  -version             Display version number" << endl
             << "  -s <alignment>       Input alignment in PHYLIP/FASTA/NEXUS/CLUSTAL/MSF format" << endl
             << "  -st <data_type>      BIN, DNA, AA, NT2AA, CODON, MORPH (default: auto-detect)" << endl
+            << "  -mmap                Memory-mapped, multi-threaded reading of FASTA alignment" << endl
             << "  -q <partition_file>  Edge-linked partition model (file in NEXUS/RAxML format)" << endl
             << " -spp <partition_file> Like -q option but allowing partition-specific rates" << endl
             << "  -sp <partition_file> Edge-unlinked partition model (like -M option of RAxML)" << endl
@@ -3664,11 +3718,16 @@ void usage_iqtree(char* argv[], bool full_command) {
             << "  -quiet               Quiet mode, suppress printing to screen (stdout)" << endl
             << "  -keep-ident          Keep identical sequences (default: remove & finally add)" << endl
             << "  -safe                Safe likelihood kernel to avoid numerical underflow" << endl
+            << "  -lhfloat             Store partial likelihoods in single precision during tree search" << endl
             << "  -mem RAM             Maximal RAM usage for memory saving mode" << endl
+            << "  -dbin                Store distances in single precision, memory-mapped to" << endl
+            << "                       a binary .mldist file (for very many taxa); BIONJ still" << endl
+            << "                       needs an in-memory copy of the condensed matrix" << endl
             << "  --runs NUMBER        Number of indepedent runs (default: 1)" << endl
             << endl << "CHECKPOINTING TO RESUME STOPPED RUN:" << endl
             << "  -redo                Redo analysis even for successful runs (default: resume)" << endl
             << "  -cptime <seconds>    Minimum checkpoint time interval (default: 60 sec)" << endl
+            << "  -cptext              Write checkpoint as gzipped text .ckp.gz instead of binary .ckp.bin" << endl
             << endl << "LIKELIHOOD MAPPING ANALYSIS:" << endl
             << "  -lmap <#quartets>    Number of quartets for likelihood mapping analysis" << endl
             << "  -lmclust <clustfile> NEXUS file containing clusters for likelihood mapping" << endl
@@ -3698,6 +3757,8 @@ void usage_iqtree(char* argv[], bool full_command) {
             << "  -bcor <min_corr>     Minimum correlation coefficient (default: 0.99)" << endl
 			<< "  -beps <epsilon>      RELL epsilon to break tie (default: 0.5)" << endl
             << "  -bnni                Optimize UFBoot trees by NNI on bootstrap alignment" << endl
+            << "  -bbatch <#trees>     Score RELL of #trees at once by matrix kernel (default: 0)" << endl
+            << "  -bcompact            Store UFBoot replicate counts as 8-bit integers" << endl
             << "  -j <jackknife>       Proportion of sites for jackknife (default: NONE)" << endl
             << endl << "STANDARD NON-PARAMETRIC BOOTSTRAP:" << endl
             << "  -b <#replicates>     Bootstrap + ML tree + consensus tree (>=100)" << endl
@@ -3878,6 +3939,7 @@ void usage_iqtree(char* argv[], bool full_command) {
             << "  -zb <#replicates>    Performing BP,KH,SH,ELW tests for trees passed via -z" << endl
             << "  -zw                  Also performing weighted-KH and weighted-SH tests" << endl
             << "  -au                  Also performing approximately unbiased (AU) test" << endl
+            << "  -zpar                Evaluate trees passed via -z concurrently, one per thread" << endl
             << endl << "ANCESTRAL STATE RECONSTRUCTION:" << endl
             << "  -asr                 Ancestral state reconstruction by empirical Bayes" << endl
             << "  -asr-min <prob>      Min probability of ancestral state (default: equil freq)" << endl
@@ -4211,6 +4273,7 @@ int finish_random() {
 /******************/
 
 int *randstream;
+int *thread_randstream = NULL;
 
 int init_random(int seed, bool write_info, int** rstream) {
     //    srand((unsigned) time(NULL));
@@ -4269,6 +4332,8 @@ int random_int(int a, int b) {
 }
 
 double random_double(int *rstream) {
+    if (!rstream)
+        rstream = thread_randstream;
 #ifndef FIXEDINTRAND
 #ifndef PARALLEL
 #if RAN_TYPE == RAN_STANDARD
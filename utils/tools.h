@@ -805,6 +805,9 @@ public:
     /** true if sequential phylip format is used, default: false (interleaved format) */
     bool phylip_sequential_format;
 
+    /** true to read FASTA alignment via memory mapping and parallel pattern compression */
+    bool mmap_alignment;
+
     /**
             file containing multiple trees to evaluate at the end
      */
@@ -819,6 +822,9 @@ public:
     /** true to do the approximately unbiased (AU) test */
     bool do_au_test;
 
+    /** true to evaluate the trees passed via -z concurrently, one tree per thread */
+    bool topotest_parallel_trees;
+
     /**
             file specifying partition model
      */
@@ -1034,6 +1040,12 @@ public:
      */
     bool compute_ml_dist;
 
+    /**
+            TRUE to store distances as a condensed single-precision matrix,
+            memory-mapped to a binary distance file, default: FALSE
+     */
+    bool dist_binary;
+
     /**
             TRUE to compute the maximum-likelihood tree
      */
@@ -1542,6 +1554,9 @@ public:
     /** TRUE to force using non-reversible likelihood kernel */
     bool kernel_nonrev;
 
+    /** TRUE to store partial likelihoods in single precision during tree search, default: FALSE */
+    bool partial_lh_float;
+
     /**
      	 	WSL_NONE: do not print anything
             WSL_SITE: print site log-likelihood
@@ -1806,6 +1821,15 @@ public:
 	/** true to print all UFBoot trees to a file */
 	int print_ufboot_trees;
 
+    /**
+        number of trees collected before their RELL scores are computed at once
+        by the blocked matrix kernel (0: score every tree on its own)
+     */
+    int ufboot_batch;
+
+    /** true to store UFBoot replicate counts as BootCountType instead of BootValType */
+    bool ufboot_compact;
+
     /**********************************************/
     /**** variables for jackknife ******************/
 
@@ -1964,6 +1988,9 @@ public:
 
     /** time (in seconds) between checkpoint dump */
     int checkpoint_dump_interval;
+
+    /** true to write checkpoint files in the gzipped text format instead of the binary format */
+    bool checkpoint_text;
     /** TRUE to print quartet log-likelihoods to .quartetlh file */
     bool print_lmap_quartet_lh;
 
@@ -2080,6 +2107,15 @@ void outError(const char *error, string msg, bool quit = true);
 void outWarning(const char *warn);
 void outWarning(string warn);
 
+/**
+    output of the calling thread to cout, appended here instead of printed if not NULL.
+    Set by concurrent tasks whose output is printed later in a fixed order (e.g. testModelsParallel)
+*/
+extern string *thread_cout_buffer;
+#ifdef _OPENMP
+#pragma omp threadprivate(thread_cout_buffer)
+#endif
+
 
 /** safe version of std::getline to deal with files from different platforms */ 
 std::istream& safeGetline(std::istream& is, std::string& t);
@@ -2407,6 +2443,15 @@ double computePValueChiSquare(double x, int df);
 
 extern int *randstream;
 
+/**
+    random stream of the calling thread for functions called without a stream, randstream if NULL.
+    Set by concurrent tasks that need reproducible random numbers (e.g. testModelsParallel)
+*/
+extern int *thread_randstream;
+#ifdef _OPENMP
+#pragma omp threadprivate(thread_randstream)
+#endif
+
 /**
  * initialize the random number generator
  * @param seed seed for generator